@@ -5,13 +5,19 @@
 #include <climits>
 #include <type_traits>
 #include <array>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "utils/gl_utils.h"
+#include "utils/gl_program_cache.h"
 #include "utils/interactive_window.h"
 
+#include "renderer/weighted_oit.h"
+
 #include "geometry/tile_mesh.h"
 
 using namespace std;
@@ -24,11 +30,49 @@ using RenderMesh = TileMesh<TEXTURED, QuadPlanarTileSet>;
 class App: public InteractiveGLWindow {
   GLProgramBuilder programBuilder;
 
-  GLuint renderProgram = 0;
+  // The variants of the wall programs, built the first time a frame draws with one
+  GLProgramCache wallPrograms{programBuilder};
+
+  // The renderer's defines, which every wall program variant is built with
+  vector<string> rendererDefines;
+
   GLuint solidColorProgram = 0;
 
+  // A wall program variant and its uniforms, resolved once when the variant is built
+  struct WallUniforms {
+    GLUniform<GLint> texid;
+    GLUniform<GLint> depthId;
+    GLUniform<GLint> viewLayers;
+    GLUniform<mat4> reprojMat;
+  };
+  struct WallVariant {
+    GLuint program = 0;
+    WallUniforms uniforms;
+  };
+
+  // The wall variants by [instanced][orderIndependent], so picking one each frame is a lookup
+  // rather than building and hashing its defines. program is 0 until the variant is built.
+  WallVariant wallVariants[2][2];
+  GLUniform<vec4> solidColor;
+
+  // Reused every frame, so recording draws doesn't allocate
+  DrawList drawList;
+
   unique_ptr<RenderMesh> tileMesh;
 
+  unique_ptr<WeightedBlendedOIT> oit;
+
+  // Frames drawn in each blend mode when benchmarking them against each other
+  static const size_t NUM_BENCHMARK_FRAMES = 100;
+
+  // Timer queries in flight when benchmarking. Each is read back this many frames after it
+  // was issued, so reading it doesn't wait for the GPU to finish the frame just submitted.
+  static const size_t NUM_BENCHMARK_QUERIES = 4;
+
+  // How far ahead and at how many points along the way to predict the camera for prefetching
+  static constexpr float PREFETCH_SECONDS = 0.3f;
+  static const size_t NUM_PREFETCH_STEPS = 3;
+
   Mode mode;
 
   class Config {
@@ -36,6 +80,16 @@ class App: public InteractiveGLWindow {
     std::array<Quad4, 4> mirrorFaces = RenderMesh::edgeFaces();
   public:
     bool showWireFrame = false;
+    bool showFloorAndCeiling = false;
+
+    // Draw walls with weighted blended OIT instead of sorting them back to front
+    bool orderIndependent = false;
+
+    bool runBenchmark = false;
+
+    // Print how many GL calls the renderer's state cache made and skipped last frame, and
+    // how much texture memory sharing layers between tile views saves
+    bool printStateStats = false;
 
     Quad4 currentMirror() {
       return mirrorFaces[mirrorViewId];
@@ -56,27 +110,26 @@ public:
     programBuilder.addIncludeDir("shaders/glsl330");
     programBuilder.addIncludeDir("shaders");
 
+    // The wall programs are drawn by the renderer, indirectly if it can
+    rendererDefines = rndr.programDefines();
+
     if(mode == IDENTIFIED) {
       rndr.enableDepthBuffer();
-
-      renderProgram = programBuilder.buildFromFiles(
-          "shaders/tile_color_vert.glsl",
-          "shaders/tile_color_frag.glsl");
-
     } else if(mode == TEXTURED) {
       rndr.enableAlphaBlending();
       glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-      renderProgram = programBuilder.buildFromFiles(
-          "shaders/solid_texture_vert.glsl",
-          "shaders/solid_texture_frag.glsl");
+      oit = make_unique<WeightedBlendedOIT>(programBuilder, width(), height());
     }
 
     solidColorProgram = programBuilder.buildFromFiles(
         "shaders/solid_color_vert.glsl",
         "shaders/solid_color_frag.glsl");
+    solidColor = programBuilder.reflection(solidColorProgram).uniform<vec4>("color");
 
     tileMesh = make_unique<RenderMesh>(5);
+
+    // Build the variant the first frame draws with now, rather than in the middle of it
+    wallVariant(false);
   }
 
   void onUpdate() {
@@ -87,12 +140,60 @@ public:
     }
 
     camera().setPerspectiveProjection(p[0].x, p[1].x, p[1].y, p[0].y, 1.0 - p[0].z, 10000.0);
+
+    // Prefetch the views the camera will see if it keeps moving the way it is
+    vector<TileViewResidency::PredictedCamera> predictions;
+    for(size_t i = 1; i <= NUM_PREFETCH_STEPS; i++) {
+      const float t = PREFETCH_SECONDS * i / NUM_PREFETCH_STEPS;
+      predictions.push_back({ t, camera().getProjectionMatrix() * camera().predictViewMatrix(t) });
+    }
+    const mat4 viewProj = camera().getProjectionMatrix() * camera().getViewMatrix();
+    tileMesh->updateResidency(viewProj, predictions);
+
+    // Only the chunks of walls in view are sorted and drawn
+    tileMesh->updateVisibleChunks(viewProj, camera().getPosition());
+
+    // Keep the walls sorted back to front from where the camera is now, so they blend correctly.
+    // OIT doesn't care about the order.
+    if(!config.orderIndependent) {
+      tileMesh->updateDepthOrder(camera().getPosition());
+    }
   }
 
   void onEvent(const SDL_Event& evt) {
     if(isKeyDownEvent(evt, SDLK_t)) {
         config.showWireFrame = !config.showWireFrame;
     }
+    if(isKeyDownEvent(evt, SDLK_f)) {
+      config.showFloorAndCeiling = !config.showFloorAndCeiling;
+    }
+    if(isKeyDownEvent(evt, SDLK_g)) {
+      if(tileMesh->gpuSortingEnabled()) {
+        tileMesh->disableGpuSorting();
+        cout << "Sorting walls on the CPU" << endl;
+      } else if(tileMesh->enableGpuSorting(programBuilder)) {
+        cout << "Sorting walls on the GPU" << endl;
+      } else {
+        cout << "GPU wall sorting needs OpenGL 4.3 and non-instanced walls" << endl;
+      }
+    }
+    if(isKeyDownEvent(evt, SDLK_i) && tileMesh->setInstanced(!tileMesh->instanced())) {
+      const auto start = chrono::steady_clock::now();
+      tileMesh->geometry();
+      const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      cout << (tileMesh->instanced() ? "Instanced" : "Non-instanced") << " walls: rebuilt in " << ms <<
+              " ms, " << tileMesh->geometryBytes() << " bytes of geometry" << endl;
+    }
+    if(isKeyDownEvent(evt, SDLK_o) && oit) {
+      config.orderIndependent = !config.orderIndependent;
+      cout << (config.orderIndependent ? "Blending walls with weighted blended OIT" : "Blending sorted walls") << endl;
+    }
+    if(isKeyDownEvent(evt, SDLK_b) && oit) {
+      config.runBenchmark = true;
+    }
+    if(isKeyDownEvent(evt, SDLK_c)) {
+      config.printStateStats = true;
+    }
     if(isKeyDownEvent(evt, SDLK_v)) {
       config.nextMirror();
 
@@ -104,10 +205,38 @@ public:
     }
   }
 
-  void onDraw(Renderer& rndr) {
-    rndr.clearViewport();
+  /*
+   * The wall program specialized for how the walls are drawn now. Only the code for the mode,
+   * the wall layout and the blending is compiled into each variant.
+   */
+  const WallVariant& wallVariant(bool orderIndependent) {
+    WallVariant& variant = wallVariants[tileMesh->instanced() ? 1 : 0][orderIndependent ? 1 : 0];
+    if(variant.program != 0) {
+      return variant;
+    }
+
+    ShaderDefines defines(rendererDefines);
+    defines.enable("TILE_INSTANCED", tileMesh->instanced());
+    defines.enable("TILE_OIT", orderIndependent);
+
+    if(mode == IDENTIFIED) {
+      variant.program = wallPrograms.program("shaders/tile_color_vert.glsl", "shaders/tile_color_frag.glsl", defines);
+    } else {
+      variant.program = wallPrograms.program("shaders/solid_texture_vert.glsl", "shaders/solid_texture_frag.glsl", defines);
+    }
+
+    const GLProgramReflection& reflection = wallPrograms.reflection(variant.program);
+    variant.uniforms = WallUniforms{
+      reflection.uniform<GLint>("texid"), reflection.uniform<GLint>("depthId"),
+      reflection.uniform<GLint>("viewLayers"), reflection.uniform<mat4>("reprojMat") };
+    return variant;
+  }
 
-    rndr.setProgram(renderProgram);
+  void drawWalls(Renderer& rndr, bool orderIndependent) {
+    const WallVariant& variant = wallVariant(orderIndependent);
+    const GLuint program = variant.program;
+    rndr.setProgram(program);
+    const WallUniforms& uniforms = variant.uniforms;
 
     float f = 1.0; // TODO: I think this is a problem and we should have an f for each mirror
     vec3 c = camera().getPosition();
@@ -122,23 +251,157 @@ public:
 //                                vec4(0,        0,        f,   -f*c.z),
 //                                vec4(0,        0,        1,   -c.z));
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, tileMesh->tileTextureArray());
-    glUniform1i(glGetUniformLocation(renderProgram, "texid"), 0);
+    // Uniforms stay set in the program until the draw list is submitted
+    uniforms.texid.set(0);
+    uniforms.depthId.set(1);
+    uniforms.viewLayers.set(2);
+    uniforms.reprojMat.set(reprojectionMat);
+
+    // The walls are already in back to front order, so they go in as one packet
+    const Geometry& geometry = tileMesh->geometry();
+    drawList.record(0, DrawList::LayerOrder::BACK_TO_FRONT, program, nullptr, {
+        { 0, GL_TEXTURE_2D_ARRAY, tileMesh->tileTextureArray() },
+        { 1, GL_TEXTURE_2D_ARRAY, tileMesh->tileDepthTextureArray() },
+        { 2, GL_TEXTURE_BUFFER, tileMesh->tileViewTable() } },
+        geometry, mat4(1.0), 0.0f, GL_TRIANGLES,
+        tileMesh->instanced() ? nullptr : &tileMesh->visibleRanges(),
+        tileMesh->instanced() ? tileMesh->numWallInstances() : 0);
+    rndr.submit(drawList);
+  }
+
+  void drawScene(Renderer& rndr, bool orderIndependent) {
+    rndr.clearViewport();
+
+    if(orderIndependent) {
+      oit->beginAccumulation(rndr.state());
+      drawWalls(rndr, true);
+      oit->composite(rndr.state());
+    } else {
+      drawWalls(rndr, false);
+    }
+  }
+
+  struct BenchmarkResult {
+    double cpuMs = 0.0;
+    double gpuMs = 0.0;
+    vector<uint8_t> image;
+  };
+
+  /*
+   * Draw the current view NUM_BENCHMARK_FRAMES times in one blend mode. The sorted mode
+   * re-sorts for an eye which moves a little every frame, so the sort does the work it would
+   * while the camera is moving. The image is read back from the last frame, which is drawn from
+   * the real camera position. CPU times stop once a frame is submitted, and GPU times are read
+   * from a ring of timer queries a few frames later, so neither includes waiting on the other.
+   */
+  BenchmarkResult benchmarkBlendMode(Renderer& rndr, bool orderIndependent) {
+    BenchmarkResult result;
+    GLuint queries[NUM_BENCHMARK_QUERIES];
+    glGenQueries(NUM_BENCHMARK_QUERIES, queries);
+
+    auto readQuery = [&](GLuint query) {
+      GLuint64 elapsedNs = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsedNs);
+      result.gpuMs += elapsedNs / 1e6;
+    };
+
+    const vec3 eye = camera().getPosition();
+    for(size_t i = 0; i < NUM_BENCHMARK_FRAMES; i++) {
+      const bool last = i + 1 == NUM_BENCHMARK_FRAMES;
+      const float angle = 6.2832f * i / NUM_BENCHMARK_FRAMES;
+
+      // The query last issued NUM_BENCHMARK_QUERIES frames ago is most likely done by now
+      const GLuint query = queries[i % NUM_BENCHMARK_QUERIES];
+      if(i >= NUM_BENCHMARK_QUERIES) {
+        readQuery(query);
+      }
+
+      const auto start = chrono::steady_clock::now();
+      if(!orderIndependent) {
+        tileMesh->updateDepthOrder(last ? eye : eye + 0.5f * vec3(cos(angle), 0.0, sin(angle)));
+      }
+      glBeginQuery(GL_TIME_ELAPSED, query);
+      drawScene(rndr, orderIndependent);
+      glEndQuery(GL_TIME_ELAPSED);
+      result.cpuMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    for(size_t i = NUM_BENCHMARK_FRAMES - std::min(size_t(NUM_BENCHMARK_FRAMES), size_t(NUM_BENCHMARK_QUERIES));
+        i < NUM_BENCHMARK_FRAMES; i++) {
+      readQuery(queries[i % NUM_BENCHMARK_QUERIES]);
+    }
+    result.cpuMs /= NUM_BENCHMARK_FRAMES;
+    result.gpuMs /= NUM_BENCHMARK_FRAMES;
+
+    result.image.resize(width() * height() * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width(), height(), GL_RGBA, GL_UNSIGNED_BYTE, result.image.data());
+
+    glDeleteQueries(NUM_BENCHMARK_QUERIES, queries);
+    return result;
+  }
+
+  /*
+   * Compare frame times and images of sorted alpha blending and weighted blended OIT
+   */
+  void benchmarkBlendModes(Renderer& rndr) {
+    const BenchmarkResult sorted = benchmarkBlendMode(rndr, false);
+    const BenchmarkResult oitResult = benchmarkBlendMode(rndr, true);
+
+    size_t sumDiff = 0, maxDiff = 0, numDifferentPixels = 0;
+    for(size_t p = 0; p < sorted.image.size(); p += 4) {
+      size_t pixelDiff = 0;
+      for(size_t c = 0; c < 3; c++) {
+        const size_t d = abs(int(sorted.image[p + c]) - int(oitResult.image[p + c]));
+        sumDiff += d;
+        pixelDiff = std::max(pixelDiff, d);
+      }
+      maxDiff = std::max(maxDiff, pixelDiff);
+      numDifferentPixels += pixelDiff > 2 ? 1 : 0;
+    }
+    const size_t numPixels = sorted.image.size() / 4;
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, tileMesh->tileDepthTextureArray());
-    glUniform1i(glGetUniformLocation(renderProgram, "depthId"), 1);
+    cout << "Sorted: " << sorted.cpuMs << " ms CPU (sort and submit), " << sorted.gpuMs << " ms GPU" << endl;
+    cout << "OIT:    " << oitResult.cpuMs << " ms CPU (submit), " << oitResult.gpuMs << " ms GPU" << endl;
+    cout << "Image difference: mean " << double(sumDiff) / (numPixels * 3) << "/255, max " << maxDiff <<
+            "/255, " << 100.0 * numDifferentPixels / numPixels << "% of pixels differ by more than 2/255" << endl;
+  }
+
+  void onDraw(Renderer& rndr) {
+    if(config.printStateStats) {
+      config.printStateStats = false;
+      const GLStateCache::Stats& stats = rndr.lastFrameStateStats();
+      cout << "GL state changes last frame: " << stats.issued << " made, " << stats.elided << " skipped" << endl;
+
+      if(const TileViewResidency* residency = tileMesh->residency()) {
+        cout << residency->numSharedViews() << " of " << residency->numPagedInViews() <<
+                " paged in tile views share a layer with another view (" << residency->numMirroredViews() <<
+                " as mirror images), saving " << residency->numSharedViews() * residency->bytesPerLayer() / (1024 * 1024) <<
+                " MiB of texture memory" << endl;
+      }
+
+      const VertexCacheStats& welded = tileMesh->weldedCacheStats();
+      if(welded.numTriangles > 0) {
+        cout << "Welded wall geometry: " << welded.numTriangles << " triangles, ACMR " << welded.acmrBefore <<
+                " -> " << welded.acmrAfter << endl;
+      }
+    }
+
+    if(config.runBenchmark) {
+      config.runBenchmark = false;
+      benchmarkBlendModes(rndr);
+
+      // Leave the walls sorted for the camera for the next sorted frame
+      tileMesh->updateDepthOrder(camera().getPosition());
+    }
 
-    glUniformMatrix4fv(glGetUniformLocation(renderProgram, "reprojMat"), 1, GL_FALSE, value_ptr(reprojectionMat));
-    rndr.draw(tileMesh->geometry(), mat4(1.0), PrimitiveType::TRIANGLES);
+    drawScene(rndr, config.orderIndependent);
 
     if(config.showWireFrame) {
       glLineWidth(3.0);
       rndr.setProgram(solidColorProgram);
-      glUniform4fv(glGetUniformLocation(solidColorProgram, "color"), 1, value_ptr(vec4(0.0, 1.0, 0.0, 1.0)));
+      solidColor.set(vec4(0.0, 1.0, 0.0, 1.0));
       glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-      rndr.draw(tileMesh->geometry(), scale(mat4(1.0), vec3(1.0)), PrimitiveType::TRIANGLES);
+      rndr.draw(tileMesh->weldedGeometry(config.showFloorAndCeiling), scale(mat4(1.0), vec3(1.0)), PrimitiveType::TRIANGLES);
       glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
     }
   }
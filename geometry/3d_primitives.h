@@ -5,8 +5,8 @@
 #include <array>
 #include <algorithm>
 #include <type_traits>
-#include <iostream>
 #include <tuple>
+#include <utility>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
@@ -14,6 +14,8 @@
 
 #include "utils/gl_utils.h"
 #include "vertex.h"
+#include "index_optimizer.h"
+#include "geometry_pool.h"
 
 #ifndef GEOMETRY_H_
 #define GEOMETRY_H_
@@ -24,10 +26,84 @@ struct vertexPosNormTex {
   glm::vec2 texcoord;
 };
 
+/*
+ * Ranges of an index buffer to draw with one glMultiDrawElementsBaseVertex call. offsets are
+ * byte offsets into the index buffer, as glMultiDrawElements takes them. Each range's base
+ * vertex is added to the geometry's own, so the indices of a range can be relative to the
+ * range's first vertex and fit in 16 bits however many vertices the geometry has.
+ */
+struct IndexRanges {
+  std::vector<GLsizei> counts;
+  std::vector<const GLvoid*> offsets;
+  std::vector<GLint> baseVertices;
+
+  /*
+   * Add numIndices indices starting at firstIndex, merging them into the last range if they
+   * carry straight on from it with the same base vertex
+   */
+  void add(size_t firstIndex, size_t numIndices, size_t indexSize, GLint baseVertex = 0) {
+    const size_t offset = firstIndex * indexSize;
+    if(!counts.empty() && reinterpret_cast<size_t>(offsets.back()) + counts.back() * indexSize == offset &&
+       baseVertices.back() == baseVertex) {
+      counts.back() += numIndices;
+      return;
+    }
+    counts.push_back(numIndices);
+    offsets.push_back(reinterpret_cast<const GLvoid*>(offset));
+    baseVertices.push_back(baseVertex);
+  }
+
+  void clear() {
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+  }
+
+  size_t size() const {
+    return counts.size();
+  }
+};
+
+/*
+ * Owns the buffers and vertex arrays it draws with, or its ranges of a GeometryPool, and
+ * releases them when it is destroyed. It can be moved but not copied, so each is released
+ * exactly once.
+ */
 class Geometry {
+  /*
+   * Make the vertex array for drawing a line along the normal of each of g's vertices, which
+   * must be laid out like vertexPosNormTex. It reads the position and normal of g's own
+   * vertices once per instance, so each line is an instance of a two vertex draw.
+   */
+  static void makeNormalView(Geometry& g) {
+    const size_t first = g.base_vertex * sizeof(vertexPosNormTex);
+    glGenVertexArrays(1, &g.normal_view_vao);
+    glBindVertexArray(g.normal_view_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, g.vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(vertexPosNormTex), (void*) first);
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertexPosNormTex), (void*) (first + sizeof(glm::vec4)));
+    glVertexAttribDivisor(1, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
 public:
+  // The most vertices which can be addressed with 16 bit indices
+  static const size_t MAX_SHORT_INDEXED_VERTICES = 65536;
+
+  /*
+   * Allocate buffers for num_vertices vertices and num_indices indices. If vertex_data and
+   * index_data are given, they are uploaded as the buffers' initial contents. Given indices are
+   * stored as 16 bits when there are few enough vertices; check index_type before writing to
+   * the index buffer.
+   */
   template <class Vertex>
-  static Geometry makeGeometry(GLuint num_vertices, GLuint num_indices) {
+  static Geometry makeGeometry(GLuint num_vertices, GLuint num_indices,
+                               const void* vertex_data = nullptr, const GLuint* index_data = nullptr) {
+    utils::ScopedVertexArrayUnbind unbindVao;
     Geometry g;
     g.num_vertices = num_vertices;
     g.num_indices = num_indices;
@@ -35,29 +111,61 @@ public:
     glGenBuffers(1, &g.vbo);
     glBindBuffer(GL_ARRAY_BUFFER, g.vbo);
     glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(Vertex),
-                 nullptr, GL_STATIC_DRAW);
+                 vertex_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, &g.ibo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
+    if(index_data != nullptr && num_vertices <= MAX_SHORT_INDEXED_VERTICES) {
+      const std::vector<GLushort> short_indices(index_data, index_data + num_indices);
+      g.index_type = GL_UNSIGNED_SHORT;
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(GLushort), short_indices.data(), GL_STATIC_DRAW);
+    } else {
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(GLuint), index_data, GL_STATIC_DRAW);
+    }
 
     g.vao = geometry::generateVAO<Vertex>();
 
-    glGenBuffers(1, &g.normal_view_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, g.normal_view_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices * 2 * sizeof(glm::vec4), nullptr, GL_STATIC_DRAW);
+    return g;
+  }
 
-    glGenVertexArrays(1, &g.normal_view_vao);
-    glBindVertexArray(g.normal_view_vao);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  /*
+   * Allocate num_vertices vertices and num_indices indices from pool, which must hold vertices
+   * of type Vertex, uploading vertex_data and index_data if they are given. The geometry
+   * draws with the pool's buffers and vertex array from its own first index and base vertex,
+   * and its indices are the pool's index type. Given indices are narrowed for a 16 bit pool,
+   * so they must all fit in 16 bits.
+   */
+  template <class Vertex>
+  static Geometry makeGeometry(GeometryPool& pool, GLuint num_vertices, GLuint num_indices,
+                               const void* vertex_data = nullptr, const GLuint* index_data = nullptr) {
+    std::vector<GLushort> short_indices;
+    const void* indices = index_data;
+    if(index_data != nullptr && pool.indexType() == GL_UNSIGNED_SHORT) {
+      if(num_indices > 0 && *std::max_element(index_data, index_data + num_indices) >= MAX_SHORT_INDEXED_VERTICES) {
+        throw std::runtime_error("Geometry has indices too large for a GeometryPool with 16 bit indices");
+      }
+      short_indices.assign(index_data, index_data + num_indices);
+      indices = short_indices.data();
+    }
+
+    utils::ScopedVertexArrayUnbind unbindVao;
+    Geometry g;
+    g.num_vertices = num_vertices;
+    g.num_indices = num_indices;
+    g.index_type = pool.indexType();
+    g.pool = &pool;
+    g.allocation = pool.allocate(sizeof(Vertex), num_vertices, num_indices, vertex_data, indices);
+    g.vbo = pool.vbo();
+    g.ibo = pool.ibo();
+    g.vao = pool.vao();
+    g.base_vertex = g.allocation.firstVertex;
+    g.first_index = g.allocation.firstIndex;
 
     return g;
   }
 
   Geometry(GLuint num_vertices, GLuint num_indices) : num_vertices(num_vertices), num_indices(num_indices) {
+    utils::ScopedVertexArrayUnbind unbindVao;
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(vertexPosNormTex), nullptr, GL_STATIC_DRAW);
@@ -78,35 +186,95 @@ public:
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glGenBuffers(1, &normal_view_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, normal_view_vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices * 2 * sizeof(glm::vec4), nullptr, GL_STATIC_DRAW);
-
-    glGenVertexArrays(1, &normal_view_vao);
-    glBindVertexArray(normal_view_vao);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    makeNormalView(*this);
   }
 
   Geometry() {}
+
+  Geometry(const Geometry&) = delete;
+  Geometry& operator=(const Geometry&) = delete;
+
+  Geometry(Geometry&& other) {
+    *this = std::move(other);
+  }
+
+  Geometry& operator=(Geometry&& other) {
+    if(this != &other) {
+      release();
+      vbo = other.vbo;
+      ibo = other.ibo;
+      vao = other.vao;
+      normal_view_vao = other.normal_view_vao;
+      normal_length = other.normal_length;
+      num_vertices = other.num_vertices;
+      num_indices = other.num_indices;
+      index_type = other.index_type;
+      base_vertex = other.base_vertex;
+      first_index = other.first_index;
+      pool = other.pool;
+      allocation = other.allocation;
+
+      // Leave other empty, so it doesn't release anything
+      other.vbo = other.ibo = other.vao = 0;
+      other.normal_view_vao = 0;
+      other.num_vertices = other.num_indices = 0;
+      other.pool = nullptr;
+    }
+    return *this;
+  }
+
   ~Geometry() {
-//    glDeleteBuffers(1, &vbo);
-//    glDeleteBuffers(1, &ibo);
-//    glDeleteBuffers(1, &normal_view_vbo);
-//    glDeleteVertexArrays(1, &vao);
-//    glDeleteVertexArrays(1, &normal_view_vao);
+    release();
+  }
+
+  /*
+   * Delete the buffers and vertex arrays, or free the ranges of the pool, leaving the geometry
+   * empty. Pool ranges are only reused once the draws issued so far have finished.
+   */
+  void release() {
+    if(normal_view_vao != 0) {
+      glDeleteVertexArrays(1, &normal_view_vao);
+    }
+    if(pool != nullptr) {
+      pool->free(allocation);
+    } else if(vao != 0) {
+      glDeleteVertexArrays(1, &vao);
+      glDeleteBuffers(1, &vbo);
+      glDeleteBuffers(1, &ibo);
+    }
+
+    vbo = ibo = vao = 0;
+    normal_view_vao = 0;
+    num_vertices = num_indices = 0;
+    base_vertex = 0;
+    first_index = 0;
+    pool = nullptr;
   }
 
   GLuint vbo = 0;
   GLuint ibo = 0;
   GLuint vao = 0;
-  GLuint normal_view_vbo = 0;
+  // Made for primitives and vertexPosNormTex geometry, see makeNormalView
   GLuint normal_view_vao = 0;
+  float normal_length = 0.0f;
   size_t num_vertices = 0;
   size_t num_indices = 0;
 
+  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  GLenum index_type = GL_UNSIGNED_INT;
+
+  // Where the geometry starts in its buffers, which are shared if it came from a pool
+  GLint base_vertex = 0;
+  size_t first_index = 0;
+
+  // The pool the geometry was allocated from, or nullptr if it has buffers of its own
+  GeometryPool* pool = nullptr;
+  GeometryPool::Allocation allocation = {};
+
+  size_t indexSize() const {
+    return index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  }
+
   static void compute_normals(vertexPosNormTex* vertices, GLuint* indices, size_t num_indices) {
     // Compute the normals of each triangle
     for(unsigned i = 0; i < num_indices; i += 3) {
@@ -124,14 +292,41 @@ public:
     }
   }
 
-  static Geometry make_cube(const glm::vec3& scale, bool invertNormals = false) {
-    Geometry ret(8, 36);
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    vertexPosNormTex* vertices = reinterpret_cast<vertexPosNormTex*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-    glBindBuffer(GL_ARRAY_BUFFER, ret.ibo);
-    GLuint* indices = reinterpret_cast<GLuint*>(glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_READ_WRITE));
+  /*
+   * Reorder the triangles and vertices of a primitive for the post-transform and pre-transform
+   * vertex caches, and upload it. The normal view draws a line of length normalLength along
+   * the normal of every vertex. The primitive is allocated from pool if one is given, and how
+   * much the reordering helped is written to cacheStats if one is given.
+   */
+  static Geometry makePrimitive(std::vector<vertexPosNormTex>& vertices, std::vector<GLuint>& indices, float normalLength,
+                                GeometryPool* pool = nullptr, geometry::VertexCacheStats* cacheStats = nullptr) {
+    static_assert(sizeof(geometry::Vertex4P3N2T) == sizeof(vertexPosNormTex), "Primitive vertices must match Vertex4P3N2T");
+
+    if(cacheStats != nullptr) {
+      cacheStats->numTriangles = indices.size() / 3;
+      cacheStats->acmrBefore = geometry::averageCacheMissRatio(indices, vertices.size());
+    }
+    geometry::optimizeVertexCache(indices, vertices.size());
+    geometry::remapVertices(vertices, geometry::optimizeVertexFetch(indices, vertices.size()));
+    if(cacheStats != nullptr) {
+      cacheStats->acmrAfter = geometry::averageCacheMissRatio(indices, vertices.size());
+    }
+
+    Geometry ret = pool != nullptr ?
+        makeGeometry<geometry::Vertex4P3N2T>(*pool, vertices.size(), indices.size(), vertices.data(), indices.data()) :
+        makeGeometry<geometry::Vertex4P3N2T>(vertices.size(), indices.size(), vertices.data(), indices.data());
 
+    {
+      utils::ScopedVertexArrayUnbind unbindVao;
+      makeNormalView(ret);
+    }
+    ret.normal_length = normalLength;
 
+    return ret;
+  }
+
+  static Geometry make_cube(const glm::vec3& scale, bool invertNormals = false, GeometryPool* pool = nullptr,
+                            geometry::VertexCacheStats* cacheStats = nullptr) {
     const float normalScale = invertNormals ? -1.0 : 1.0;
     const glm::vec4 v4scale(scale, 1.0);
 
@@ -157,52 +352,28 @@ public:
       glm::vec3(-0.577350,  0.577350, -0.577350),
     }};
 
-    const std::array<GLuint, 36> inds {{
+    std::vector<GLuint> indices {
       0, 1, 2, 2, 3, 0,
       3, 2, 6, 6, 7, 3,
       7, 6, 5, 5, 4, 7,
       4, 0, 3, 3, 7, 4,
       1, 0, 5, 4, 5, 0,
       1, 5, 6, 6, 2, 1
-    }};
+    };
 
+    std::vector<vertexPosNormTex> vertices(verts.size());
     for(size_t i = 0; i < verts.size(); i++) {
       vertices[i].position = v4scale * verts[i];
       vertices[i].normal = normalScale * norms[i];
     }
-    std::copy(inds.begin(), inds.end(), indices);
-
-    glBindBuffer(GL_ARRAY_BUFFER, ret.normal_view_vbo);
-    glm::vec4* normals = reinterpret_cast<glm::vec4*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
 
-    for(unsigned j = 0, i = 0; j < ret.num_vertices; i+=2) {
-      normals[i] = vertices[j].position;
-      normals[i+1] = normals[i] + glm::vec4(vertices[j].normal, 1.0f);
-      normals[i].w = 0.0;
-      normals[i+1].w = 1.0;
-      j+=1;
-    }
-
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    return ret;
+    return makePrimitive(vertices, indices, 1.0, pool, cacheStats);
   }
 
-  static Geometry make_plane(unsigned uSamples, unsigned vSamples) {
-    unsigned numVertices = (uSamples+1) * (vSamples+1);
-    unsigned numIndices = uSamples * vSamples * 6;
-
-    Geometry ret(numVertices, numIndices);
-
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    vertexPosNormTex* vertices = reinterpret_cast<vertexPosNormTex*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ret.ibo);
-    GLuint* indices = reinterpret_cast<GLuint*>(glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_READ_WRITE));
+  static Geometry make_plane(unsigned uSamples, unsigned vSamples, GeometryPool* pool = nullptr,
+                             geometry::VertexCacheStats* cacheStats = nullptr) {
+    std::vector<vertexPosNormTex> vertices((uSamples+1) * (vSamples+1));
+    std::vector<GLuint> indices(uSamples * vSamples * 6);
 
     for(unsigned i = 0; i <= uSamples; i++) {
       for(unsigned j = 0; j <= vSamples; j++) {
@@ -210,7 +381,7 @@ public:
                                 glm::vec2(static_cast<float>(uSamples)/2.0,
                                          static_cast<float>(vSamples)/2.0)) *
                                glm::vec2(1.0/(uSamples+1), 1.0/(vSamples+1));
-        const size_t vOffset = i*(uSamples + 1) + j;
+        const size_t vOffset = i*(vSamples + 1) + j;
 
         vertices[vOffset].position = glm::vec4(vPos, 0.0, 1.0);
         vertices[vOffset].texcoord = vPos + glm::vec2(0.5);
@@ -220,47 +391,25 @@ public:
 
     for(unsigned i = 0; i < uSamples; i++) {
       for(unsigned j = 0; j < vSamples; j++) {
-        const size_t iOffset = (i*uSamples + j) * 6;
-        const size_t iBase = i*(uSamples+1) + j;
+        const size_t iOffset = (i*vSamples + j) * 6;
+        const size_t iBase = i*(vSamples+1) + j;
 
         indices[iOffset + 0] = iBase;
         indices[iOffset + 1] = iBase + 1;
-        indices[iOffset + 2] = iBase + uSamples + 1;
+        indices[iOffset + 2] = iBase + vSamples + 1;
 
         indices[iOffset + 3] = iBase + 1;
-        indices[iOffset + 4] = iBase + uSamples + 2;
-        indices[iOffset + 5] = iBase + uSamples + 1;
+        indices[iOffset + 4] = iBase + vSamples + 2;
+        indices[iOffset + 5] = iBase + vSamples + 1;
       }
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, ret.normal_view_vbo);
-    glm::vec4* normals = reinterpret_cast<glm::vec4*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-
-    for(unsigned j = 0, i = 0; j < ret.num_vertices; i+=2) {
-      normals[i] = vertices[j].position;
-      normals[i+1] = normals[i] + glm::vec4(vertices[j].normal, 1.0f);
-      normals[i].w = 0.0;
-      normals[i+1].w = 1.0;
-      j+=1;
-    }
-
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    return ret;
+    return makePrimitive(vertices, indices, 1.0, pool, cacheStats);
   }
 
-  static Geometry make_triangle() {
-    Geometry ret(3, 3);
-
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    vertexPosNormTex* vertices = reinterpret_cast<vertexPosNormTex*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ret.ibo);
-    GLuint* indices = reinterpret_cast<GLuint*>(glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_READ_WRITE));
+  static Geometry make_triangle(GeometryPool* pool = nullptr, geometry::VertexCacheStats* cacheStats = nullptr) {
+    std::vector<vertexPosNormTex> vertices(3);
+    std::vector<GLuint> indices { 0, 1, 2 };
 
     vertices[0].position = {-0.5, -0.5, 0.0, 1.0 };
     vertices[1].position = { 0.5, -0.5, 0.0, 1.0 };
@@ -268,42 +417,16 @@ public:
     vertices[0].normal = { 0.0, 0.0, 1.0 };
     vertices[1].normal = { 0.0, 0.0, 1.0 };
     vertices[2].normal = { 0.0, 0.0, 1.0 };
-    indices[0] = 0;
-    indices[1] = 1;
-    indices[2] = 2;
-
 
-    compute_normals(vertices, indices, ret.num_indices);
-
-    glBindBuffer(GL_ARRAY_BUFFER, ret.normal_view_vbo);
-    glm::vec4* normals = reinterpret_cast<glm::vec4*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-
-    for(unsigned j = 0, i = 0; j < ret.num_vertices; i+=2) {
-      normals[i] = vertices[j].position;
-      normals[i+1] = normals[i] - (0.2f * glm::vec4(vertices[j].normal, 1.0f));
-      normals[i+1].w = 0.0;
-      normals[i].w = 1.0;
-      j+=1;
-    }
+    compute_normals(vertices.data(), indices.data(), indices.size());
 
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    return ret;
+    return makePrimitive(vertices, indices, -0.2, pool, cacheStats);
   }
 
-  static Geometry make_sphere(double radius, unsigned theta_samples, unsigned phi_samples) {
-    Geometry ret(theta_samples * phi_samples, phi_samples * 6 + (theta_samples - 2) * phi_samples * 6);
-
-    // Map vertex and index buffer objects for the sphere
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    vertexPosNormTex* vertices = reinterpret_cast<vertexPosNormTex*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ret.ibo);
-    GLuint* indices = reinterpret_cast<GLuint*>(glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_READ_WRITE));
+  static Geometry make_sphere(double radius, unsigned theta_samples, unsigned phi_samples, GeometryPool* pool = nullptr,
+                              geometry::VertexCacheStats* cacheStats = nullptr) {
+    std::vector<vertexPosNormTex> vertices((theta_samples - 1) * phi_samples + 2);
+    std::vector<GLuint> indices(phi_samples * 6 + (theta_samples - 2) * phi_samples * 6);
 
     // Variables hold the current vertex to write to
     unsigned vert_i = 0, ind_i = 0;
@@ -325,10 +448,7 @@ public:
     unsigned index_base = 1;
 
     // Cache of cosine and sine of each phi sample for reuse in inner loop
-    double* cos_sin_phi[2];
-    cos_sin_phi[0] = new double[2*phi_samples];
-    cos_sin_phi[1] = &(cos_sin_phi[0][phi_samples]);
-
+    std::vector<double> cos_phi(phi_samples), sin_phi(phi_samples);
 
     // Set the position of the top vertex
     vertices[vert_i].position = {0.0, -radius, 0.0, 1.0};
@@ -338,9 +458,9 @@ public:
     // Construct the top triangle of vertices connected to the top vertex
     for (unsigned j = 0; j < phi_samples; j++) {
       double phi = j * d_phi;
-      cos_sin_phi[0][j] = glm::cos(phi);
-      cos_sin_phi[1][j] = glm::sin(phi);
-      vertices[vert_i].position = {xz_rad * cos_sin_phi[0][j], y, xz_rad * cos_sin_phi[1][j], 1.0};
+      cos_phi[j] = glm::cos(phi);
+      sin_phi[j] = glm::sin(phi);
+      vertices[vert_i].position = {xz_rad * cos_phi[j], y, xz_rad * sin_phi[j], 1.0};
       vertices[vert_i].normal = glm::normalize(glm::vec3(vertices[vert_i].position));
       vert_i += 1;
 
@@ -356,7 +476,7 @@ public:
       y = radius * glm::sin(theta);
 
       for (unsigned j = 0; j < phi_samples; j++) {
-        vertices[vert_i].position = {xz_rad * cos_sin_phi[0][j], y, xz_rad * cos_sin_phi[1][j], 1.0};
+        vertices[vert_i].position = {xz_rad * cos_phi[j], y, xz_rad * sin_phi[j], 1.0};
         vertices[vert_i].normal = glm::normalize(glm::vec3(vertices[vert_i].position));
         vert_i += 1;
 
@@ -384,26 +504,7 @@ public:
     vertices[vert_i].normal = glm::normalize(glm::vec3(vertices[vert_i].position));
     vert_i += 1;
 
-    glBindBuffer(GL_ARRAY_BUFFER, ret.normal_view_vbo);
-    glm::vec4* normals = reinterpret_cast<glm::vec4*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-
-    for(unsigned j = 0, i = 0; j < ret.num_vertices; i+=2) {
-      normals[i] = vertices[j].position;
-      normals[i+1] = normals[i] + ((static_cast<float>(radius)/3.0f) * glm::vec4(vertices[j].normal, 1.0f));
-      normals[i].w = 0.0;
-      normals[i+1].w = 1.0;
-      j+=1;
-    }
-
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    delete cos_sin_phi[0];
-    return ret;
+    return makePrimitive(vertices, indices, static_cast<float>(radius)/3.0f, pool, cacheStats);
   }
 };
 
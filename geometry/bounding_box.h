@@ -0,0 +1,68 @@
+#include <array>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+#ifndef GEOMETRY_BOUNDING_BOX_H_
+#define GEOMETRY_BOUNDING_BOX_H_
+
+namespace geometry {
+
+/*
+ * Returns false if all of points are outside the same clip plane of viewProj, which means
+ * their convex hull can't be seen. Hulls which are outside near an edge of the frustum may
+ * still be reported as visible.
+ */
+template <size_t N>
+bool isInFrustum(const glm::mat4& viewProj, const std::array<glm::vec4, N>& points) {
+	std::array<glm::vec4, N> clip;
+	for(size_t i = 0; i < N; i++) {
+		clip[i] = viewProj * points[i];
+	}
+
+	for(int axis = 0; axis < 3; axis++) {
+		bool allBelow = true, allAbove = true;
+		for(size_t i = 0; i < N; i++) {
+			allBelow = allBelow && clip[i][axis] < -clip[i].w;
+			allAbove = allAbove && clip[i][axis] > clip[i].w;
+		}
+		if(allBelow || allAbove) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * An axis aligned bounding box. A default constructed box is empty and grows to fit the
+ * points added to it.
+ */
+struct AABB {
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+	void extend(const glm::vec3& p) {
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	glm::vec3 center() const {
+		return (min + max) / 2.0f;
+	}
+
+	std::array<glm::vec4, 8> corners() const {
+		std::array<glm::vec4, 8> ret;
+		for(size_t i = 0; i < 8; i++) {
+			ret[i] = glm::vec4(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z, 1.0);
+		}
+		return ret;
+	}
+
+	bool isInFrustum(const glm::mat4& viewProj) const {
+		return geometry::isInFrustum(viewProj, corners());
+	}
+};
+
+}
+
+#endif /* GEOMETRY_BOUNDING_BOX_H_ */
@@ -0,0 +1,263 @@
+#include <GL/glew.h>
+
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+#include "utils/gl_utils.h"
+#include "utils/range_allocator.h"
+#include "vertex.h"
+
+#ifndef GEOMETRY_POOL_H_
+#define GEOMETRY_POOL_H_
+
+/*
+ * One vertex buffer and one index buffer shared by many Geometry objects with the same vertex
+ * format, so they can all be drawn with one vertex array, and with one multi-draw call when
+ * they share a program and material. Each Geometry gets its own range of vertices and of
+ * indices. Its indices are relative to its first vertex and drawn with a base vertex, and are
+ * all of the pool's index type. A pool of 16 bit indices halves the index memory and
+ * bandwidth of geometry drawn in pieces of at most 65536 vertices each.
+ *
+ * Freed ranges may still be read by draws the GPU hasn't finished, so they are only reused
+ * once a fence inserted when they were freed has signaled. When the pool runs out of room it
+ * first waits for pending frees, then grows its buffers in place. Every Geometry holds the
+ * names of the buffers, so they keep their names when they grow.
+ *
+ * The pool must outlive the geometry allocated from it.
+ */
+class GeometryPool {
+public:
+	struct Allocation {
+		size_t firstVertex;
+		size_t numVertices;
+		size_t firstIndex;
+		size_t numIndices;
+	};
+
+private:
+	GLuint mVbo = 0;
+	GLuint mIbo = 0;
+	GLuint mVao = 0;
+	size_t mVertexSize = 0;
+	GLenum mIndexType = GL_UNSIGNED_INT;
+	size_t mIndexSize = sizeof(GLuint);
+
+	utils::RangeAllocator mVertices;
+	utils::RangeAllocator mIndices;
+
+	// Frees waiting for the GPU to finish the draws issued before them, oldest first
+	struct PendingFree {
+		GLsync fence;
+		Allocation allocation;
+	};
+	std::deque<PendingFree> mPending;
+
+	GeometryPool() = default;
+
+	/*
+	 * Reallocate buffer with newSize bytes, keeping its name and its first oldSize bytes
+	 */
+	static void growBuffer(GLuint buffer, size_t oldSize, size_t newSize) {
+		GLuint copy = 0;
+		glGenBuffers(1, &copy);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, copy);
+		glBufferData(GL_COPY_WRITE_BUFFER, oldSize, nullptr, GL_STATIC_COPY);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+
+		glBufferData(GL_COPY_READ_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+		glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, oldSize);
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &copy);
+	}
+
+	/*
+	 * Return the pending frees whose fences have signaled to the free ranges. Fences signal in
+	 * the order they were inserted, so this stops at the first which hasn't. If wait is true,
+	 * waits for every pending free instead.
+	 */
+	void reclaim(bool wait) {
+		while(!mPending.empty()) {
+			const GLuint64 timeout = wait ? GLuint64(1000000000) : 0;
+			const GLenum status = glClientWaitSync(mPending.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+			if(status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+				if(wait && status == GL_TIMEOUT_EXPIRED) {
+					continue;
+				}
+				return;
+			}
+
+			const Allocation& a = mPending.front().allocation;
+			mVertices.free(a.firstVertex, a.numVertices);
+			mIndices.free(a.firstIndex, a.numIndices);
+			glDeleteSync(mPending.front().fence);
+			mPending.pop_front();
+		}
+	}
+
+	/*
+	 * Grow allocator and buffer, whose elements are elementSize bytes, to fit size more
+	 * elements in one range
+	 */
+	static void grow(utils::RangeAllocator& allocator, GLuint buffer, size_t elementSize, size_t size) {
+		const size_t oldCapacity = allocator.capacity();
+		const size_t newCapacity = std::max(oldCapacity * 2, oldCapacity + size);
+		growBuffer(buffer, oldCapacity * elementSize, newCapacity * elementSize);
+		allocator.grow(newCapacity);
+	}
+
+public:
+	/*
+	 * A pool with room for vertexCapacity vertices of type Vertex, and indexCapacity indices of
+	 * indexType, GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+	 */
+	template <class Vertex>
+	static std::unique_ptr<GeometryPool> make(size_t vertexCapacity, size_t indexCapacity, GLenum indexType = GL_UNSIGNED_INT) {
+		if(indexType != GL_UNSIGNED_INT && indexType != GL_UNSIGNED_SHORT) {
+			throw std::runtime_error("GeometryPool indices must be GL_UNSIGNED_INT or GL_UNSIGNED_SHORT");
+		}
+
+		utils::ScopedVertexArrayUnbind unbindVao;
+		std::unique_ptr<GeometryPool> pool(new GeometryPool());
+		pool->mVertexSize = sizeof(Vertex);
+		pool->mIndexType = indexType;
+		pool->mIndexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		pool->mVertices = utils::RangeAllocator(vertexCapacity);
+		pool->mIndices = utils::RangeAllocator(indexCapacity);
+
+		glGenBuffers(1, &pool->mVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, pool->mVbo);
+		glBufferData(GL_ARRAY_BUFFER, vertexCapacity * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+
+		pool->mVao = geometry::generateVAO<Vertex>();
+
+		glGenBuffers(1, &pool->mIbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->mIbo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity * pool->mIndexSize, nullptr, GL_STATIC_DRAW);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return pool;
+	}
+
+	GeometryPool(const GeometryPool&) = delete;
+	GeometryPool& operator=(const GeometryPool&) = delete;
+
+	~GeometryPool() {
+		for(auto p = mPending.begin(); p != mPending.end(); p++) {
+			glDeleteSync(p->fence);
+		}
+		glDeleteVertexArrays(1, &mVao);
+		glDeleteBuffers(1, &mVbo);
+		glDeleteBuffers(1, &mIbo);
+	}
+
+	/*
+	 * Reserve room for numVertices vertices of vertexSize bytes and numIndices indices, and
+	 * upload vertexData and indexData, which holds indices of the pool's index type, to it if
+	 * they are given. Throws if the pool holds vertices of a different size.
+	 */
+	Allocation allocate(size_t vertexSize, size_t numVertices, size_t numIndices,
+	                    const void* vertexData = nullptr, const void* indexData = nullptr) {
+		if(vertexSize != mVertexSize) {
+			throw std::runtime_error("Allocated geometry from a GeometryPool with a different vertex format");
+		}
+
+		reclaim(false);
+		size_t firstVertex = mVertices.allocate(numVertices);
+		size_t firstIndex = mIndices.allocate(numIndices);
+		if((firstVertex == utils::RangeAllocator::FAILED || firstIndex == utils::RangeAllocator::FAILED) &&
+		   !mPending.empty()) {
+			// Rather wait for the ranges in flight than grow
+			if(firstVertex != utils::RangeAllocator::FAILED) {
+				mVertices.free(firstVertex, numVertices);
+			}
+			if(firstIndex != utils::RangeAllocator::FAILED) {
+				mIndices.free(firstIndex, numIndices);
+			}
+			reclaim(true);
+			firstVertex = mVertices.allocate(numVertices);
+			firstIndex = mIndices.allocate(numIndices);
+		}
+		if(firstVertex == utils::RangeAllocator::FAILED) {
+			grow(mVertices, mVbo, mVertexSize, numVertices);
+			firstVertex = mVertices.allocate(numVertices);
+		}
+		if(firstIndex == utils::RangeAllocator::FAILED) {
+			grow(mIndices, mIbo, mIndexSize, numIndices);
+			firstIndex = mIndices.allocate(numIndices);
+		}
+
+		if(vertexData != nullptr) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mVbo);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, firstVertex * mVertexSize, numVertices * mVertexSize, vertexData);
+		}
+		if(indexData != nullptr) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mIbo);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * mIndexSize, numIndices * mIndexSize, indexData);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		return Allocation{ firstVertex, numVertices, firstIndex, numIndices };
+	}
+
+	/*
+	 * Give the ranges of an allocation back to the pool, once the draws issued so far have
+	 * finished with them
+	 */
+	void free(const Allocation& allocation) {
+		mPending.push_back(PendingFree{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), allocation });
+	}
+
+	GLuint vbo() const {
+		return mVbo;
+	}
+
+	GLuint ibo() const {
+		return mIbo;
+	}
+
+	// Has the vertex attributes of the pool's vertex format, and its index buffer bound
+	GLuint vao() const {
+		return mVao;
+	}
+
+	size_t vertexSize() const {
+		return mVertexSize;
+	}
+
+	GLenum indexType() const {
+		return mIndexType;
+	}
+
+	size_t indexSize() const {
+		return mIndexSize;
+	}
+
+	size_t vertexCapacity() const {
+		return mVertices.capacity();
+	}
+
+	size_t indexCapacity() const {
+		return mIndices.capacity();
+	}
+
+	// Not counting ranges waiting for the GPU
+	size_t freeVertices() const {
+		return mVertices.freeSpace();
+	}
+
+	size_t freeIndices() const {
+		return mIndices.freeSpace();
+	}
+
+	size_t numPendingFrees() const {
+		return mPending.size();
+	}
+};
+
+#endif /* GEOMETRY_POOL_H_ */
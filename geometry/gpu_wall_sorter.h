@@ -0,0 +1,194 @@
+#include <GL/glew.h>
+
+#include <vector>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "utils/gl_program_builder.h"
+#include "utils/gl_stream_buffer.h"
+
+#ifndef GPU_WALL_SORTER_H_
+#define GPU_WALL_SORTER_H_
+
+namespace geometry {
+
+/*
+ * Sorts walls back to front on the GPU with a bitonic sort in a compute shader, and writes
+ * the sorted walls straight into an index buffer laid out like TileMesh's: wall w is made of
+ * vertices 4w to 4w+3, and takes 6 indices.
+ *
+ * Only the given ranges of walls are sorted, such as the walls of the chunks in view, and
+ * the sort only does work for as many walls as are in them. They are sorted together into one
+ * back to front order, so walls from different ranges interleave as their depths require.
+ *
+ * Needs OpenGL 4.3 for compute shaders and shader storage buffers. Everything it uses is
+ * core 4.3, so it also runs on software implementations such as Mesa's llvmpipe.
+ */
+class GPUWallSorter {
+	static const int PASS_COMPUTE_KEYS = 0;
+	static const int PASS_BITONIC_STEP = 1;
+	static const int PASS_WRITE_INDICES = 2;
+
+	// Must match local_size_x in sort_walls_comp.glsl
+	static const GLuint WORKGROUP_SIZE = 256;
+
+	GLuint mProgram = 0;
+	GLuint mCenterBuffer = 0;
+	GLuint mKeyBuffer = 0;
+	size_t mNumWalls = 0;
+	size_t mNumKeys = 0;
+
+	// Storage buffer ranges are bound from an offset which is a multiple of this
+	GLint mStorageAlignment = 1;
+
+	GLint mPassLoc, mEyeLoc, mNumWallsLoc, mNumRangesLoc, mNumKeysLoc, mKLoc, mJLoc, mShortIndicesLoc, mFirstWordLoc;
+
+	void dispatch(int pass) {
+		glUniform1i(mPassLoc, pass);
+		glDispatchCompute((mNumKeys + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+public:
+	static bool isSupported() {
+		return GLEW_VERSION_4_3;
+	}
+
+	GPUWallSorter(utils::GLProgramBuilder& programBuilder) {
+		if(!isSupported()) {
+			throw std::runtime_error("GPUWallSorter needs OpenGL 4.3");
+		}
+
+		mProgram = programBuilder.buildComputeProgramFromFile("shaders/sort_walls_comp.glsl");
+		mPassLoc = glGetUniformLocation(mProgram, "sortPass");
+		mEyeLoc = glGetUniformLocation(mProgram, "eye");
+		mNumWallsLoc = glGetUniformLocation(mProgram, "numWalls");
+		mNumRangesLoc = glGetUniformLocation(mProgram, "numRanges");
+		mNumKeysLoc = glGetUniformLocation(mProgram, "numKeys");
+		mKLoc = glGetUniformLocation(mProgram, "k");
+		mJLoc = glGetUniformLocation(mProgram, "j");
+		mShortIndicesLoc = glGetUniformLocation(mProgram, "shortIndices");
+		mFirstWordLoc = glGetUniformLocation(mProgram, "firstWord");
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &mStorageAlignment);
+
+		glGenBuffers(1, &mCenterBuffer);
+		glGenBuffers(1, &mKeyBuffer);
+	}
+
+	GPUWallSorter(const GPUWallSorter&) = delete;
+	GPUWallSorter& operator=(const GPUWallSorter&) = delete;
+
+	~GPUWallSorter() {
+		glDeleteBuffers(1, &mCenterBuffer);
+		glDeleteBuffers(1, &mKeyBuffer);
+		glDeleteProgram(mProgram);
+	}
+
+	/*
+	 * Set the center of every wall which may be sorted
+	 */
+	void setWalls(const std::vector<glm::vec3>& centers) {
+		mNumWalls = centers.size();
+		size_t maxKeys = 1;
+		while(maxKeys < mNumWalls) {
+			maxKeys *= 2;
+		}
+
+		// vec3 arrays are padded to vec4 in storage buffers
+		std::vector<glm::vec4> padded(centers.size());
+		for(size_t i = 0; i < centers.size(); i++) {
+			padded[i] = glm::vec4(centers[i], 0.0f);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCenterBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, padded.size() * sizeof(glm::vec4), padded.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mKeyBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, maxKeys * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	/*
+	 * Sort the walls in wallRanges, each (first wall, number of walls), back to front as seen
+	 * from eye, and write them to indexBuffer from index firstIndex on, which must be followed
+	 * by room for 6 indices of indexType (GL_UNSIGNED_INT or GL_UNSIGNED_SHORT) for every wall
+	 * sorted. 16 bit indices are written in pairs, so they must start at an even index. The
+	 * ranges must not overlap, and are streamed through uploads.
+	 * The program in use is restored afterwards, so this can run in the middle of drawing.
+	 */
+	void sort(const glm::vec3& eye, const std::vector<glm::uvec2>& wallRanges, utils::GLStreamBuffer& uploads,
+	          GLuint indexBuffer, GLenum indexType = GL_UNSIGNED_INT, size_t firstIndex = 0) {
+		// Where each range starts in the sorted walls
+		std::vector<glm::uvec2> ranges;
+		size_t numSorted = 0;
+		for(auto r = wallRanges.begin(); r != wallRanges.end(); r++) {
+			if(r->y > 0) {
+				ranges.push_back(glm::uvec2(r->x, numSorted));
+				numSorted += r->y;
+			}
+		}
+		if(numSorted == 0) {
+			return;
+		}
+		mNumKeys = 1;
+		while(mNumKeys < numSorted) {
+			mNumKeys *= 2;
+		}
+
+		const size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		const size_t offset = firstIndex * indexSize;
+		if(offset % sizeof(GLuint) != 0) {
+			throw std::runtime_error("GPUWallSorter can't write 16 bit indices from an odd index");
+		}
+
+		// Bind only the walls' range of the index buffer, from the nearest offset the binding
+		// allows, and skip the words before the range in the shader
+		const size_t boundOffset = offset - offset % mStorageAlignment;
+		const utils::GLStreamBuffer::Range rangeData = uploads.write(ranges.data(), ranges.size() * sizeof(glm::uvec2), mStorageAlignment);
+
+		GLint previousProgram = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+		glUseProgram(mProgram);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mCenterBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mKeyBuffer);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, indexBuffer, boundOffset, offset - boundOffset + numSorted * 6 * indexSize);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, rangeData.buffer, rangeData.offset, ranges.size() * sizeof(glm::uvec2));
+
+		glUniform3fv(mEyeLoc, 1, glm::value_ptr(eye));
+		glUniform1ui(mNumWallsLoc, numSorted);
+		glUniform1ui(mNumRangesLoc, ranges.size());
+		glUniform1ui(mNumKeysLoc, mNumKeys);
+		glUniform1i(mShortIndicesLoc, indexType == GL_UNSIGNED_SHORT);
+		glUniform1ui(mFirstWordLoc, (offset - boundOffset) / sizeof(GLuint));
+
+		dispatch(PASS_COMPUTE_KEYS);
+		for(GLuint k = 2; k <= mNumKeys; k *= 2) {
+			glUniform1ui(mKLoc, k);
+			for(GLuint j = k / 2; j > 0; j /= 2) {
+				glUniform1ui(mJLoc, j);
+				dispatch(PASS_BITONIC_STEP);
+			}
+		}
+		dispatch(PASS_WRITE_INDICES);
+
+		// The indices are read by the next draw
+		glMemoryBarrier(GL_ELEMENT_ARRAY_BARRIER_BIT);
+
+		for(GLuint binding = 0; binding < 4; binding++) {
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+		}
+		glUseProgram(previousProgram);
+	}
+
+	/*
+	 * Sort every wall, as sort above
+	 */
+	void sort(const glm::vec3& eye, utils::GLStreamBuffer& uploads, GLuint indexBuffer,
+	          GLenum indexType = GL_UNSIGNED_INT, size_t firstIndex = 0) {
+		sort(eye, std::vector<glm::uvec2>(1, glm::uvec2(0, mNumWalls)), uploads, indexBuffer, indexType, firstIndex);
+	}
+};
+
+}
+
+#endif /* GPU_WALL_SORTER_H_ */
@@ -0,0 +1,215 @@
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#ifndef GEOMETRY_INDEX_OPTIMIZER_H_
+#define GEOMETRY_INDEX_OPTIMIZER_H_
+
+namespace geometry {
+
+namespace detail {
+
+// The size of the LRU cache modelled when ordering triangles. This is bigger than any real
+// post-transform cache, which makes the order good across cache sizes.
+const size_t FORSYTH_CACHE_SIZE = 32;
+
+/*
+ * How much we want to draw the triangles of a vertex next, given its position in the LRU
+ * cache (or -1 if it isn't in the cache) and the number of its triangles left to draw
+ */
+inline float forsythVertexScore(int cachePos, size_t remainingTriangles) {
+	if(remainingTriangles == 0) {
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if(cachePos >= 0) {
+		if(cachePos < 3) {
+			// The vertices of the last triangle get a fixed score so strips aren't favoured
+			// over fans
+			score = 0.75f;
+		} else {
+			score = std::pow(1.0f - float(cachePos - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+		}
+	}
+
+	// Finish off vertices with few triangles left, so they don't need to be reloaded later
+	return score + 2.0f / std::sqrt(float(remainingTriangles));
+}
+
+}
+
+/*
+ * Reorder the triangles of an indexed triangle list so consecutive triangles reuse the
+ * vertices in the post-transform cache, with Tom Forsyth's linear-speed vertex cache
+ * optimization. The winding of every triangle is kept.
+ */
+inline void optimizeVertexCache(std::vector<uint32_t>& indices, size_t numVertices) {
+	const size_t numTriangles = indices.size() / 3;
+	if(numTriangles == 0) {
+		return;
+	}
+
+	// The triangles using each vertex. The triangles of v which are still to be drawn are
+	// vertexTriangles[triangleOffsets[v]] up to remaining[v] entries after it.
+	std::vector<uint32_t> triangleOffsets(numVertices + 1, 0);
+	for(size_t i = 0; i < numTriangles * 3; i++) {
+		triangleOffsets[indices[i] + 1]++;
+	}
+	for(size_t v = 0; v < numVertices; v++) {
+		triangleOffsets[v + 1] += triangleOffsets[v];
+	}
+	std::vector<uint32_t> remaining(numVertices, 0);
+	std::vector<uint32_t> vertexTriangles(numTriangles * 3);
+	for(size_t i = 0; i < numTriangles * 3; i++) {
+		const uint32_t v = indices[i];
+		vertexTriangles[triangleOffsets[v] + remaining[v]++] = i / 3;
+	}
+
+	std::vector<int> cachePos(numVertices, -1);
+	std::vector<float> vertexScore(numVertices);
+	for(size_t v = 0; v < numVertices; v++) {
+		vertexScore[v] = detail::forsythVertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triangleScore(numTriangles);
+	std::vector<bool> drawn(numTriangles, false);
+	for(size_t t = 0; t < numTriangles; t++) {
+		triangleScore[t] = vertexScore[indices[t*3]] + vertexScore[indices[t*3 + 1]] + vertexScore[indices[t*3 + 2]];
+	}
+
+	std::vector<uint32_t> out;
+	out.reserve(numTriangles * 3);
+	std::vector<uint32_t> cache, newCache;
+	size_t nextUndrawn = 0;
+	int64_t best = -1;
+
+	for(size_t n = 0; n < numTriangles; n++) {
+		// Nothing in the cache has triangles left, so start again from the first triangle left.
+		// This keeps the whole thing linear.
+		if(best < 0) {
+			while(drawn[nextUndrawn]) {
+				nextUndrawn++;
+			}
+			best = nextUndrawn;
+		}
+
+		const uint32_t* tri = &indices[best * 3];
+		out.insert(out.end(), tri, tri + 3);
+		drawn[best] = true;
+
+		// Take the triangle off its vertices' lists of triangles left to draw
+		for(size_t k = 0; k < 3; k++) {
+			const uint32_t v = tri[k];
+			uint32_t* first = &vertexTriangles[triangleOffsets[v]];
+			uint32_t* last = first + remaining[v];
+			*std::find(first, last, uint32_t(best)) = *(last - 1);
+			remaining[v]--;
+		}
+
+		// Move the triangle's vertices to the front of the cache
+		newCache.assign(tri, tri + 3);
+		for(auto v = cache.begin(); v != cache.end(); v++) {
+			if(*v != tri[0] && *v != tri[1] && *v != tri[2]) {
+				newCache.push_back(*v);
+			}
+		}
+		for(size_t i = 0; i < newCache.size(); i++) {
+			const uint32_t v = newCache[i];
+			cachePos[v] = i < detail::FORSYTH_CACHE_SIZE ? int(i) : -1;
+			vertexScore[v] = detail::forsythVertexScore(cachePos[v], remaining[v]);
+		}
+
+		// Only the triangles of vertices whose scores changed need rescoring, and the best of
+		// them is drawn next
+		best = -1;
+		float bestScore = -1.0f;
+		for(auto v = newCache.begin(); v != newCache.end(); v++) {
+			for(uint32_t i = 0; i < remaining[*v]; i++) {
+				const uint32_t t = vertexTriangles[triangleOffsets[*v] + i];
+				triangleScore[t] = vertexScore[indices[t*3]] + vertexScore[indices[t*3 + 1]] + vertexScore[indices[t*3 + 2]];
+				if(triangleScore[t] > bestScore) {
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+
+		newCache.resize(std::min(newCache.size(), detail::FORSYTH_CACHE_SIZE));
+		cache.swap(newCache);
+	}
+
+	indices.swap(out);
+}
+
+/*
+ * Renumber vertices in the order the indices first use them, so the vertex fetches of
+ * consecutive triangles are close together in memory. indices are updated in place, and the
+ * returned table maps each old vertex to its new position. Vertices which aren't used go at
+ * the end.
+ */
+inline std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, size_t numVertices) {
+	const uint32_t UNUSED = ~uint32_t(0);
+	std::vector<uint32_t> remap(numVertices, UNUSED);
+	uint32_t next = 0;
+	for(auto i = indices.begin(); i != indices.end(); i++) {
+		if(remap[*i] == UNUSED) {
+			remap[*i] = next++;
+		}
+		*i = remap[*i];
+	}
+	for(auto r = remap.begin(); r != remap.end(); r++) {
+		if(*r == UNUSED) {
+			*r = next++;
+		}
+	}
+	return remap;
+}
+
+/*
+ * Move every vertex to its new position in remap, as returned by optimizeVertexFetch
+ */
+template <class Vertex>
+void remapVertices(std::vector<Vertex>& vertices, const std::vector<uint32_t>& remap) {
+	std::vector<Vertex> out(vertices.size());
+	for(size_t i = 0; i < vertices.size(); i++) {
+		out[remap[i]] = vertices[i];
+	}
+	vertices.swap(out);
+}
+
+/*
+ * How much reordering a mesh's indices improved its average cache miss ratio
+ */
+struct VertexCacheStats {
+	size_t numTriangles = 0;
+	float acmrBefore = 0.0f;
+	float acmrAfter = 0.0f;
+};
+
+/*
+ * The average cache miss ratio of drawing indices through a FIFO post-transform cache of
+ * cacheSize vertices: the number of vertices transformed per triangle. It is 3 when nothing is
+ * reused, and approaches 0.5 for a regular triangle grid.
+ */
+inline float averageCacheMissRatio(const std::vector<uint32_t>& indices, size_t numVertices, size_t cacheSize = 16) {
+	if(indices.size() < 3) {
+		return 0.0f;
+	}
+
+	// A vertex stays in the FIFO until cacheSize other vertices have been loaded after it
+	std::vector<size_t> loadedAt(numVertices, 0);
+	size_t misses = 0;
+	for(auto i = indices.begin(); i != indices.end(); i++) {
+		if(loadedAt[*i] == 0 || misses - loadedAt[*i] >= cacheSize) {
+			misses++;
+			loadedAt[*i] = misses;
+		}
+	}
+	return float(misses) / (indices.size() / 3);
+}
+
+}
+
+#endif /* GEOMETRY_INDEX_OPTIMIZER_H_ */
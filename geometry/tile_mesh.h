@@ -1,16 +1,31 @@
 #include <GL/glew.h>
 #include <SOIL/SOIL.h>
+#include <sys/stat.h>
 
+#include <cmath>
 #include <string>
 #include <array>
+#include <memory>
+#include <vector>
+#include <future>
+#include <algorithm>
+#include <cstddef>
 #include <unordered_map>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtx/compatibility.hpp>
 
 #include "geometry/planar_tiling.h"
 #include "geometry/3d_primitives.h"
+#include "geometry/bounding_box.h"
 #include "geometry/vertex.h"
+#include "geometry/tile_view_residency.h"
+#include "geometry/gpu_wall_sorter.h"
+#include "utils/mipmap.h"
+#include "utils/gl_stream_buffer.h"
+#include "utils/radix_sort.h"
+#include "utils/thread_pool.h"
 
 #ifndef TILEMESH_H_
 #define TILEMESH_H_
@@ -89,35 +104,260 @@ template <geometry::Mode mode, class Tiling>
 class TileMesh {
 public:
 	struct Vertex;
+	struct WallInstance;
+	struct Chunk;
 private:
 	Tiling mTiling;
 
 	bool mRebuildGeometry = true;
 
+	// The non-instanced walls are allocated from one of these pools, so rebuilding them reuses
+	// the pool's buffers and vertex array rather than making new ones. Walls sorted on the CPU
+	// have 16 bit indices relative to the first vertex of each run of walls they are drawn in,
+	// until the visible walls take too many runs and mLongWallIndices is set. The GPU sorter
+	// writes indices of walls from anywhere in the geometry, so walls it sorts always have 32
+	// bit indices.
+	std::unique_ptr<GeometryPool> mWallPool;
+	std::unique_ptr<GeometryPool> mLongIndexWallPool;
+	bool mLongWallIndices = false;
 	Geometry mGeometry;
 
-	GLuint mTileTextureArray = 0;
-	GLuint mTileDepthTextureArray = 0;
+	// Position only walls which share the corners they share in the tiling, and optionally the
+	// floor and ceiling of every tile, for overlays like the wireframe
+	bool mRebuildWeldedGeometry = true;
+	bool mWeldedFloorAndCeiling = false;
+
+	// The welded geometry is rebuilt whenever the floor and ceiling are toggled, so it reuses
+	// the ranges of a pool rather than allocating new buffers every time
+	static const size_t WELDED_POOL_VERTICES = 1 << 14;
+	static const size_t WELDED_POOL_INDICES = 1 << 16;
+	std::unique_ptr<GeometryPool> mWeldedPool;
+	Geometry mWeldedGeometry;
+
+	// How much reordering the welded geometry's indices helped, as of its last build
+	VertexCacheStats mWeldedCacheStats;
+
+	// The width and height in pixels of every tile view image
+	static const size_t TILE_TEX_DIM = 512;
+
+	// Internal formats of the tile view arrays. The depth views are only ever read
+	// through a single normalized channel, so they are stored as one 16 bit channel.
+	static const GLenum COLOR_TEX_FORMAT = GL_RGBA8;
+	static const GLenum DEPTH_TEX_FORMAT = GL_R16;
+
+	// Depth mip levels keep the nearest depth of the texels they cover rather than
+	// averaging, so a coarse level never places a surface farther away than it is.
+	static const utils::MipReduction DEPTH_MIP_REDUCTION = utils::MipReduction::MIN;
+
+	// The texture budget used when none is given, enough for about 250 views
+	static const size_t DEFAULT_TEXTURE_BUDGET = 512 * 1024 * 1024;
+
+	// Pages the color and depth tile views in and out of GPU memory. Made along with mUploads
+	// the first time the geometry is built, so a mesh can be made and its tiling walked, as
+	// printTextureNames does, without a GL context.
+	std::unique_ptr<TileViewResidency> mResidency;
+	size_t mTextureBudget;
 	GLuint mNumTextures = 0;
 
-	void depthsort(Vertex* verts, GLuint* inds, size_t numIndices);
+	// Worker threads used to build the tile geometry
+	utils::ThreadPool mBuildPool;
+
+	// Re-sorted indices and instances and newly visible chunks' vertices are streamed through
+	// this ring and copied into place on the GPU, so updating them never waits for draws still
+	// reading the old data
+	static const size_t UPLOAD_SEGMENT_SIZE = 1 << 20;
+	std::unique_ptr<utils::GLStreamBuffer> mUploads;
+
+	/*
+	 * Make the residency pool and the upload ring if they haven't been made yet
+	 */
+	void createGLResources();
+
+	// Walls are grouped into chunks by ring (distance from the center tile) and sector (angle
+	// around it), so each chunk covers a compact patch of the floor
+	static constexpr float CHUNK_RING_WIDTH = 4.0f;
+	static const size_t NUM_CHUNK_SECTORS = 8;
+
+	// Patches with more walls are split into several chunks. The visible walls are drawn in
+	// runs of at most as many walls, so 16 bit indices relative to the first vertex of a run
+	// can address all 4 vertices of every wall in it.
+	static const size_t MAX_CHUNK_WALLS = Geometry::MAX_SHORT_INDEXED_VERTICES / 4;
+
+	// When walls far apart in the layout interleave in depth, the runs get short. Past this
+	// many the draws cost more than 32 bit indices would, so the walls move to those.
+	static const size_t MAX_SHORT_INDEX_RUNS = 64;
+
+	// The chunks, in the order their walls are laid out in the vertex and index buffers, and
+	// the chunk of every wall
+	std::vector<Chunk> mChunks;
+	std::vector<GLuint> mWallChunks;
+
+	// The visible chunks as of the last updateVisibleChunks, in chunk order, and the index
+	// ranges of their walls, back to front. mVisibleIndices are the indices last uploaded for
+	// them, so only what changes has to be uploaded again.
+	std::vector<size_t> mVisibleChunks;
+	IndexRanges mVisibleRanges;
+	std::vector<GLuint> mVisibleIndices;
+
+	/*
+	 * Where the walls of each tile go in the vertex and index buffers. Walls are laid out tile
+	 * by tile, so the walls of tiles[i] are walls offsets[i] up to offsets[i+1].
+	 */
+	struct WallLayout {
+		std::vector<typename Tiling::Tile*> tiles;
+		std::vector<size_t> offsets;
+
+		size_t numWalls() const {
+			return offsets.back();
+		}
+	};
+
+	// The centers of the depth sorted walls, and the walls in back to front order as of the
+	// last sort. mWallDepths is scratch space for the distance of each wall to the camera.
+	std::vector<glm::vec3> mWallCenters;
+	std::vector<GLuint> mWallOrder;
+	std::vector<float> mWallDepths;
+
+	// Sorts the walls on the GPU instead, if enabled, from mGpuSortedEye as of the last sort.
+	// The GPU writes the order of the visible walls to the start of the index range.
+	std::unique_ptr<GPUWallSorter> mGpuSorter;
+	glm::vec3 mGpuSortedEye;
+
+	// How far on average the insertion sort in sortWalls may move each wall before it falls
+	// back to a full radix sort
+	static const size_t MAX_INSERTION_MOVES_PER_WALL = 8;
+
+	// Draw each wall as an instance of one shared quad instead of as its own 4 vertices.
+	// mWallInstances holds the instance of every wall in wall order, and mInstanceBuffer holds
+	// them in draw order. The quad and the instance buffer are made the first time the walls
+	// are instanced and kept after that, and the instance buffer only ever grows.
+	bool mInstanced = false;
+	std::vector<WallInstance> mWallInstances;
+	Geometry mWallQuad;
+	GLuint mInstanceBuffer = 0;
+	size_t mInstanceCapacity = 0;
+
+	/*
+	 * Write the 6 indices of the two triangles of wall to dst
+	 */
+	template <class Index>
+	static void writeWallIndices(GLuint wall, Index* dst);
+
+	/*
+	 * Merge the back to front orders of the walls of each visible chunk into one order of all
+	 * the visible walls, and upload its indices from the start of the index range. Walls which
+	 * aren't sorted are drawn chunk by chunk. With 16 bit indices the order is split into runs
+	 * of walls whose vertices are close enough together, each drawn from its own base vertex.
+	 * If that takes more than MAX_SHORT_INDEX_RUNS runs, the walls move to 32 bit indices.
+	 */
+	void mergeVisibleWalls();
+
+	/*
+	 * Re-sort positions first up to last of mWallOrder back to front as seen from eye,
+	 * starting from the last order. Returns the range of positions which changed.
+	 */
+	std::pair<size_t, size_t> sortWalls(const glm::vec3& eye, size_t first, size_t last);
+
+	/*
+	 * Returns true if the wall from v1 to v2 faces the center tile
+	 */
+	static bool isWallVisible(const glm::vec2& v1, const glm::vec2& v2);
+
+	/*
+	 * Returns true if the edge e has a tile behind it and is visible from the center tile
+	 */
+	static bool hasVisibleWall(const typename Tiling::Edge& e, const glm::vec2& centroidOffset);
+
+	/*
+	 * Count the visible walls of every tile in parallel and lay them out. This gives the
+	 * exact size of the wall geometry before anything is allocated.
+	 */
+	WallLayout layoutWalls();
+
+	/*
+	 * Decode the image in the file whose name is key and build its mip chain. Color images
+	 * are decoded to RGBA8 and depth images to R16. The mip chain is cached on disk next to
+	 * the image and reused as long as the image doesn't change.
+	 * This is run on the decode workers, so it must not make any GL calls.
+	 */
+	static utils::MipChain decodeImage(const std::string& key, bool isDepth);
 
 	/*
-	 * Create an OpenGL texture2D array of n textures of size w by h pixels each
+	 * A visible wall between tile and adjacentTile, running from v1 to v2 relative to the
+	 * center tile. vertex1 and vertex2 are the tiling vertices at v1 and v2.
 	 */
-	GLuint makeTextureArray(size_t w, size_t h, size_t n);
+	struct Wall {
+		typename Tiling::Tile* tile;
+		typename Tiling::Tile* adjacentTile;
+		glm::vec2 v1, v2;
+		typename Tiling::Vertex* vertex1;
+		typename Tiling::Vertex* vertex2;
+	};
+
+	// Everything needed to write the vertices of a chunk when it first comes into view: the
+	// walls, the texture coordinates of the 4 corners of every wall, and the texcoord.z of
+	// each wall
+	std::vector<Wall> mWalls;
+	std::array<glm::vec2, 4> mCornerUVs;
+	std::vector<float> mWallLayers;
+
+	/*
+	 * Find every visible wall in parallel, in the order given by layout
+	 */
+	std::vector<Wall> collectWalls(const WallLayout& layout);
+
+	/*
+	 * Reorder walls so the walls of each chunk are contiguous, and build mChunks and
+	 * mWallChunks. The walls of each tile stay in order within their chunk.
+	 */
+	void chunkWalls(std::vector<Wall>& walls);
 
 	/*
-	 * Load the image in the file whose name is key to arrayIndex in the Texture2DArray
-	 * specified by tex
+	 * Store the wall centers and start mWallOrder out sorted as seen from the center tile
 	 */
-	void loadImgToTexArray(const std::string& key, GLuint tex, size_t arrayIndex);
+	void initWallOrder(const std::vector<Wall>& walls);
+
+	/*
+	 * Lay out the vertices and indices of a quad for each wall, optionally depth sorting the
+	 * indices, and allocate the geometry. The vertices of each chunk are written the first time
+	 * it is visible, by writeChunkVertices. Corners 0 and 1 of a wall are the top and bottom
+	 * of v1, and 2 and 3 of v2, and corner c of wall w gets the texture coordinate
+	 * (cornerUVs[c], layers[w]).
+	 */
+	void buildWallGeometry(const std::vector<Wall>& walls, const std::array<glm::vec2, 4>& cornerUVs,
+	                       std::vector<float> layers, bool sort);
+
+	/*
+	 * (Re)allocate the non-instanced walls from the pool for how they are sorted now. Every
+	 * chunk's vertices are written again when it is next visible, and the indices when the
+	 * visible walls are next ordered.
+	 */
+	void allocateWallGeometry();
+
+	/*
+	 * Sort the walls of mVisibleChunks back to front from eye on the GPU, and draw them as the
+	 * one index range the sorter wrote
+	 */
+	void sortVisibleWallsOnGpu(const glm::vec3& eye);
+
+	/*
+	 * Write the vertices of the walls of chunk to the vertex buffer
+	 */
+	void writeChunkVertices(const Chunk& chunk);
+
+	/*
+	 * Make a depth sorted instance of the shared wall quad for each wall, with the given view
+	 * ids, and upload them. The quad is made if it hasn't been yet.
+	 */
+	void buildInstancedWalls(const std::vector<Wall>& walls, const std::vector<size_t>& viewIds);
 
 	std::pair<std::string, std::string> getTexKey(const glm::ivec2& tileIndex, const glm::ivec2& adjacentTileIndex);
 
-	Geometry generateTexturedTileGeometry();
+	void generateTexturedTileGeometry();
+
+	void generateIdentifiedTileGeometry();
 
-	Geometry generateIdentifiedTileGeometry();
+	Geometry generateWeldedGeometry(bool floorAndCeiling);
 
 public:
 	void printTextureNames();
@@ -127,6 +367,27 @@ public:
 		glm::vec3 texcoord;
 	};
 
+	/*
+	 * A spatial chunk of walls, which is culled as a whole. Its walls are walls firstWall up
+	 * to firstWall + numWalls, in mWallOrder and the vertex buffer.
+	 */
+	struct Chunk {
+		size_t firstWall;
+		size_t numWalls;
+		AABB bounds;
+		bool dirty;   // The vertices in the vertex buffer are out of date
+		bool visible; // As of the last updateVisibleChunks
+	};
+
+	/*
+	 * What differs between the walls of the instanced geometry. Every wall is the same unit
+	 * quad stretched between its endpoints.
+	 */
+	struct WallInstance {
+		glm::vec4 endpoints; // The wall's v1 in xy and v2 in zw
+		GLuint view;         // The view id, as in texcoord.z of Vertex
+	};
+
 	static std::array<Quad4, Tiling::numEdgesPerTile()> edgeFaces() {
 	  std::array<Quad4, Tiling::numEdgesPerTile()> ret;
 
@@ -150,32 +411,175 @@ public:
 		return mNumTextures;
 	}
 
+	/*
+	 * The tile view arrays and table are 0 until the geometry has been built
+	 */
 	GLuint tileTextureArray() const {
-		return mTileTextureArray;
+		return mResidency ? mResidency->colorTextureArray() : 0;
 	}
 
 	GLuint tileDepthTextureArray() const {
-		return mTileDepthTextureArray;
+		return mResidency ? mResidency->depthTextureArray() : 0;
+	}
+
+	/*
+	 * The buffer texture mapping the view id in each wall's texcoord.z to the layer of the
+	 * tile texture arrays holding it. See TileViewResidency.
+	 */
+	GLuint tileViewTable() const {
+		return mResidency ? mResidency->viewTable() : 0;
+	}
+
+	/*
+	 * The pool paging the tile views in and out, or nullptr until the geometry has been built
+	 */
+	const TileViewResidency* residency() const {
+		return mResidency.get();
+	}
+
+	/*
+	 * The number of bytes of GPU memory allocated for the color and depth tile views
+	 */
+	size_t textureBytes() const {
+		return mResidency ? mResidency->allocatedBytes() : 0;
 	}
 
+	/*
+	 * Page tile views in and out for the camera with the given view projection matrix,
+	 * prefetching the views which will be visible from the predicted cameras.
+	 * Call once per frame before drawing.
+	 */
+	void updateResidency(const glm::mat4& viewProj,
+	                     const std::vector<TileViewResidency::PredictedCamera>& predictions =
+	                         std::vector<TileViewResidency::PredictedCamera>()) {
+		geometry();
+		mResidency->update(viewProj, *mUploads, predictions);
+	}
+
+	/*
+	 * The wall geometry, which is the shared quad if the walls are instanced
+	 */
 	const Geometry& geometry() {
 	  if(mRebuildGeometry) {
+	    createGLResources();
+
+	    // Free the old ranges first, so the new geometry can take their place
+	    mGeometry.release();
 	    switch(mode) {
 	    case TEXTURED:
-        mGeometry = generateTexturedTileGeometry();
+        generateTexturedTileGeometry();
         break;
 	    case IDENTIFIED:
-	      mGeometry = generateIdentifiedTileGeometry();
+	      generateIdentifiedTileGeometry();
 	      break;
 	    }
 	    mRebuildGeometry = false;
 	  }
-		return mGeometry;
+		return mInstanced ? mWallQuad : mGeometry;
+	}
+
+	/*
+	 * Cull the chunks against the camera with the given view projection matrix, write the
+	 * vertices of chunks which have come into view for the first time, and order the walls of
+	 * the visible chunks again if they changed. Call once per frame before sorting and drawing.
+	 * Walls sorted on the GPU are sorted as seen from eye.
+	 */
+	void updateVisibleChunks(const glm::mat4& viewProj, const glm::vec3& eye);
+
+	/*
+	 * The index ranges of the walls of the visible chunks, back to front, for drawing the
+	 * non-instanced geometry with Renderer's multi-draw. The ranges follow each other in the
+	 * index buffer, and differ only in their base vertex. With 32 bit indices, which the walls
+	 * always have while they are sorted on the GPU, this is a single range.
+	 */
+	const IndexRanges& visibleRanges() const {
+		return mVisibleRanges;
+	}
+
+	const std::vector<Chunk>& chunks() const {
+		return mChunks;
+	}
+
+	/*
+	 * Re-sort the walls of the visible chunks back to front as seen from eye, and upload the
+	 * part of the index buffer which changed. Cheap when the camera has only moved a little
+	 * since the last call. Each chunk's walls are sorted on their own, in parallel, and then
+	 * merged into one order of all the visible walls.
+	 */
+	void updateDepthOrder(const glm::vec3& eye);
+
+	/*
+	 * Sort the walls with a compute shader in updateDepthOrder. Returns false, and keeps
+	 * sorting on the CPU, if the GL context doesn't support it or the walls aren't sorted. The
+	 * walls move to 32 bit indices while they are sorted on the GPU, and only the walls of the
+	 * visible chunks are sorted and drawn.
+	 */
+	bool enableGpuSorting(utils::GLProgramBuilder& programBuilder);
+
+	void disableGpuSorting();
+
+	bool gpuSortingEnabled() const {
+		return mGpuSorter != nullptr;
+	}
+
+	/*
+	 * Switch between instanced and non-instanced walls. The geometry is rebuilt the next time
+	 * it is used. Returns false if instancing isn't supported, which is the case for
+	 * IDENTIFIED meshes. Instanced walls are always sorted on the CPU.
+	 */
+	bool setInstanced(bool instanced);
+
+	bool instanced() const {
+		return mInstanced;
+	}
+
+	/*
+	 * The number of instances to draw of the geometry when it is instanced
+	 */
+	size_t numWallInstances() const {
+		return mWallInstances.size();
+	}
+
+	/*
+	 * The number of bytes in the buffers of the wall geometry, including the instances
+	 */
+	size_t geometryBytes() const {
+		if(mInstanced) {
+			return mWallQuad.num_vertices * sizeof(Vertex4P) + mWallQuad.num_indices * mWallQuad.indexSize() +
+			       mWallInstances.size() * sizeof(WallInstance);
+		}
+		return mGeometry.num_vertices * sizeof(Vertex) + mGeometry.num_indices * mGeometry.indexSize();
+	}
+
+	/*
+	 * Position only geometry of the walls, where each tiling vertex is emitted once at the top
+	 * and once at the bottom and shared by every wall and tile touching it. If floorAndCeiling
+	 * is true, the floor and ceiling of every tile are included as triangle fans.
+	 * Walls need their own texture coordinates to be textured, so this is for untextured
+	 * overlays such as wireframes. It is not depth sorted.
+	 */
+	const Geometry& weldedGeometry(bool floorAndCeiling = false) {
+		if(mRebuildWeldedGeometry || floorAndCeiling != mWeldedFloorAndCeiling) {
+			// Free the old ranges first, so the new geometry can take their place
+			mWeldedGeometry.release();
+			mWeldedGeometry = generateWeldedGeometry(floorAndCeiling);
+			mWeldedFloorAndCeiling = floorAndCeiling;
+			mRebuildWeldedGeometry = false;
+		}
+		return mWeldedGeometry;
+	}
+
+	/*
+	 * How much the vertex cache optimization improved the welded geometry when it was last
+	 * built. All zero until weldedGeometry() is first called.
+	 */
+	const VertexCacheStats& weldedCacheStats() const {
+		return mWeldedCacheStats;
 	}
 
 	void rebuildMesh(size_t radius);
 
-	TileMesh(size_t radius);
+	TileMesh(size_t radius, size_t textureBudgetBytes = DEFAULT_TEXTURE_BUDGET);
 
 	virtual ~TileMesh();
 };
@@ -5,12 +5,78 @@ namespace geometry {
 #endif
 
 template <Mode mode, class Tiling>
-TileMesh<mode, Tiling>::TileMesh(size_t radius) {
+const size_t TileMesh<mode, Tiling>::TILE_TEX_DIM;
+
+template <Mode mode, class Tiling>
+const GLenum TileMesh<mode, Tiling>::COLOR_TEX_FORMAT;
+
+template <Mode mode, class Tiling>
+const GLenum TileMesh<mode, Tiling>::DEPTH_TEX_FORMAT;
+
+template <Mode mode, class Tiling>
+const utils::MipReduction TileMesh<mode, Tiling>::DEPTH_MIP_REDUCTION;
+
+template <Mode mode, class Tiling>
+const size_t TileMesh<mode, Tiling>::DEFAULT_TEXTURE_BUDGET;
+
+template <Mode mode, class Tiling>
+const size_t TileMesh<mode, Tiling>::MAX_INSERTION_MOVES_PER_WALL;
+
+template <Mode mode, class Tiling>
+constexpr float TileMesh<mode, Tiling>::CHUNK_RING_WIDTH;
+
+template <Mode mode, class Tiling>
+const size_t TileMesh<mode, Tiling>::NUM_CHUNK_SECTORS;
+
+template <Mode mode, class Tiling>
+const size_t TileMesh<mode, Tiling>::UPLOAD_SEGMENT_SIZE;
+
+template <Mode mode, class Tiling>
+const size_t TileMesh<mode, Tiling>::MAX_CHUNK_WALLS;
+
+template <Mode mode, class Tiling>
+TileMesh<mode, Tiling>::TileMesh(size_t radius, size_t textureBudgetBytes) : mTextureBudget(textureBudgetBytes) {
   rebuildMesh(radius);
 }
 
 template <Mode mode, class Tiling>
-TileMesh<mode, Tiling>::~TileMesh() {}
+void TileMesh<mode, Tiling>::createGLResources() {
+  if(!mResidency) {
+    // Identified meshes don't draw any views, so they only need the placeholder
+    mResidency = std::make_unique<TileViewResidency>(
+        mode == TEXTURED ? mTextureBudget : 0, COLOR_TEX_FORMAT, DEPTH_TEX_FORMAT, TILE_TEX_DIM,
+        utils::MipChain::fullChainLength(TILE_TEX_DIM, TILE_TEX_DIM),
+        [](const std::string& colorKey, const std::string& depthKey) {
+          return DecodedView(decodeImage(colorKey, false), decodeImage(depthKey, true));
+        });
+  }
+  if(!mUploads) {
+    mUploads = std::make_unique<utils::GLStreamBuffer>(UPLOAD_SEGMENT_SIZE);
+  }
+}
+
+template <Mode mode, class Tiling>
+TileMesh<mode, Tiling>::~TileMesh() {
+  if(mInstanceBuffer != 0) {
+    glDeleteBuffers(1, &mInstanceBuffer);
+  }
+}
+
+template <Mode mode, class Tiling>
+bool TileMesh<mode, Tiling>::setInstanced(bool instanced) {
+  if(mode != TEXTURED) {
+    return !instanced;
+  }
+
+  if(instanced != mInstanced) {
+    mInstanced = instanced;
+    mRebuildGeometry = true;
+    if(instanced) {
+      mGpuSorter.reset();
+    }
+  }
+  return true;
+}
 
 template <Mode mode, class Tiling>
 void TileMesh<mode, Tiling>::rebuildMesh(size_t radius) {
@@ -22,69 +88,443 @@ void TileMesh<mode, Tiling>::rebuildMesh(size_t radius) {
   mTiling.addTilesInNeighborhood(glm::ivec2(0), nearestN);
 
   mRebuildGeometry = true;
+  mRebuildWeldedGeometry = true;
 }
 
 template <Mode mode, class Tiling>
-void TileMesh<mode, Tiling>::depthsort(Vertex* verts, GLuint* inds, size_t numIndices) { // Depth sort the triangles
-  std::vector<size_t> v;
-  v.reserve(numIndices/3);
-  for(size_t i = 0; i < numIndices / 3; i++) {
-    v.push_back(i);
+void TileMesh<mode, Tiling>::updateDepthOrder(const glm::vec3& eye) {
+  geometry();
+
+  if(mGpuSorter) {
+    // updateVisibleChunks sorts when the visible chunks change
+    if(eye != mGpuSortedEye) {
+      sortVisibleWallsOnGpu(eye);
+    }
+    return;
   }
 
-  auto triDepthCmpFunc = [&](size_t i1, size_t i2) {
-    const glm::vec4 c1 = (verts[inds[i1*3]].pos + verts[inds[i1*3+1]].pos + verts[inds[i1*3+2]].pos) / 3.0f;
-    const glm::vec4 c2 = (verts[inds[i2*3]].pos + verts[inds[i2*3+1]].pos + verts[inds[i2*3+2]].pos) / 3.0f;
-    return glm::distance(glm::vec3(0.0), glm::vec3(c1)) > glm::distance(glm::vec3(0.0), glm::vec3(c2));
-  };
+  // Identified meshes aren't sorted
+  if(mWallOrder.empty()) {
+    return;
+  }
+
+  // Chunks own disjoint ranges of the order, so they can be sorted in parallel. Chunks out of
+  // view keep their last order until they come back into view.
+  std::vector<std::pair<size_t, size_t>> chunkChanges(mChunks.size(), std::make_pair(size_t(0), size_t(0)));
+  mBuildPool.parallelFor(0, mChunks.size(), [&](size_t c) {
+    if(mChunks[c].visible) {
+      chunkChanges[c] = sortWalls(eye, mChunks[c].firstWall, mChunks[c].firstWall + mChunks[c].numWalls);
+    }
+  });
+
+  // The chunks move relative to each other even when the order within each stays the same,
+  // so the visible walls are merged again after every sort. Only changed indices are uploaded.
+  if(!mInstanced) {
+    mergeVisibleWalls();
+    return;
+  }
+
+  std::pair<size_t, size_t> changed(mWallOrder.size(), 0);
+  for(auto c = chunkChanges.begin(); c != chunkChanges.end(); c++) {
+    if(c->first < c->second) {
+      changed.first = std::min(changed.first, c->first);
+      changed.second = std::max(changed.second, c->second);
+    }
+  }
+  if(changed.first >= changed.second) {
+    return;
+  }
+
+  std::vector<WallInstance> instances(changed.second - changed.first);
+  for(size_t i = changed.first; i < changed.second; i++) {
+    instances[i - changed.first] = mWallInstances[mWallOrder[i]];
+  }
+  mUploads->copyTo(mInstanceBuffer, changed.first * sizeof(WallInstance), instances.data(), instances.size() * sizeof(WallInstance));
+}
+
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::mergeVisibleWalls() {
+  size_t numVisible = 0;
+  for(auto c = mVisibleChunks.begin(); c != mVisibleChunks.end(); c++) {
+    numVisible += mChunks[*c].numWalls;
+  }
+  std::vector<GLuint> order;
+  order.reserve(numVisible);
+
+  if(mWallOrder.empty()) {
+    for(auto c = mVisibleChunks.begin(); c != mVisibleChunks.end(); c++) {
+      for(size_t w = mChunks[*c].firstWall; w < mChunks[*c].firstWall + mChunks[*c].numWalls; w++) {
+        order.push_back(w);
+      }
+    }
+  } else {
+    // Each chunk's part of mWallOrder is sorted farthest first by mWallDepths, so repeatedly
+    // taking the farthest next wall of any chunk sorts all of them. The (next, last) positions
+    // of the chunks are kept in a heap with the chunk whose next wall is farthest on top. Ties
+    // go to the lower wall, as the GPU sorter does.
+    typedef std::pair<size_t, size_t> Run;
+    auto nearer = [this](const Run& a, const Run& b) {
+      const GLuint wa = mWallOrder[a.first];
+      const GLuint wb = mWallOrder[b.first];
+      return mWallDepths[wa] < mWallDepths[wb] || (mWallDepths[wa] == mWallDepths[wb] && wa > wb);
+    };
+
+    std::vector<Run> runs;
+    for(auto c = mVisibleChunks.begin(); c != mVisibleChunks.end(); c++) {
+      if(mChunks[*c].numWalls > 0) {
+        runs.push_back(Run(mChunks[*c].firstWall, mChunks[*c].firstWall + mChunks[*c].numWalls));
+      }
+    }
+    std::make_heap(runs.begin(), runs.end(), nearer);
+    while(!runs.empty()) {
+      std::pop_heap(runs.begin(), runs.end(), nearer);
+      Run& run = runs.back();
+      order.push_back(mWallOrder[run.first++]);
+      if(run.first == run.second) {
+        runs.pop_back();
+      } else {
+        std::push_heap(runs.begin(), runs.end(), nearer);
+      }
+    }
+  }
+
+  // With 16 bit indices, cut the order wherever the next wall would put a run's vertices too
+  // far apart, and write each run's indices relative to its lowest vertex. Chunks are laid out
+  // ring by ring, so seen from near the center walls at similar depths are mostly close
+  // together and the runs stay long. 32 bit indices are drawn as one run from vertex 0.
+  const bool shortIndices = mGeometry.index_type == GL_UNSIGNED_SHORT;
+  std::vector<std::pair<size_t, GLuint>> cuts; // The first position and lowest wall of each run
+  for(size_t first = 0, last; first < order.size(); first = last) {
+    GLuint minWall = shortIndices ? order[first] : 0, maxWall = order[first];
+    for(last = first + 1; last < order.size(); last++) {
+      const GLuint lo = std::min(minWall, order[last]);
+      const GLuint hi = std::max(maxWall, order[last]);
+      if(shortIndices && hi - lo >= MAX_CHUNK_WALLS) {
+        break;
+      }
+      minWall = lo;
+      maxWall = hi;
+    }
+    cuts.push_back(std::make_pair(first, minWall));
+  }
+
+  if(cuts.size() > MAX_SHORT_INDEX_RUNS && shortIndices) {
+    // Move the walls to 32 bit indices until they are rebuilt, and write the vertices of the
+    // visible chunks into the new geometry straight away
+    const std::vector<size_t> visible = mVisibleChunks;
+    mLongWallIndices = true;
+    allocateWallGeometry();
+    for(auto c = visible.begin(); c != visible.end(); c++) {
+      writeChunkVertices(mChunks[*c]);
+      mChunks[*c].dirty = false;
+    }
+    mVisibleChunks = visible;
+    mergeVisibleWalls();
+    return;
+  }
+
+  std::vector<GLuint> indices(order.size() * 6);
+  mVisibleRanges.clear();
+  for(size_t r = 0; r < cuts.size(); r++) {
+    const size_t first = cuts[r].first;
+    const size_t last = r + 1 < cuts.size() ? cuts[r + 1].first : order.size();
+    for(size_t i = first; i < last; i++) {
+      writeWallIndices(order[i] - cuts[r].second, &indices[i * 6]);
+    }
+    mVisibleRanges.add(first * 6, (last - first) * 6, mGeometry.indexSize(), cuts[r].second * 4);
+  }
+
+  // Only upload the span which differs from the last upload. Indices past the end of a
+  // shorter order aren't drawn, so they can stay.
+  size_t firstChanged = 0;
+  while(firstChanged < std::min(indices.size(), mVisibleIndices.size()) && indices[firstChanged] == mVisibleIndices[firstChanged]) {
+    firstChanged++;
+  }
+  size_t lastChanged = indices.size();
+  if(indices.size() <= mVisibleIndices.size()) {
+    while(lastChanged > firstChanged && indices[lastChanged - 1] == mVisibleIndices[lastChanged - 1]) {
+      lastChanged--;
+    }
+  }
+  if(firstChanged < lastChanged) {
+    // Copied through the copy targets, so the index buffer of a bound VAO isn't disturbed
+    const size_t offset = (mGeometry.first_index + firstChanged) * mGeometry.indexSize();
+    if(shortIndices) {
+      const std::vector<GLushort> shortInds(indices.begin() + firstChanged, indices.begin() + lastChanged);
+      mUploads->copyTo(mGeometry.ibo, offset, shortInds.data(), shortInds.size() * sizeof(GLushort));
+    } else {
+      mUploads->copyTo(mGeometry.ibo, offset, &indices[firstChanged], (lastChanged - firstChanged) * sizeof(GLuint));
+    }
+  }
+  mVisibleIndices.swap(indices);
+}
+
+template <Mode mode, class Tiling>
+bool TileMesh<mode, Tiling>::enableGpuSorting(utils::GLProgramBuilder& programBuilder) {
+  // The GPU sorter writes indices, and instanced walls are ordered by their instances
+  if(!GPUWallSorter::isSupported() || mInstanced || mode != TEXTURED) {
+    return false;
+  }
+
+  geometry();
+  mGpuSorter = std::make_unique<GPUWallSorter>(programBuilder);
+  mGpuSorter->setWalls(mWallCenters);
+  allocateWallGeometry();
+  return true;
+}
+
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::disableGpuSorting() {
+  if(mGpuSorter) {
+    mGpuSorter.reset();
+    allocateWallGeometry();
+  }
+}
+
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::updateVisibleChunks(const glm::mat4& viewProj, const glm::vec3& eye) {
+  geometry();
+
+  std::vector<size_t> visible;
+  for(size_t c = 0; c < mChunks.size(); c++) {
+    Chunk& chunk = mChunks[c];
+    chunk.visible = chunk.bounds.isInFrustum(viewProj);
+    if(!chunk.visible) {
+      continue;
+    }
+
+    if(chunk.dirty) {
+      writeChunkVertices(chunk);
+      chunk.dirty = false;
+    }
+    visible.push_back(c);
+  }
+
+  // Instanced walls are all drawn. Otherwise the visible walls only have to be ordered again
+  // when they change, or as the eye moves in updateDepthOrder.
+  if(mInstanced || visible == mVisibleChunks) {
+    return;
+  }
+  mVisibleChunks = std::move(visible);
+  if(mGpuSorter) {
+    sortVisibleWallsOnGpu(eye);
+  } else {
+    mergeVisibleWalls();
+  }
+}
+
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::sortVisibleWallsOnGpu(const glm::vec3& eye) {
+  // The walls of each run of visible chunks which are next to each other in the layout
+  std::vector<glm::uvec2> wallRanges;
+  size_t numVisible = 0;
+  for(auto c = mVisibleChunks.begin(); c != mVisibleChunks.end(); c++) {
+    const Chunk& chunk = mChunks[*c];
+    if(!wallRanges.empty() && wallRanges.back().x + wallRanges.back().y == chunk.firstWall) {
+      wallRanges.back().y += chunk.numWalls;
+    } else {
+      wallRanges.push_back(glm::uvec2(chunk.firstWall, chunk.numWalls));
+    }
+    numVisible += chunk.numWalls;
+  }
+
+  mGpuSorter->sort(eye, wallRanges, *mUploads, mGeometry.ibo, mGeometry.index_type, mGeometry.first_index);
+  mGpuSortedEye = eye;
+
+  // The sorted walls are written from the start of the range, with indices of the whole layout
+  mVisibleRanges.clear();
+  mVisibleRanges.add(0, numVisible * 6, mGeometry.indexSize());
+}
+
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::writeChunkVertices(const Chunk& chunk) {
+  std::vector<Vertex> verts(chunk.numWalls * 4);
+  for(size_t i = 0; i < chunk.numWalls; i++) {
+    const size_t w = chunk.firstWall + i;
+    const glm::vec2& v1 = mWalls[w].v1;
+    const glm::vec2& v2 = mWalls[w].v2;
+    const float layer = mWallLayers[w];
+
+    verts[i * 4 + 0] = {glm::vec4(v1.x,  0.5, v1.y, 1.0), glm::vec3(mCornerUVs[0], layer)};
+    verts[i * 4 + 1] = {glm::vec4(v1.x, -0.5, v1.y, 1.0), glm::vec3(mCornerUVs[1], layer)};
+    verts[i * 4 + 2] = {glm::vec4(v2.x,  0.5, v2.y, 1.0), glm::vec3(mCornerUVs[2], layer)};
+    verts[i * 4 + 3] = {glm::vec4(v2.x, -0.5, v2.y, 1.0), glm::vec3(mCornerUVs[3], layer)};
+  }
+
+  mUploads->copyTo(mGeometry.vbo, (mGeometry.base_vertex + chunk.firstWall * 4) * sizeof(Vertex), verts.data(),
+                   verts.size() * sizeof(Vertex));
+}
+
+template <Mode mode, class Tiling>
+template <class Index>
+void TileMesh<mode, Tiling>::writeWallIndices(GLuint wall, Index* dst) {
+  const GLuint vBase = wall * 4;
+  dst[0] = vBase + 0;
+  dst[1] = vBase + 1;
+  dst[2] = vBase + 2;
+  dst[3] = vBase + 1;
+  dst[4] = vBase + 3;
+  dst[5] = vBase + 2;
+}
+
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::initWallOrder(const std::vector<Wall>& walls) {
+  mWallCenters.resize(walls.size());
+  mWallOrder.resize(walls.size());
+  mWallDepths.resize(walls.size());
+  for(size_t w = 0; w < walls.size(); w++) {
+    mWallCenters[w] = glm::vec3(walls[w].v1.x + walls[w].v2.x, 0.0, walls[w].v1.y + walls[w].v2.y) / 2.0f;
+    mWallOrder[w] = w;
+  }
+  mBuildPool.parallelFor(0, mChunks.size(), [&](size_t c) {
+    sortWalls(glm::vec3(0.0), mChunks[c].firstWall, mChunks[c].firstWall + mChunks[c].numWalls);
+  });
+}
 
-  sort(v.begin(), v.end(), triDepthCmpFunc);
+template <Mode mode, class Tiling>
+std::pair<size_t, size_t> TileMesh<mode, Tiling>::sortWalls(const glm::vec3& eye, size_t first, size_t last) {
+  const size_t numWalls = last - first;
 
-  std::vector<GLuint> inds2;
-  inds2.reserve(numIndices);
-  for(auto i = v.begin(); i != v.end(); i++) {
-    GLuint iBase = *i;
-    inds2.push_back(inds[iBase * 3]);
-    inds2.push_back(inds[iBase * 3 + 1]);
-    inds2.push_back(inds[iBase * 3 + 2]);
+  // Both triangles of a wall are at the same depth, so whole walls are sorted.
+  // Compute each wall's depth once up front rather than on every comparison.
+  for(size_t i = first; i < last; i++) {
+    mWallDepths[mWallOrder[i]] = glm::distance(mWallCenters[mWallOrder[i]], eye);
   }
 
-  memcpy(inds, inds2.data(), numIndices*sizeof(GLuint));
+  // When the camera only moves a little, the last order is almost sorted, so an insertion
+  // sort from it does close to one pass of work. Give up on it if it has to move walls too
+  // far, which happens after a big jump or when sorting for the first time.
+  const size_t maxMoves = numWalls * MAX_INSERTION_MOVES_PER_WALL;
+  size_t numMoves = 0;
+  size_t firstChanged = last, lastChanged = first;
+  for(size_t i = first + 1; i < last && numMoves <= maxMoves; i++) {
+    const GLuint wall = mWallOrder[i];
+    const float depth = mWallDepths[wall];
+
+    size_t j = i;
+    for(; j > first && mWallDepths[mWallOrder[j - 1]] < depth; j--) { // Farthest first
+      mWallOrder[j] = mWallOrder[j - 1];
+    }
+    mWallOrder[j] = wall;
+
+    if(j != i) {
+      numMoves += i - j;
+      firstChanged = std::min(firstChanged, j);
+      lastChanged = std::max(lastChanged, i + 1);
+    }
+  }
+
+  if(numMoves > maxMoves) {
+    std::vector<uint32_t> keys(numWalls);
+    std::vector<GLuint> order(mWallOrder.begin() + first, mWallOrder.begin() + last);
+    for(size_t i = 0; i < numWalls; i++) {
+      keys[i] = ~utils::sortableFloatKey(mWallDepths[order[i]]);
+    }
+    utils::radixSortByKey(keys, order);
+    std::copy(order.begin(), order.end(), mWallOrder.begin() + first);
+    return std::make_pair(first, last);
+  }
+
+  return firstChanged < lastChanged ? std::make_pair(firstChanged, lastChanged) : std::make_pair(size_t(0), size_t(0));
+}
+
+template <Mode mode, class Tiling>
+bool TileMesh<mode, Tiling>::isWallVisible(const glm::vec2& v1, const glm::vec2& v2) {
+  const glm::vec3 v1_to_v2 = glm::vec3(v2.x, 0.0, v2.y) - glm::vec3(v1.x, 0.0, v1.y);
+  const glm::vec3 tangent = normalize(v1_to_v2);
+  const glm::vec3 normal = normalize(cross(glm::vec3(0.0, 1.0, 0.0), tangent));
+  const glm::vec3 view_dir = normalize((glm::vec3(v1.x, 0.0f, v1.y) + (v1_to_v2 / 2.0f)));
+  return dot(view_dir, normal) >= 0.0;
+}
+
+template <Mode mode, class Tiling>
+bool TileMesh<mode, Tiling>::hasVisibleWall(const typename Tiling::Edge& e, const glm::vec2& centroidOffset) {
+  return e.adjacentTile != nullptr &&
+         isWallVisible(e.v1->coords2d() - centroidOffset, e.v2->coords2d() - centroidOffset);
 }
 
 template <Mode mode, class Tiling>
-GLuint TileMesh<mode, Tiling>::makeTextureArray(size_t w, size_t h, size_t n) {
-  GLuint texArray;
-  glGenTextures(1, &texArray);
-  glBindTexture(GL_TEXTURE_2D_ARRAY, texArray);
+typename TileMesh<mode, Tiling>::WallLayout TileMesh<mode, Tiling>::layoutWalls() {
+  const glm::vec2 TILE_CENTROID_OFFSET = Tiling::tileCenterCoords2d(glm::ivec2(0));
 
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  WallLayout layout;
+  layout.tiles.reserve(mTiling.tileCount());
+  for(auto t = mTiling.tiles_begin(); t != mTiling.tiles_end(); t++) {
+    layout.tiles.push_back(&t->second);
+  }
 
-  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, w, h, n);
+  // Count each tile's walls in parallel, then turn the counts into offsets
+  layout.offsets.resize(layout.tiles.size() + 1, 0);
+  mBuildPool.parallelFor(0, layout.tiles.size(), [&](size_t i) {
+    size_t count = 0;
+    for(auto e = layout.tiles[i]->edges_begin(); e != layout.tiles[i]->edges_end(); e++) {
+      count += hasVisibleWall(*e, TILE_CENTROID_OFFSET) ? 1 : 0;
+    }
+    layout.offsets[i + 1] = count;
+  });
 
-  return texArray;
+  for(size_t i = 1; i < layout.offsets.size(); i++) {
+    layout.offsets[i] += layout.offsets[i - 1];
+  }
+
+  return layout;
 }
 
 template <Mode mode, class Tiling>
-void TileMesh<mode, Tiling>::loadImgToTexArray(const std::string& key, GLuint tex, size_t arrayIndex) {
+utils::MipChain TileMesh<mode, Tiling>::decodeImage(const std::string& key, bool isDepth) {
+  struct stat fileInfo;
+  if(stat(key.c_str(), &fileInfo) != 0) {
+    throw std::runtime_error(std::string("Failed to load texture: ") + key);
+  }
+
+  // Use the cached mip chain if it was built from the current version of the image
+  const std::string cacheKey = key + std::string(".mips");
+  const size_t bytesPerTexel = isDepth ? 2 : 4;
+  utils::MipChain chain;
+  if(utils::readMipCache(cacheKey, fileInfo.st_mtime, chain) &&
+     chain.width == TILE_TEX_DIM && chain.height == TILE_TEX_DIM && chain.bytesPerTexel == bytesPerTexel) {
+    return chain;
+  }
+
   // Load the image into memory
   int w, h, channels;
-  unsigned char* img = SOIL_load_image(key.c_str(), &w, &h, &channels, SOIL_LOAD_AUTO);
+  unsigned char* img = SOIL_load_image(key.c_str(), &w, &h, &channels, isDepth ? SOIL_LOAD_L : SOIL_LOAD_RGBA);
 
   if(img == 0) {
     throw std::runtime_error(std::string("Failed to load texture: ") + key);
   }
 
-  glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
-  glTexSubImage3D(GL_TEXTURE_2D_ARRAY,
-      0, // Mipmap level
-      0, 0, arrayIndex, // x-offset, y-offset, z-offset
-      w, h, 1, // width, height, depth
-      GL_RGBA, GL_UNSIGNED_BYTE, img);
+  if(static_cast<size_t>(w) != TILE_TEX_DIM || static_cast<size_t>(h) != TILE_TEX_DIM) {
+    SOIL_free_image_data(img);
+    throw std::runtime_error(std::string("Texture has the wrong dimensions: ") + key);
+  }
+
+  chain.width = w;
+  chain.height = h;
+  chain.bytesPerTexel = bytesPerTexel;
+  chain.levels.resize(1);
+  chain.levels[0].resize(w * h * bytesPerTexel);
+  if(isDepth) {
+    // Widen 8 bit depth to the 16 bit storage format so the reduced levels don't lose precision
+    uint16_t* dst = reinterpret_cast<uint16_t*>(chain.levels[0].data());
+    for(int i = 0; i < w * h; i++) {
+      dst[i] = img[i] * 257;
+    }
+  } else {
+    memcpy(chain.levels[0].data(), img, chain.levels[0].size());
+  }
   SOIL_free_image_data(img);
+
+  if(isDepth) {
+    utils::generateMipChain(chain, DEPTH_MIP_REDUCTION);
+  } else {
+    utils::generateMipChain(chain, utils::MipReduction::AVERAGE);
+  }
+
+  // Failing to write the cache only costs us the decode next time
+  utils::writeMipCache(cacheKey, fileInfo.st_mtime, chain);
+
+  return chain;
 }
 
 template <Mode mode, class Tiling>
@@ -113,221 +553,328 @@ std::pair<std::string, std::string> TileMesh<mode, Tiling>::getTexKey(const glm:
 }
 
 
-// TODO: Identify each face based on the tile it is looking into
-template <Mode mode, typename Tiling>
-Geometry TileMesh<mode, Tiling>::generateTexturedTileGeometry() {
+template <Mode mode, class Tiling>
+std::vector<typename TileMesh<mode, Tiling>::Wall> TileMesh<mode, Tiling>::collectWalls(const WallLayout& layout) {
+  const glm::vec2 TILE_CENTROID_OFFSET = Tiling::tileCenterCoords2d(glm::ivec2(0));
+
+  // Each tile writes its walls to its own range, so the tiles can be walked in parallel
+  std::vector<Wall> walls(layout.numWalls());
+  mBuildPool.parallelFor(0, layout.tiles.size(), [&](size_t i) {
+    typename Tiling::Tile* t = layout.tiles[i];
+    size_t w = layout.offsets[i];
+    for(auto e = t->edges_begin(); e != t->edges_end(); e++) { // For each edge of t, e
+      if(hasVisibleWall(*e, TILE_CENTROID_OFFSET)) {
+        walls[w++] = Wall{ t, e->adjacentTile, e->v1->coords2d() - TILE_CENTROID_OFFSET, e->v2->coords2d() - TILE_CENTROID_OFFSET, e->v1, e->v2 };
+      }
+    }
+  });
 
-  // These numbers are an overestimate of the actual number of vertices.
-  // TODO: Compute exact values
-  const size_t numVertices = mTiling.tileCount() * mTiling.numVertsPerTile() * 4;
-  const size_t numIndices = mTiling.tileCount() * mTiling.numEdgesPerTile() * 6;
+  return walls;
+}
 
-  Geometry ret = Geometry::makeGeometry<Vertex4P3T>(numVertices, numIndices);
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::chunkWalls(std::vector<Wall>& walls) {
+  // The chunk key of each wall is its ring and sector, by the wall's center
+  std::vector<size_t> keys(walls.size());
+  mBuildPool.parallelFor(0, walls.size(), [&](size_t w) {
+    const glm::vec2 center = (walls[w].v1 + walls[w].v2) / 2.0f;
+    const size_t ring = static_cast<size_t>(glm::length(center) / CHUNK_RING_WIDTH);
+    const float turns = (std::atan2(center.y, center.x) + glm::pi<float>()) / glm::two_pi<float>();
+    const size_t sector = std::min(static_cast<size_t>(turns * NUM_CHUNK_SECTORS), NUM_CHUNK_SECTORS - 1);
+    keys[w] = ring * NUM_CHUNK_SECTORS + sector;
+  });
+
+  // Counting sort the walls by key. Empty keys don't get a chunk.
+  const size_t numKeys = walls.empty() ? 0 : *std::max_element(keys.begin(), keys.end()) + 1;
+  std::vector<size_t> offsets(numKeys + 1, 0);
+  for(auto k = keys.begin(); k != keys.end(); k++) {
+    offsets[*k + 1]++;
+  }
 
-  glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
+  // Keys with more walls than fit in a chunk get several chunks, in order
+  mChunks.clear();
+  std::vector<GLuint> keyChunks(numKeys);
+  for(size_t k = 0; k < numKeys; k++) {
+    keyChunks[k] = mChunks.size();
+    for(size_t first = 0; first < offsets[k + 1]; first += MAX_CHUNK_WALLS) {
+      mChunks.push_back(Chunk{ offsets[k] + first, std::min(offsets[k + 1] - first, MAX_CHUNK_WALLS), AABB(), true, true });
+    }
+    offsets[k + 1] += offsets[k];
+  }
 
-  Vertex* verts = reinterpret_cast<Vertex*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
+  std::vector<Wall> sorted(walls.size());
+  mWallChunks.resize(walls.size());
+  for(size_t w = 0; w < walls.size(); w++) {
+    const size_t dst = offsets[keys[w]]++;
+    const GLuint keyChunk = keyChunks[keys[w]];
+    const GLuint c = keyChunk + (dst - mChunks[keyChunk].firstWall) / MAX_CHUNK_WALLS;
+    sorted[dst] = walls[w];
+    mWallChunks[dst] = c;
+    mChunks[c].bounds.extend(glm::vec3(walls[w].v1.x, -0.5, walls[w].v1.y));
+    mChunks[c].bounds.extend(glm::vec3(walls[w].v2.x, 0.5, walls[w].v2.y));
+  }
+  walls.swap(sorted);
+}
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ret.ibo);
-  GLuint* inds = reinterpret_cast<GLuint*>(glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_READ_WRITE));
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::buildWallGeometry(const std::vector<Wall>& walls, const std::array<glm::vec2, 4>& cornerUVs,
+                                               std::vector<float> layers, bool sort) {
+  // Keep the wall centers and the draw order around so the walls can be re-sorted as the
+  // camera moves. They start out sorted as seen from the center tile.
+  mWallCenters.clear();
+  mWallOrder.clear();
+  if(sort) {
+    initWallOrder(walls);
+  }
 
+  if(mGpuSorter) {
+    mGpuSorter->setWalls(mWallCenters);
+  }
 
-  const size_t IMG_DIM = 512;
-  size_t currentTexIndex = 0;
-  std::unordered_map<std::string, size_t> textures;
+  // The vertices are only written once their chunk comes into view, so a huge room costs
+  // about as much to build as the part of it which is seen
+  mWalls = walls;
+  mCornerUVs = cornerUVs;
+  mWallLayers = std::move(layers);
+  mLongWallIndices = false;
+  allocateWallGeometry();
+}
 
-  mTileTextureArray = makeTextureArray(IMG_DIM, IMG_DIM, mTiling.edgeCount()*2);
-  mTileDepthTextureArray = makeTextureArray(IMG_DIM, IMG_DIM, mTiling.edgeCount()*2);
-
-  size_t vOffset = 0, iOffset = 0;
-  for(auto t = mTiling.tiles_begin(); t != mTiling.tiles_end(); t++) { // For each tile, t
-    for(auto e = t->second.edges_begin(); e != t->second.edges_end(); e++) { // For each edge of t, e
-      // The coordinates of the vertices of the e
-      const glm::vec2 TILE_CENTROID_OFFSET = Tiling::tileCenterCoords2d(glm::ivec2(0));
-      const glm::vec2 v1 = e->v1->coords2d() - TILE_CENTROID_OFFSET;
-      const glm::vec2 v2 = e->v2->coords2d() - TILE_CENTROID_OFFSET;
-      const size_t vBase = vOffset;
-
-      size_t textureOffset = 0;
-      if(e->adjacentTile != nullptr) { // If there is a tile adjacent to i, through e
-        typename Tiling::Tile* adjTile = e->adjacentTile; // The tile adjacent to i, through e
-
-        { // Don't load views that are not visible from the center tile
-          const glm::vec3 v1_to_v2 = glm::vec3(v2.x, 0.0, v2.y) - glm::vec3(v1.x, 0.0, v1.y);
-          const glm::vec3 tangent = normalize(v1_to_v2);
-          const glm::vec3 normal = normalize(cross(glm::vec3(0.0, 1.0, 0.0), tangent));
-          const glm::vec3 view_dir = normalize((glm::vec3(v1.x, 0.0f, v1.y) + (v1_to_v2 / 2.0f)));
-          if(dot(view_dir, normal) < 0.0) {
-            continue;
-          }
-        }
-
-        // Determine the name of the texture to load for the current tile
-        std::pair<std::string, std::string> viewName = getTexKey(t->first, adjTile->id);
-        std::string key = viewName.second;
-        std::string db_key = std::string("textures/db_") + key;
-        key = std::string("textures/") + key;
-
-        if(textures.find(key) == textures.end()) {
-          loadImgToTexArray(key, mTileTextureArray, currentTexIndex);
-
-          textures[key] = currentTexIndex;
-          textureOffset = currentTexIndex;
-
-          loadImgToTexArray(db_key, mTileDepthTextureArray, currentTexIndex);
-
-          currentTexIndex += 1;
-        } else {
-          throw std::runtime_error(
-              std::string("Using texture ") + key +
-              std::string("which is already being used!"));
-        }
-
-
-        verts[vOffset++] = {glm::vec4(v1.x,  0.5, v1.y, 1.0), glm::vec3(0.0, 1.0, textureOffset)};
-        verts[vOffset++] = {glm::vec4(v1.x, -0.5, v1.y, 1.0), glm::vec3(0.0, 0.0, textureOffset)};
-        verts[vOffset++] = {glm::vec4(v2.x,  0.5, v2.y, 1.0), glm::vec3(1.0, 1.0, textureOffset)};
-        verts[vOffset++] = {glm::vec4(v2.x, -0.5, v2.y, 1.0), glm::vec3(1.0, 0.0, textureOffset)};
-
-        inds[iOffset++] = vBase + 0;
-        inds[iOffset++] = vBase + 1;
-        inds[iOffset++] = vBase + 2;
-        inds[iOffset++] = vBase + 1;
-        inds[iOffset++] = vBase + 3;
-        inds[iOffset++] = vBase + 2;
-      }
-    }
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::allocateWallGeometry() {
+  // Every visible wall is a quad made of 4 vertices and 2 triangles
+  const size_t numVertices = mWalls.size() * 4;
+  const size_t numIndices = mWalls.size() * 6;
+  const bool longIndices = mGpuSorter || mLongWallIndices;
+  std::unique_ptr<GeometryPool>& pool = longIndices ? mLongIndexWallPool : mWallPool;
+  if(!pool) {
+    pool = GeometryPool::make<Vertex4P3T>(numVertices, numIndices, longIndices ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT);
+  }
+
+  // Free the old ranges first, so the new geometry can take their place
+  mGeometry.release();
+  mGeometry = Geometry::makeGeometry<Vertex4P3T>(*pool, numVertices, numIndices);
+  for(auto c = mChunks.begin(); c != mChunks.end(); c++) {
+    c->dirty = true;
   }
 
-  // TODO: This is kind of a hack, our buffers will be too big
-  ret.num_indices = iOffset;
-  ret.num_vertices = vOffset;
+  // The new indices are written once the chunks are culled again, and nothing is drawn until
+  // then
+  mVisibleChunks.clear();
+  mVisibleRanges.clear();
+  mVisibleIndices.clear();
+}
+
+template <Mode mode, class Tiling>
+void TileMesh<mode, Tiling>::buildInstancedWalls(const std::vector<Wall>& walls, const std::vector<size_t>& viewIds) {
+  static_assert(sizeof(Vertex4P) == sizeof(glm::vec4), "The shared quad is uploaded as an array of vec4");
+
+  mWallInstances.resize(walls.size());
+  mBuildPool.parallelFor(0, walls.size(), [&](size_t w) {
+    mWallInstances[w] = WallInstance{ glm::vec4(walls[w].v1.x, walls[w].v1.y, walls[w].v2.x, walls[w].v2.y), static_cast<GLuint>(viewIds[w]) };
+  });
+
+  // Every instance is drawn in one call, so the walls make up a single chunk which is sorted
+  // as a whole
+  AABB bounds;
+  for(auto c = mChunks.begin(); c != mChunks.end(); c++) {
+    bounds.extend(c->bounds.min);
+    bounds.extend(c->bounds.max);
+  }
+  mChunks.assign(1, Chunk{ 0, walls.size(), bounds, false, true });
+  mWallChunks.assign(walls.size(), 0);
+  mWalls.clear();
+  mWallLayers.clear();
+
+  initWallOrder(walls);
+  std::vector<WallInstance> sorted(walls.size());
+  for(size_t i = 0; i < walls.size(); i++) {
+    sorted[i] = mWallInstances[mWallOrder[i]];
+  }
+
+  if(mWallQuad.vao == 0) {
+    // x is 0 at v1 and 1 at v2, and y is the height, in the same corner order as the
+    // non-instanced walls
+    static const glm::vec4 QUAD_CORNERS[4] = {
+      glm::vec4(0.0, 0.5, 0.0, 1.0), glm::vec4(0.0, -0.5, 0.0, 1.0),
+      glm::vec4(1.0, 0.5, 0.0, 1.0), glm::vec4(1.0, -0.5, 0.0, 1.0) };
+    GLuint quadIndices[6];
+    writeWallIndices(0, quadIndices);
+    mWallQuad = Geometry::makeGeometry<Vertex4P>(4, 6, QUAD_CORNERS, quadIndices);
+
+    utils::ScopedVertexArrayUnbind unbindVao;
+    glGenBuffers(1, &mInstanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+    glBindVertexArray(mWallQuad.vao);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(WallInstance), (void*) offsetof(WallInstance, endpoints));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(WallInstance), (void*) offsetof(WallInstance, view));
+    glVertexAttribDivisor(2, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // The vertex array refers to the buffer by name, so it still sees the buffer if it grows
+  if(sorted.size() > mInstanceCapacity) {
+    mInstanceCapacity = sorted.size();
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mInstanceBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, mInstanceCapacity * sizeof(WallInstance), sorted.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  } else {
+    mUploads->copyTo(mInstanceBuffer, 0, sorted.data(), sorted.size() * sizeof(WallInstance));
+  }
+}
 
-  depthsort(verts, inds, ret.num_indices);
+template <Mode mode, typename Tiling>
+void TileMesh<mode, Tiling>::generateTexturedTileGeometry() {
+  const glm::vec2 TILE_CENTROID_OFFSET = Tiling::tileCenterCoords2d(glm::ivec2(0));
+  std::vector<Wall> walls = collectWalls(layoutWalls());
+  chunkWalls(walls);
+
+  // Determine the name of the texture to load for each wall
+  std::vector<std::string> keys(walls.size());
+  mBuildPool.parallelFor(0, walls.size(), [&](size_t w) {
+    keys[w] = getTexKey(walls[w].tile->id, walls[w].adjacentTile->id).second;
+  });
+
+  // Maps texture keys to their view ids in the residency pool. The views are paged in
+  // when their walls come into view, so nothing is loaded here.
+  std::unordered_map<std::string, size_t> textures;
+  textures.reserve(walls.size());
+  mResidency->clear();
+
+  std::vector<size_t> viewIds(walls.size());
+  for(size_t w = 0; w < walls.size(); w++) {
+    const std::string key = std::string("textures/") + keys[w];
+    auto texture = textures.find(key);
+    if(texture != textures.end()) {
+      viewIds[w] = texture->second;
+      continue;
+    }
 
-  glUnmapBuffer(GL_ARRAY_BUFFER);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+    const glm::vec2& v1 = walls[w].v1;
+    const glm::vec2& v2 = walls[w].v2;
+    const std::array<glm::vec4, 4> corners {
+      glm::vec4(v1.x, 0.5, v1.y, 1.0), glm::vec4(v1.x, -0.5, v1.y, 1.0),
+      glm::vec4(v2.x, 0.5, v2.y, 1.0), glm::vec4(v2.x, -0.5, v2.y, 1.0) };
+    const float ringDistance = glm::distance(Tiling::tileCenterCoords2d(walls[w].adjacentTile->id), TILE_CENTROID_OFFSET);
+    viewIds[w] = mResidency->addView(key, std::string("textures/db_") + keys[w], corners, ringDistance);
+    textures[key] = viewIds[w];
+  }
 
-  glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  mWallInstances.clear();
+  if(mInstanced) {
+    buildInstancedWalls(walls, viewIds);
+  } else {
+    static const std::array<glm::vec2, 4> CORNER_UVS { glm::vec2(0.0, 1.0), glm::vec2(0.0, 0.0), glm::vec2(1.0, 1.0), glm::vec2(1.0, 0.0) };
+    buildWallGeometry(walls, CORNER_UVS, std::vector<float>(viewIds.begin(), viewIds.end()), true);
+  }
 
-  mNumTextures = currentTexIndex;
+  mNumTextures = mResidency->numViews();
 
-  return ret;
+  std::cout << "Created " << mNumTextures << " tile views" << std::endl;
 }
 
 // TODO: Identify each face based on the tile it is looking into
 template <Mode mode, typename Tiling>
-Geometry TileMesh<mode, Tiling>::generateIdentifiedTileGeometry() {
-  const size_t numVertices = mTiling.tileCount() * mTiling.numVertsPerTile() * 4;
-  const size_t numIndices = mTiling.tileCount() * mTiling.numEdgesPerTile() * 6;
-
-  // Setup the geometry to return
-  Geometry ret = Geometry::makeGeometry<Vertex4P3T>(numVertices, numIndices);
-  glBindBuffer(GL_ARRAY_BUFFER, ret.vbo);
-  Vertex* verts = reinterpret_cast<Vertex*>(glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE));
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ret.ibo);
-  GLuint* inds = reinterpret_cast<GLuint*>(glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_READ_WRITE));
-
-  // Maps tiles to unique integer identifiers for those tiles
+void TileMesh<mode, Tiling>::generateIdentifiedTileGeometry() {
+  std::vector<Wall> walls = collectWalls(layoutWalls());
+  chunkWalls(walls);
+
+  // Give each tile a unique integer identifier, in the order the tiles are first seen through a wall
   std::unordered_map<glm::ivec2, size_t> tileIds;
+  std::vector<float> ids(walls.size());
+  for(size_t w = 0; w < walls.size(); w++) {
+    auto id = tileIds.find(walls[w].adjacentTile->id);
+    if(id == tileIds.end()) {
+      id = tileIds.insert(std::make_pair(walls[w].adjacentTile->id, tileIds.size() + 1)).first;
+    }
+    ids[w] = static_cast<float>(id->second) / (mTiling.tileCount() + 1);
+  }
 
-  // The next tile ID to assign to a new tile
-  size_t nextId = 1;
-
-  // Index variables to keep track of how far we've written into the vertex and index buffers
-  size_t vOffset = 0, iOffset = 0;
-
-  for(auto t = mTiling.tiles_begin(); t != mTiling.tiles_end(); t++) { // For each tile, t
-    for(auto e = t->second.edges_begin(); e != t->second.edges_end(); e++) { // For each edge of t, e
-      // The coordinates of the vertices of the e
-      const glm::vec2 TILE_CENTROID_OFFSET = Tiling::tileCenterCoords2d(glm::ivec2(0));
-      const glm::vec2 v1 = e->v1->coords2d() - TILE_CENTROID_OFFSET;
-      const glm::vec2 v2 = e->v2->coords2d() - TILE_CENTROID_OFFSET;
-      const size_t vBase = vOffset;
-
-      if(e->adjacentTile != nullptr) { // If there is a tile adjacent to i, through e
-        typename Tiling::Tile* adjTile = e->adjacentTile; // The tile adjacent to i, through e
-
-        { // Don't load views that are not visible from the center tile
-          const glm::vec3 v1_to_v2 = glm::vec3(v2.x, 0.0, v2.y) - glm::vec3(v1.x, 0.0, v1.y);
-          const glm::vec3 tangent = normalize(v1_to_v2);
-          const glm::vec3 normal = normalize(cross(glm::vec3(0.0, 1.0, 0.0), tangent));
-          const glm::vec3 view_dir = normalize((glm::vec3(v1.x, 0.0f, v1.y) + (v1_to_v2 / 2.0f)));
-          if(dot(view_dir, normal) < 0.0) {
-            continue;
-          }
-        }
-
-        float id = 0; // The id of the tile we are looking into
-
-        // Get the id for a tile we've already seen or create a new one for a new tile
-        if(tileIds.find(adjTile->id) == tileIds.end()) {
-          tileIds[adjTile->id] = nextId;
-          id = nextId;
-          nextId += 1;
-        } else {
-          id = tileIds[adjTile->id];
-        }
-        id = id / (mTiling.tileCount() + 1);
-
-//        std::cout << "id is " << id << std::endl;
-        verts[vOffset++] = {glm::vec4(v1.x,  0.5, v1.y, 1.0), glm::vec3(0.0, 0.0, id)};
-        verts[vOffset++] = {glm::vec4(v1.x, -0.5, v1.y, 1.0), glm::vec3(0.0, 1.0, id)};
-        verts[vOffset++] = {glm::vec4(v2.x,  0.5, v2.y, 1.0), glm::vec3(1.0, 0.0, id)};
-        verts[vOffset++] = {glm::vec4(v2.x, -0.5, v2.y, 1.0), glm::vec3(1.0, 1.0, id)};
-
-        inds[iOffset++] = vBase + 0;
-        inds[iOffset++] = vBase + 1;
-        inds[iOffset++] = vBase + 2;
-        inds[iOffset++] = vBase + 1;
-        inds[iOffset++] = vBase + 3;
-        inds[iOffset++] = vBase + 2;
-      }
+  static const std::array<glm::vec2, 4> CORNER_UVS { glm::vec2(0.0, 0.0), glm::vec2(0.0, 1.0), glm::vec2(1.0, 0.0), glm::vec2(1.0, 1.0) };
+  buildWallGeometry(walls, CORNER_UVS, std::move(ids), false);
+}
+
+template <Mode mode, typename Tiling>
+Geometry TileMesh<mode, Tiling>::generateWeldedGeometry(bool floorAndCeiling) {
+  const glm::vec2 TILE_CENTROID_OFFSET = Tiling::tileCenterCoords2d(glm::ivec2(0));
+  const std::vector<Wall> walls = collectWalls(layoutWalls());
+
+  // The index of the top of each tiling vertex in verts. The bottom comes right after it.
+  // Only vertices which are used are emitted.
+  std::vector<glm::vec4> verts;
+  std::vector<GLuint> inds;
+  std::unordered_map<const typename Tiling::Vertex*, GLuint> vertexIndex;
+  verts.reserve(mTiling.vertexCount() * 2);
+  vertexIndex.reserve(mTiling.vertexCount());
+  auto weld = [&](typename Tiling::Vertex* v) {
+    auto i = vertexIndex.find(v);
+    if(i == vertexIndex.end()) {
+      const glm::vec2 p = v->coords2d() - TILE_CENTROID_OFFSET;
+      i = vertexIndex.insert(std::make_pair(v, static_cast<GLuint>(verts.size()))).first;
+      verts.push_back(glm::vec4(p.x, 0.5, p.y, 1.0));
+      verts.push_back(glm::vec4(p.x, -0.5, p.y, 1.0));
     }
+    return i->second;
+  };
+
+  // The same corners and winding as the unwelded walls
+  inds.reserve(walls.size() * 6);
+  for(auto w = walls.begin(); w != walls.end(); w++) {
+    const GLuint i1 = weld(w->vertex1), i2 = weld(w->vertex2);
+    const GLuint quad[6] = { i1, i1 + 1, i2, i1 + 1, i2 + 1, i2 };
+    inds.insert(inds.end(), quad, quad + 6);
   }
 
-  ret.num_indices = iOffset;
-  ret.num_vertices = vOffset;
+  if(floorAndCeiling) {
+    for(auto t = mTiling.tiles_begin(); t != mTiling.tiles_end(); t++) {
+      std::vector<GLuint> polygon;
+      float area = 0.0;
+      for(auto v = t->second.vertices_begin(); v != t->second.vertices_end(); v++) {
+        polygon.push_back(weld(*v));
+        const glm::vec2 a = (*v)->coords2d();
+        const glm::vec2 b = (v + 1 == t->second.vertices_end() ? *t->second.vertices_begin() : *(v + 1))->coords2d();
+        area += a.x * b.y - b.x * a.y;
+      }
 
-  glUnmapBuffer(GL_ARRAY_BUFFER);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+      // Turn the floor to face up and the ceiling to face down. A counterclockwise polygon in
+      // the xz plane faces down.
+      if(area > 0.0) {
+        std::reverse(polygon.begin(), polygon.end());
+      }
+      for(size_t i = 1; i + 1 < polygon.size(); i++) {
+        const GLuint floorTri[3] = { polygon[0] + 1, polygon[i] + 1, polygon[i + 1] + 1 };
+        const GLuint ceilingTri[3] = { polygon[0], polygon[i + 1], polygon[i] };
+        inds.insert(inds.end(), floorTri, floorTri + 3);
+        inds.insert(inds.end(), ceilingTri, ceilingTri + 3);
+      }
+    }
+  }
 
-  glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  // Nothing is sorted here, so the triangles can go in whatever order suits the vertex caches
+  mWeldedCacheStats.numTriangles = inds.size() / 3;
+  mWeldedCacheStats.acmrBefore = averageCacheMissRatio(inds, verts.size());
+  optimizeVertexCache(inds, verts.size());
+  remapVertices(verts, optimizeVertexFetch(inds, verts.size()));
+  mWeldedCacheStats.acmrAfter = averageCacheMissRatio(inds, verts.size());
 
-  return ret;
+  if(!mWeldedPool) {
+    mWeldedPool = GeometryPool::make<Vertex4P>(WELDED_POOL_VERTICES, WELDED_POOL_INDICES);
+  }
+  return Geometry::makeGeometry<Vertex4P>(*mWeldedPool, verts.size(), inds.size(), verts.data(), inds.data());
 }
 
 template <Mode mode, typename Tiling>
 void TileMesh<mode, Tiling>::printTextureNames() {
-  for(auto t = mTiling.tiles_begin(); t != mTiling.tiles_end(); t++) { // For each tile, t
-    for(auto e = t->second.edges_begin(); e != t->second.edges_end(); e++) { // For each edge of t, e
-      // The coordinates of the vertices of the e
-      const glm::vec2 TILE_CENTROID_OFFSET = Tiling::tileCenterCoords2d(glm::ivec2(0));
-      const glm::vec2 v1 = e->v1->coords2d() - TILE_CENTROID_OFFSET;
-      const glm::vec2 v2 = e->v2->coords2d() - TILE_CENTROID_OFFSET;
-
-      if(e->adjacentTile != nullptr) { // If there is a tile adjacent to i, through e
-        typename Tiling::Tile* adjTile = e->adjacentTile; // The tile adjacent to i, through e
-
-        { // Don't load views that are not visible from the center tile
-          const glm::vec3 v1_to_v2 = glm::vec3(v2.x, 0.0, v2.y) - glm::vec3(v1.x, 0.0, v1.y);
-          const glm::vec3 tangent = normalize(v1_to_v2);
-          const glm::vec3 normal = normalize(cross(glm::vec3(0.0, 1.0, 0.0), tangent));
-          const glm::vec3 view_dir = normalize((glm::vec3(v1.x, 0.0f, v1.y) + (v1_to_v2 / 2.0f)));
-          if(dot(view_dir, normal) < 0.0) {
-            continue;
-          }
-        }
-
-        // Determine the name of the texture to load for the current tile
-        std::pair<std::string, std::string> viewName = getTexKey(t->first, adjTile->id);
-
-        // Print the texture name
-        std::cout << viewName.first << "," << std::to_string(adjTile->id.x) << "," << std::to_string(adjTile->id.y) << std::endl;
-      }
-    }
+  const std::vector<Wall> walls = collectWalls(layoutWalls());
+  for(auto w = walls.begin(); w != walls.end(); w++) {
+    // Determine the name of the texture to load for the current tile
+    std::pair<std::string, std::string> viewName = getTexKey(w->tile->id, w->adjacentTile->id);
+
+    // Print the texture name
+    std::cout << viewName.first << "," << std::to_string(w->adjacentTile->id.x) << "," << std::to_string(w->adjacentTile->id.y) << std::endl;
   }
 }
 
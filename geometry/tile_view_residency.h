@@ -0,0 +1,599 @@
+#include <GL/glew.h>
+
+#include <string>
+#include <array>
+#include <vector>
+#include <list>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "geometry/bounding_box.h"
+#include "utils/gl_texture_array.h"
+#include "utils/gl_stream_buffer.h"
+#include "utils/mipmap.h"
+#include "utils/thread_pool.h"
+
+#ifndef TILE_VIEW_RESIDENCY_H_
+#define TILE_VIEW_RESIDENCY_H_
+
+namespace geometry {
+
+/*
+ * A 128 bit content hash of a view, made of two independently seeded 64 bit hashes. Views
+ * only share a layer if the whole hash matches, so a collision in one half can't show the
+ * wrong image.
+ */
+struct ViewHash {
+	uint64_t first = 0;
+	uint64_t second = 0;
+
+	bool operator==(const ViewHash& other) const {
+		return first == other.first && second == other.second;
+	}
+};
+
+/*
+ * The color and depth images of one tile view with their full mip chains
+ */
+struct DecodedView {
+	utils::MipChain color;
+	utils::MipChain depth;
+
+	// Content hashes of the view and of its mirror image
+	ViewHash hash;
+	ViewHash mirroredHash;
+
+	DecodedView(utils::MipChain&& c, utils::MipChain&& d) : color(std::move(c)), depth(std::move(d)) {
+		hash = hashView(false);
+		mirroredHash = hashView(true);
+	}
+
+private:
+	static constexpr uint64_t SECOND_HASH_SEED = 0x2545f4914f6cdd1dull;
+
+	ViewHash hashView(bool mirrored) const {
+		auto combine = [](uint64_t h1, uint64_t h2) { return h1 ^ (h2 + 0x9e3779b97f4a7c15ull + (h1 << 6) + (h1 >> 2)); };
+		ViewHash h;
+		h.first = combine(utils::hashImage(color, mirrored), utils::hashImage(depth, mirrored));
+		h.second = combine(utils::hashImage(color, mirrored, SECOND_HASH_SEED), utils::hashImage(depth, mirrored, SECOND_HASH_SEED));
+		return h;
+	}
+};
+
+/*
+ * Keeps the tile views which are in front of the camera resident in a fixed pool of texture
+ * array layers, sized to fit a GPU memory budget.
+ *
+ * Every view is given an id when it is added. Walls refer to their view by id, and shaders
+ * look the id up in viewTable(), a GL_R32UI buffer texture holding (layer << 1 | mirrored)
+ * for each view. Views which aren't resident point at layer 0, a placeholder which is
+ * never evicted.
+ *
+ * Each frame, update() tests the wall quad of every view against the view frustum, and
+ * against the frusta of where the camera is predicted to be shortly. It queues decodes
+ * for views which are or will soon be visible and aren't resident, largest on screen and
+ * soonest visible first. Decoded views are uploaded as they finish. Views with the same content as a resident layer, or
+ * its mirror image, share that layer. When the pool is full, the least recently visible
+ * layer is evicted. Layers visible in the current frame are never evicted, so if the
+ * visible set doesn't fit in the budget, the farthest views stay on the placeholder. Their
+ * decoded images are kept until a layer is freed or they go out of view, rather than being
+ * decoded again every frame.
+ */
+class TileViewResidency {
+public:
+	typedef std::function<DecodedView(const std::string& colorKey, const std::string& depthKey)> DecodeFunc;
+
+	static const size_t PLACEHOLDER_LAYER = 0;
+
+	/*
+	 * Where the camera is expected to be seconds from now
+	 */
+	struct PredictedCamera {
+		float seconds;
+		glm::mat4 viewProj;
+	};
+
+private:
+	struct View {
+		std::string colorKey;
+		std::string depthKey;
+		std::array<glm::vec4, 4> corners;
+		float ringDistance;
+
+		size_t layer = PLACEHOLDER_LAYER;
+		bool mirrored = false;
+		bool pending = false;
+
+		// The last frame the view was visible or predicted to be
+		uint64_t lastWantedFrame = 0;
+	};
+
+	struct Layer {
+		ViewHash hash;
+		uint64_t lastVisibleFrame = 0;
+		std::vector<size_t> views; // The views currently showing this layer
+		std::list<size_t>::iterator lruPos;
+	};
+
+	struct PageIn {
+		size_t view;
+		std::future<DecodedView> decoded;
+
+		// The decoded view once it is ready, kept if there was no layer to put it in so it
+		// isn't decoded again when a layer is freed
+		std::unique_ptr<DecodedView> ready;
+	};
+
+	struct Request {
+		float priority;
+		float ringDistance;
+		size_t view;
+
+		bool operator<(const Request& other) const {
+			return priority != other.priority ? priority > other.priority : ringDistance < other.ringDistance;
+		}
+	};
+
+	// Added to the time until a view is visible when prioritizing it, so views which are
+	// visible now don't get an infinite priority
+	static constexpr float PRIORITY_TIME_BIAS = 0.05f;
+
+	utils::GLTextureArray mColorArray;
+	utils::GLTextureArray mDepthArray;
+
+	GLuint mTableBuffer = 0;
+	GLuint mTableTexture = 0;
+	size_t mTableCapacity = 0;
+	bool mTableDirty = true;
+
+	std::vector<View> mViews;
+	std::vector<Layer> mLayers;
+	std::vector<size_t> mFreeLayers;
+
+	// Resident layers, most recently visible first
+	std::list<size_t> mLru;
+
+	// Resident layers by the first half of their content hash. Only one layer is indexed
+	// for each first half, so a layer whose first half collides with another's can't be
+	// shared, which is rare enough not to matter.
+	std::unordered_map<uint64_t, size_t> mLayerByHash;
+
+	std::list<PageIn> mPending;
+	std::vector<Request> mRequests;
+	uint64_t mFrame = 0;
+
+	// Caps which keep a burst of newly visible walls from stalling a frame
+	size_t mMaxPendingDecodes;
+	size_t mMaxUploadsPerFrame;
+
+	DecodeFunc mDecode;
+	utils::ThreadPool mDecodePool;
+
+	/*
+	 * The area of the quad on screen in normalized device coordinates, where the whole
+	 * screen has an area of 4
+	 */
+	static float screenArea(const glm::mat4& viewProj, const std::array<glm::vec4, 4>& corners) {
+		// The corners in order around the quad
+		static const size_t order[4] = { 0, 1, 3, 2 };
+
+		glm::vec2 p[4];
+		for(size_t i = 0; i < 4; i++) {
+			const glm::vec4 c = viewProj * corners[order[i]];
+			if(c.w <= 0.0f) {
+				// The quad passes by the camera, so it may cover the whole screen
+				return 4.0f;
+			}
+			p[i] = glm::clamp(glm::vec2(c) / c.w, glm::vec2(-1.0f), glm::vec2(1.0f));
+		}
+
+		float area = 0.0f;
+		for(size_t i = 0; i < 4; i++) {
+			area += p[i].x * p[(i+1) % 4].y - p[(i+1) % 4].x * p[i].y;
+		}
+		return std::abs(area) / 2.0f;
+	}
+
+	void uploadLayer(const DecodedView& view, size_t layer) {
+		// Rows of the small mip levels are not 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for(size_t level = 0; level < mColorArray.levels(); level++) {
+			mColorArray.upload(layer, level, GL_RGBA, GL_UNSIGNED_BYTE, view.color.levels[level].data());
+			mDepthArray.upload(layer, level, GL_RED, GL_UNSIGNED_SHORT, view.depth.levels[level].data());
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	void uploadPlaceholder() {
+		// Opaque mid grey at the far plane
+		utils::MipChain color, depth;
+		color.width = depth.width = mColorArray.width();
+		color.height = depth.height = mColorArray.height();
+		color.bytesPerTexel = 4;
+		depth.bytesPerTexel = 2;
+		color.levels.push_back(std::vector<uint8_t>(color.width * color.height * 4, 128));
+		depth.levels.push_back(std::vector<uint8_t>(depth.width * depth.height * 2, 255));
+		for(size_t i = 3; i < color.levels[0].size(); i += 4) {
+			color.levels[0][i] = 255;
+		}
+		utils::generateMipChain(color, utils::MipReduction::AVERAGE);
+		utils::generateMipChain(depth, utils::MipReduction::MIN);
+
+		const DecodedView placeholder(std::move(color), std::move(depth));
+		uploadLayer(placeholder, PLACEHOLDER_LAYER);
+	}
+
+	void touch(size_t layer) {
+		mLru.splice(mLru.begin(), mLru, mLayers[layer].lruPos);
+	}
+
+	void setViewLayer(size_t view, size_t layer, bool mirrored) {
+		mViews[view].layer = layer;
+		mViews[view].mirrored = mirrored;
+		if(layer != PLACEHOLDER_LAYER) {
+			mLayers[layer].views.push_back(view);
+		}
+		mTableDirty = true;
+	}
+
+	/*
+	 * Returns a layer which can be overwritten, evicting the least recently visible layer
+	 * if there are no free ones. Returns PLACEHOLDER_LAYER if every layer is visible now.
+	 * Layers which are visible now are always at the front of the LRU list, so only the
+	 * back of the list needs to be checked.
+	 */
+	size_t allocateLayer() {
+		if(!mFreeLayers.empty()) {
+			size_t layer = mFreeLayers.back();
+			mFreeLayers.pop_back();
+			mLayers[layer].lruPos = mLru.insert(mLru.begin(), layer);
+			return layer;
+		}
+
+		if(mLru.empty() || mLayers[mLru.back()].lastVisibleFrame == mFrame) {
+			return PLACEHOLDER_LAYER;
+		}
+
+		size_t layer = mLru.back();
+		Layer& l = mLayers[layer];
+		for(auto v = l.views.begin(); v != l.views.end(); v++) {
+			mViews[*v].layer = PLACEHOLDER_LAYER;
+			mViews[*v].mirrored = false;
+		}
+		l.views.clear();
+		auto indexed = mLayerByHash.find(l.hash.first);
+		if(indexed != mLayerByHash.end() && indexed->second == layer) {
+			mLayerByHash.erase(indexed);
+		}
+		mTableDirty = true;
+
+		mLru.splice(mLru.begin(), mLru, l.lruPos);
+		return layer;
+	}
+
+	/*
+	 * Show a decoded view, in a layer holding the same image if there is one. Returns false,
+	 * and leaves the view pending, if there is no layer for it because every layer is visible.
+	 */
+	bool pageIn(size_t view, const DecodedView& decoded) {
+		// Share a resident layer holding the same image or its mirror image
+		auto same = mLayerByHash.find(decoded.hash.first);
+		if(same != mLayerByHash.end() && mLayers[same->second].hash == decoded.hash) {
+			mViews[view].pending = false;
+			setViewLayer(view, same->second, false);
+			touch(same->second);
+			return true;
+		}
+		auto mirror = mLayerByHash.find(decoded.mirroredHash.first);
+		if(mirror != mLayerByHash.end() && mLayers[mirror->second].hash == decoded.mirroredHash) {
+			mViews[view].pending = false;
+			setViewLayer(view, mirror->second, true);
+			touch(mirror->second);
+			return true;
+		}
+
+		const size_t layer = allocateLayer();
+		if(layer == PLACEHOLDER_LAYER) {
+			return false;
+		}
+
+		mViews[view].pending = false;
+		uploadLayer(decoded, layer);
+		mLayers[layer].hash = decoded.hash;
+		mLayers[layer].lastVisibleFrame = mFrame; // Don't evict it again in the frame it was uploaded
+		mLayerByHash.insert(std::make_pair(decoded.hash.first, layer));
+		setViewLayer(view, layer, false);
+		touch(layer);
+		return true;
+	}
+
+	/*
+	 * Upload the view table if it changed. The new table is copied into place through
+	 * uploads, so draws still reading the old table aren't waited on.
+	 */
+	void updateTable(utils::GLStreamBuffer& uploads) {
+		if(mViews.size() > mTableCapacity) {
+			mTableCapacity = mViews.size();
+			glBindBuffer(GL_TEXTURE_BUFFER, mTableBuffer);
+			glBufferData(GL_TEXTURE_BUFFER, mTableCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+			// The buffer texture has to be re-attached to see the new storage
+			glBindTexture(GL_TEXTURE_BUFFER, mTableTexture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, mTableBuffer);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+			mTableDirty = true;
+		}
+
+		if(!mTableDirty || mViews.empty()) {
+			return;
+		}
+
+		std::vector<GLuint> table(mViews.size());
+		for(size_t i = 0; i < mViews.size(); i++) {
+			table[i] = static_cast<GLuint>(mViews[i].layer << 1) | (mViews[i].mirrored ? 1 : 0);
+		}
+		uploads.copyTo(mTableBuffer, 0, table.data(), table.size() * sizeof(GLuint));
+		mTableDirty = false;
+	}
+
+public:
+	/*
+	 * Allocate a pool of as many dim by dim layers with the given number of mip levels as
+	 * fit in budgetBytes. decode is called on the decode workers to load a view, so it must
+	 * not make any GL calls.
+	 */
+	TileViewResidency(size_t budgetBytes, GLenum colorFormat, GLenum depthFormat, size_t dim, size_t levels,
+	                  const DecodeFunc& decode, size_t maxPendingDecodes = 0, size_t maxUploadsPerFrame = 4) :
+		mColorArray(colorFormat, dim, dim, levels),
+		mDepthArray(depthFormat, dim, dim, levels),
+		mMaxPendingDecodes(maxPendingDecodes),
+		mMaxUploadsPerFrame(maxUploadsPerFrame),
+		mDecode(decode) {
+		// Decodes run in the order they are queued, so keeping the queue short lets new high
+		// priority views jump ahead of ones queued frames ago
+		if(mMaxPendingDecodes == 0) {
+			mMaxPendingDecodes = 2 * mDecodePool.size();
+		}
+
+		GLint maxLayers;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+		const size_t bytesPerLayer = mColorArray.bytesPerLayer() + mDepthArray.bytesPerLayer();
+		const size_t numLayers = std::min<size_t>(std::max<size_t>(budgetBytes / bytesPerLayer, 2), maxLayers);
+
+		mColorArray.reserve(numLayers);
+		mDepthArray.reserve(numLayers);
+		mLayers.resize(numLayers);
+		for(size_t i = 0; i < numLayers; i++) {
+			mColorArray.append();
+			mDepthArray.append();
+		}
+		uploadPlaceholder();
+
+		glGenBuffers(1, &mTableBuffer);
+		glGenTextures(1, &mTableTexture);
+
+		clear();
+
+		std::cout << "Tile view pool holds " << numLayers - 1 << " views in " <<
+				allocatedBytes() / (1024 * 1024) << " MiB of texture memory" << std::endl;
+	}
+
+	TileViewResidency(const TileViewResidency&) = delete;
+	TileViewResidency& operator=(const TileViewResidency&) = delete;
+
+	~TileViewResidency() {
+		glDeleteTextures(1, &mTableTexture);
+		glDeleteBuffers(1, &mTableBuffer);
+	}
+
+	/*
+	 * Forget every view and free every layer except the placeholder
+	 */
+	void clear() {
+		mViews.clear();
+		mPending.clear();
+		mRequests.clear();
+		mLru.clear();
+		mLayerByHash.clear();
+		mFreeLayers.clear();
+		for(size_t i = mLayers.size() - 1; i > PLACEHOLDER_LAYER; i--) {
+			mLayers[i].views.clear();
+			mFreeLayers.push_back(i);
+		}
+		mTableDirty = true;
+	}
+
+	/*
+	 * Add a view whose wall has the given corners and which is ringDistance away from the
+	 * center tile. Returns the id of the view. The view starts out on the placeholder layer.
+	 */
+	size_t addView(const std::string& colorKey, const std::string& depthKey,
+	               const std::array<glm::vec4, 4>& corners, float ringDistance) {
+		View v;
+		v.colorKey = colorKey;
+		v.depthKey = depthKey;
+		v.corners = corners;
+		v.ringDistance = ringDistance;
+		mViews.push_back(v);
+		mTableDirty = true;
+		return mViews.size() - 1;
+	}
+
+	/*
+	 * Page views in and out for a camera with the given view projection matrix. predictions
+	 * are where the camera is expected to be in the near future, in order of increasing time.
+	 * Views which will come into view there are fetched ahead of time. The view table is
+	 * streamed through uploads. Call once per frame before drawing.
+	 */
+	void update(const glm::mat4& viewProj, utils::GLStreamBuffer& uploads,
+	            const std::vector<PredictedCamera>& predictions = std::vector<PredictedCamera>()) {
+		mFrame += 1;
+
+		// Mark the layers of visible views as used and request the missing ones
+		mRequests.clear();
+		std::vector<size_t> visibleLayers;
+		for(size_t i = 0; i < mViews.size(); i++) {
+			View& v = mViews[i];
+
+			float seconds = 0.0f, area = 0.0f;
+			if(isInFrustum(viewProj, v.corners)) {
+				area = screenArea(viewProj, v.corners);
+				if(v.layer != PLACEHOLDER_LAYER) {
+					mLayers[v.layer].lastVisibleFrame = mFrame;
+					visibleLayers.push_back(v.layer);
+				}
+			} else {
+				auto p = predictions.begin();
+				while(p != predictions.end() && !isInFrustum(p->viewProj, v.corners)) {
+					p++;
+				}
+				if(p == predictions.end()) {
+					continue;
+				}
+				seconds = p->seconds;
+				area = screenArea(p->viewProj, v.corners);
+				if(v.layer != PLACEHOLDER_LAYER) {
+					touch(v.layer);
+				}
+			}
+			v.lastWantedFrame = mFrame;
+
+			if(v.layer == PLACEHOLDER_LAYER && !v.pending) {
+				mRequests.push_back(Request{ area / (seconds + PRIORITY_TIME_BIAS), v.ringDistance, i });
+			}
+		}
+
+		// Touch the layers visible now last so they end up at the front of the LRU list
+		for(auto l = visibleLayers.begin(); l != visibleLayers.end(); l++) {
+			touch(*l);
+		}
+
+		std::sort(mRequests.begin(), mRequests.end());
+		for(auto r = mRequests.begin(); r != mRequests.end() && mPending.size() < mMaxPendingDecodes; r++) {
+			View& v = mViews[r->view];
+			v.pending = true;
+
+			DecodeFunc decode = mDecode;
+			const std::string colorKey = v.colorKey, depthKey = v.depthKey;
+			mPending.push_back(PageIn{ r->view, mDecodePool.submit([decode, colorKey, depthKey] {
+				return decode(colorKey, depthKey);
+			})});
+		}
+
+		// Upload the views which have finished decoding. Views which found no layer wait, still
+		// pending and holding their slot in the queue, until a layer is freed, and are dropped
+		// once they are no longer wanted.
+		size_t numUploads = 0;
+		for(auto p = mPending.begin(); p != mPending.end() && numUploads < mMaxUploadsPerFrame;) {
+			if(p->ready) {
+				if(mViews[p->view].lastWantedFrame != mFrame) {
+					mViews[p->view].pending = false;
+					p = mPending.erase(p);
+					continue;
+				}
+			} else if(p->decoded.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+				p->ready.reset(new DecodedView(p->decoded.get()));
+			} else {
+				p++;
+				continue;
+			}
+
+			if(!pageIn(p->view, *p->ready)) {
+				p++;
+				continue;
+			}
+			p = mPending.erase(p);
+			numUploads += 1;
+		}
+
+		updateTable(uploads);
+	}
+
+	GLuint colorTextureArray() const {
+		return mColorArray.id();
+	}
+
+	GLuint depthTextureArray() const {
+		return mDepthArray.id();
+	}
+
+	/*
+	 * The GL_TEXTURE_BUFFER mapping view ids to (layer << 1 | mirrored)
+	 */
+	GLuint viewTable() const {
+		return mTableTexture;
+	}
+
+	size_t numViews() const {
+		return mViews.size();
+	}
+
+	/*
+	 * The number of layers holding a view, not counting the placeholder
+	 */
+	size_t numResidentLayers() const {
+		return mLru.size();
+	}
+
+	/*
+	 * The number of views paged in to a layer, rather than showing the placeholder
+	 */
+	size_t numPagedInViews() const {
+		size_t n = 0;
+		for(auto l = mLru.begin(); l != mLru.end(); l++) {
+			n += mLayers[*l].views.size();
+		}
+		return n;
+	}
+
+	/*
+	 * The number of paged in views sharing a layer with another view, each of which saves a
+	 * layer. The first view paged in to a layer doesn't count.
+	 */
+	size_t numSharedViews() const {
+		size_t n = 0;
+		for(auto l = mLru.begin(); l != mLru.end(); l++) {
+			n += std::max<size_t>(mLayers[*l].views.size(), 1) - 1;
+		}
+		return n;
+	}
+
+	/*
+	 * The number of paged in views showing their layer as a mirror image
+	 */
+	size_t numMirroredViews() const {
+		size_t n = 0;
+		for(auto v = mViews.begin(); v != mViews.end(); v++) {
+			n += v->layer != PLACEHOLDER_LAYER && v->mirrored ? 1 : 0;
+		}
+		return n;
+	}
+
+	/*
+	 * The number of bytes of GPU memory used by one color and depth layer
+	 */
+	size_t bytesPerLayer() const {
+		return mColorArray.bytesPerLayer() + mDepthArray.bytesPerLayer();
+	}
+
+	/*
+	 * The number of bytes of GPU memory allocated for the color and depth layers
+	 */
+	size_t allocatedBytes() const {
+		return mColorArray.allocatedBytes() + mDepthArray.allocatedBytes();
+	}
+};
+
+}
+
+#endif /* TILE_VIEW_RESIDENCY_H_ */
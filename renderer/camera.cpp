@@ -71,7 +71,13 @@ void Camera::setPerspectiveProjection(float fov_y, float aspect, float near_z,
 }
 
 mat4 Camera::getViewMatrix() const {
-  return lookAt(getPosition(), getPosition() + getLookatVector(), getUpVector()) * viewTransform;
+  return getViewMatrix(getPosition(), orientation);
+}
+
+mat4 Camera::getViewMatrix(const vec3& position, const quat& orientation) const {
+  const vec3 lookat = orientation * this->lookat;
+  const vec3 up = orientation * vec3(0.0, 1.0, 0.0);
+  return lookAt(position, position + lookat, up) * viewTransform;
 }
 
 mat4 Camera::getProjectionMatrix() const {
@@ -169,6 +175,7 @@ void FirstPersonCamera::updateLookat(const glm::vec2& pos) {
   vec2 dCamSphericalPos = pos * vec2(getFovX(), getFovY()) / 2.0f;
   dCamSphericalPos = cameraAngularVel * radians(dCamSphericalPos);
   cameraSphericalCoords += dCamSphericalPos;
+  lastSphericalDelta = dCamSphericalPos;
 
   // Don't let the user rotate up and down more than 90 degrees
   cameraSphericalCoords.x = clamp(cameraSphericalCoords.x, -half_pi<float>(), half_pi<float>());
@@ -185,7 +192,31 @@ void FirstPersonCamera::setAngularVelocity(const glm::vec2& vel) {
 }
 
 void FirstPersonCamera::updatePosition() {
+  const vec3 lastPosition = getPosition();
+
   advance(moveCamera.z * cameraVelocity.z);
   strafeRight(moveCamera.x * cameraVelocity.x);
   strafeUp(moveCamera.y * cameraVelocity.y);
+
+  // Movement is applied per frame, so the frame time turns it into a rate.
+  // Rates are smoothed over a few frames so one slow frame doesn't throw off predictions.
+  const auto now = chrono::steady_clock::now();
+  if(hasLastUpdate) {
+    const float dt = chrono::duration<float>(now - lastUpdate).count();
+    if(dt > 0.0f && dt < 0.25f) {
+      const float smoothing = 0.25f;
+      measuredVelocity = mix(measuredVelocity, (getPosition() - lastPosition) / dt, smoothing);
+      measuredAngularRate = mix(measuredAngularRate, lastSphericalDelta / dt, smoothing);
+    }
+  }
+  lastUpdate = now;
+  hasLastUpdate = true;
+}
+
+mat4 FirstPersonCamera::predictViewMatrix(float seconds) const {
+  vec2 sphericalCoords = cameraSphericalCoords + measuredAngularRate * seconds;
+  sphericalCoords.x = clamp(sphericalCoords.x, -half_pi<float>(), half_pi<float>());
+
+  const quat orientation(vec3(sphericalCoords.x, sphericalCoords.y, 0.0));
+  return getViewMatrix(getPosition() + measuredVelocity * seconds, orientation);
 }
@@ -1,3 +1,5 @@
+#include <chrono>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
@@ -31,6 +33,11 @@ public:
   void setOrthographicProjection(float left, float right, float bottom, float top, float near, float far);
 
   glm::mat4 getViewMatrix() const;
+
+  /*
+   * The view matrix the camera would have if it were at position with the given orientation
+   */
+  glm::mat4 getViewMatrix(const glm::vec3& position, const glm::quat& orientation) const;
   glm::mat4 getProjectionMatrix() const;
   glm::vec3 getLookatVector() const;
   glm::vec3 getUpVector() const;
@@ -48,6 +55,13 @@ class FirstPersonCamera : public Camera {
   glm::vec3 cameraVelocity = glm::vec3(1.0);
   glm::vec2 cameraAngularVel = glm::vec2(1.0);
 
+  // How fast the camera actually moved over the last few frames, in units and radians per second
+  glm::vec3 measuredVelocity = glm::vec3(0.0);
+  glm::vec2 measuredAngularRate = glm::vec2(0.0);
+  glm::vec2 lastSphericalDelta = glm::vec2(0.0);
+  std::chrono::steady_clock::time_point lastUpdate;
+  bool hasLastUpdate = false;
+
 public:
   FirstPersonCamera() = default;
   FirstPersonCamera(const glm::vec3& vel, const glm::vec2& angVel);
@@ -66,5 +80,25 @@ public:
   glm::vec3 getCameraVelocity() const {
     return moveCamera * cameraVelocity;
   }
+
+  /*
+   * The world space velocity of the camera in units per second
+   */
+  glm::vec3 getMeasuredVelocity() const {
+    return measuredVelocity;
+  }
+
+  /*
+   * The rate at which the camera is turning in radians per second about its x and y axes
+   */
+  glm::vec2 getMeasuredAngularRate() const {
+    return measuredAngularRate;
+  }
+
+  /*
+   * Extrapolate the camera's current velocity and angular rate seconds into the future,
+   * and return the view matrix it would have then
+   */
+  glm::mat4 predictViewMatrix(float seconds) const;
 };
 #endif /* CAMERA_H_ */
@@ -0,0 +1,199 @@
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+
+#include <glm/glm.hpp>
+
+#include "utils/radix_sort.h"
+
+#ifndef RENDERER_DRAW_LIST_H_
+#define RENDERER_DRAW_LIST_H_
+
+class Geometry;
+class Material;
+struct IndexRanges;
+
+/*
+ * Draws recorded for a frame, to be sorted by state and submitted together with
+ * Renderer::submit. Packets and their texture bindings are kept in vectors which are cleared
+ * but not freed between frames, so recording doesn't allocate once the list has warmed up.
+ *
+ * A DrawList isn't thread safe. To record from several threads, give each thread its own
+ * list and merge them into one before submitting. Everything a packet points to must stay
+ * alive until the list is submitted.
+ */
+class DrawList {
+public:
+	struct TextureBinding {
+		GLuint unit;
+		GLenum target;
+		GLuint texture;
+	};
+
+	struct Packet {
+		GLuint program;
+		const Material* material;    // nullptr if the program doesn't use one
+		uint32_t firstTexture;       // Into textures()
+		uint32_t numTextures;
+		const Geometry* geometry;
+		const IndexRanges* ranges;   // Draw only these ranges of the index buffer, if given
+		size_t numInstances;         // Draw instanced if not 0
+		glm::mat4 transform;
+		GLenum primitive;
+	};
+
+	/*
+	 * How the draws of a layer are ordered. STATE groups draws with the same program,
+	 * material and textures, and draws each group front to back, for opaque geometry.
+	 * BACK_TO_FRONT ignores state, for blended geometry.
+	 */
+	enum class LayerOrder { STATE, BACK_TO_FRONT };
+
+	// Bits of the sort key. The layer always comes first.
+	static const unsigned LAYER_BITS = 8;
+	static const unsigned PROGRAM_BITS = 16;
+	static const unsigned STATE_BITS = 16;
+	static const unsigned DEPTH_BITS = 24;
+
+private:
+	std::vector<Packet> mPackets;
+	std::vector<uint64_t> mKeys;
+	std::vector<TextureBinding> mTextures;
+
+	// The order to submit the packets in as of the last sort, and scratch space for sorting
+	std::vector<uint32_t> mOrder;
+	std::vector<uint64_t> mSortKeys;
+
+	static uint64_t bits(uint64_t value, unsigned numBits) {
+		return value & ((uint64_t(1) << numBits) - 1);
+	}
+
+	/*
+	 * A hash of the material and textures of a packet. Packets with different state can share
+	 * a hash, which only costs them being grouped less tightly.
+	 */
+	uint64_t stateHash(const Packet& packet) const {
+		size_t h = std::hash<const void*>()(packet.material);
+		for(uint32_t t = packet.firstTexture; t < packet.firstTexture + packet.numTextures; t++) {
+			h = h * 31 + mTextures[t].texture;
+		}
+		return bits(h ^ (h >> 16) ^ (h >> 32), STATE_BITS);
+	}
+
+public:
+	/*
+	 * The sort key of a draw. viewDepth is the distance from the camera, and only its top
+	 * DEPTH_BITS bits are kept.
+	 */
+	static uint64_t makeKey(uint8_t layer, LayerOrder order, GLuint program, uint64_t state, float viewDepth) {
+		uint64_t depth = utils::sortableFloatKey(viewDepth) >> (32 - DEPTH_BITS);
+		const uint64_t layerBits = uint64_t(layer) << (64 - LAYER_BITS);
+		if(order == LayerOrder::BACK_TO_FRONT) {
+			depth = bits(~depth, DEPTH_BITS); // Farthest first
+			return layerBits | (depth << (PROGRAM_BITS + STATE_BITS)) |
+			       (bits(program, PROGRAM_BITS) << STATE_BITS) | bits(state, STATE_BITS);
+		}
+		return layerBits | (bits(program, PROGRAM_BITS) << (STATE_BITS + DEPTH_BITS)) |
+		       (bits(state, STATE_BITS) << DEPTH_BITS) | depth;
+	}
+
+	/*
+	 * Record a draw of geometry with program, in the given layer. Lower layers are drawn
+	 * first. ranges and numInstances are as in Renderer's draw functions, where at most one
+	 * of them is used. Renderer draws packets with a material made by it with the program
+	 * the material points to when the list is submitted, since that changes with the lights.
+	 */
+	void record(uint8_t layer, LayerOrder order, GLuint program, const Material* material,
+	            std::initializer_list<TextureBinding> textures, const Geometry& geometry,
+	            const glm::mat4& transform, float viewDepth, GLenum primitive = GL_TRIANGLES,
+	            const IndexRanges* ranges = nullptr, size_t numInstances = 0) {
+		Packet packet = { program, material, static_cast<uint32_t>(mTextures.size()),
+		                  static_cast<uint32_t>(textures.size()), &geometry, ranges, numInstances,
+		                  transform, primitive };
+		mTextures.insert(mTextures.end(), textures.begin(), textures.end());
+		mKeys.push_back(makeKey(layer, order, program, stateHash(packet), viewDepth));
+		mPackets.push_back(packet);
+	}
+
+	/*
+	 * Move the packets of other to the end of this list, leaving other empty
+	 */
+	void merge(DrawList& other) {
+		const uint32_t textureBase = mTextures.size();
+		for(auto p = other.mPackets.begin(); p != other.mPackets.end(); p++) {
+			p->firstTexture += textureBase;
+		}
+		mPackets.insert(mPackets.end(), other.mPackets.begin(), other.mPackets.end());
+		mKeys.insert(mKeys.end(), other.mKeys.begin(), other.mKeys.end());
+		mTextures.insert(mTextures.end(), other.mTextures.begin(), other.mTextures.end());
+		other.clear();
+	}
+
+	/*
+	 * Sort the packets by key. Packets with the same key stay in the order they were recorded.
+	 */
+	void sort() {
+		mOrder.resize(mPackets.size());
+		for(size_t i = 0; i < mOrder.size(); i++) {
+			mOrder[i] = i;
+		}
+		mSortKeys.assign(mKeys.begin(), mKeys.end());
+		utils::radixSortByKey(mSortKeys, mOrder);
+	}
+
+	/*
+	 * Whether two packets of this list draw with the same program, material and textures
+	 */
+	bool sameState(const Packet& a, const Packet& b) const {
+		if(a.program != b.program || a.material != b.material || a.numTextures != b.numTextures) {
+			return false;
+		}
+		for(uint32_t t = 0; t < a.numTextures; t++) {
+			const TextureBinding& ta = mTextures[a.firstTexture + t];
+			const TextureBinding& tb = mTextures[b.firstTexture + t];
+			if(ta.unit != tb.unit || ta.target != tb.target || ta.texture != tb.texture) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+	 * The packets in submission order, as of the last sort
+	 */
+	const std::vector<uint32_t>& order() const {
+		return mOrder;
+	}
+
+	const std::vector<Packet>& packets() const {
+		return mPackets;
+	}
+
+	const std::vector<uint64_t>& keys() const {
+		return mKeys;
+	}
+
+	const std::vector<TextureBinding>& textures() const {
+		return mTextures;
+	}
+
+	size_t size() const {
+		return mPackets.size();
+	}
+
+	/*
+	 * Empty the list for the next frame, keeping its memory
+	 */
+	void clear() {
+		mPackets.clear();
+		mKeys.clear();
+		mTextures.clear();
+		mOrder.clear();
+	}
+};
+
+#endif /* RENDERER_DRAW_LIST_H_ */
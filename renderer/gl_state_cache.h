@@ -0,0 +1,171 @@
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+#ifndef RENDERER_GL_STATE_CACHE_H_
+#define RENDERER_GL_STATE_CACHE_H_
+
+/*
+ * A shadow copy of the GL state Renderer touches: the program, vertex array, buffer and
+ * texture bindings and enable caps. Calls which wouldn't change anything are skipped and
+ * counted.
+ *
+ * The cache can only see changes made through it. Code which changes the same state behind
+ * its back must either restore what it changed or call invalidate(), after which every
+ * binding is unknown and the next call for it is always made.
+ */
+class GLStateCache {
+public:
+	struct Stats {
+		size_t issued = 0; // GL calls made
+		size_t elided = 0; // GL calls skipped because they wouldn't have changed anything
+	};
+
+private:
+	// A binding which isn't known, and never matches a real one
+	static const GLuint UNKNOWN = ~GLuint(0);
+
+	GLuint mProgram = UNKNOWN;
+	GLuint mVertexArray = UNKNOWN;
+	GLuint mActiveTextureUnit = UNKNOWN;
+
+	// Buffer bindings by target. The element array binding is part of the vertex array
+	// state, so it is kept for each vertex array instead.
+	std::unordered_map<GLenum, GLuint> mBuffers;
+	std::unordered_map<GLuint, GLuint> mElementBuffers;
+
+	// Texture bindings by unit in the high 32 bits and target in the low 32 bits
+	std::unordered_map<uint64_t, GLuint> mTextures;
+
+	std::unordered_map<GLenum, bool> mCaps;
+
+	Stats mStats;
+
+	/*
+	 * Set binding to value, returning true if the GL call to do it needs to be made
+	 */
+	bool update(GLuint& binding, GLuint value) {
+		if(binding == value) {
+			mStats.elided++;
+			return false;
+		}
+		binding = value;
+		mStats.issued++;
+		return true;
+	}
+
+	GLuint& knownBinding(std::unordered_map<GLenum, GLuint>& bindings, GLenum key) {
+		return bindings.insert(std::make_pair(key, UNKNOWN)).first->second;
+	}
+
+public:
+	void useProgram(GLuint program) {
+		if(update(mProgram, program)) {
+			glUseProgram(program);
+		}
+	}
+
+	void bindVertexArray(GLuint vao) {
+		if(update(mVertexArray, vao)) {
+			glBindVertexArray(vao);
+		}
+	}
+
+	void bindBuffer(GLenum target, GLuint buffer) {
+		if(target == GL_ELEMENT_ARRAY_BUFFER && mVertexArray == UNKNOWN) {
+			// We don't know which vertex array the binding would go to
+			mStats.issued++;
+			glBindBuffer(target, buffer);
+			return;
+		}
+
+		GLuint& binding = target == GL_ELEMENT_ARRAY_BUFFER ?
+				knownBinding(mElementBuffers, mVertexArray) : knownBinding(mBuffers, target);
+		if(update(binding, buffer)) {
+			glBindBuffer(target, buffer);
+		}
+	}
+
+	void activeTexture(GLuint unit) {
+		if(update(mActiveTextureUnit, unit)) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+		}
+	}
+
+	/*
+	 * Bind texture to target of texture unit unit. This also makes unit the active unit if
+	 * the binding changes.
+	 */
+	void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+		const uint64_t key = (uint64_t(unit) << 32) | target;
+		GLuint& binding = mTextures.insert(std::make_pair(key, UNKNOWN)).first->second;
+		if(binding == texture) {
+			mStats.elided++;
+			return;
+		}
+
+		activeTexture(unit);
+		binding = texture;
+		mStats.issued++;
+		glBindTexture(target, texture);
+	}
+
+	void setEnabled(GLenum cap, bool enabled) {
+		auto c = mCaps.find(cap);
+		if(c != mCaps.end() && c->second == enabled) {
+			mStats.elided++;
+			return;
+		}
+
+		mCaps[cap] = enabled;
+		mStats.issued++;
+		if(enabled) {
+			glEnable(cap);
+		} else {
+			glDisable(cap);
+		}
+	}
+
+	void enable(GLenum cap) {
+		setEnabled(cap, true);
+	}
+
+	void disable(GLenum cap) {
+		setEnabled(cap, false);
+	}
+
+	/*
+	 * Whether cap is enabled, only asking GL if the cache doesn't know
+	 */
+	bool isEnabled(GLenum cap) {
+		auto c = mCaps.find(cap);
+		if(c == mCaps.end()) {
+			c = mCaps.insert(std::make_pair(cap, glIsEnabled(cap) == GL_TRUE)).first;
+		}
+		return c->second;
+	}
+
+	/*
+	 * Forget everything, so every binding is made again the next time it is asked for
+	 */
+	void invalidate() {
+		mProgram = UNKNOWN;
+		mVertexArray = UNKNOWN;
+		mActiveTextureUnit = UNKNOWN;
+		mBuffers.clear();
+		mElementBuffers.clear();
+		mTextures.clear();
+		mCaps.clear();
+	}
+
+	const Stats& stats() const {
+		return mStats;
+	}
+
+	void resetStats() {
+		mStats = Stats();
+	}
+};
+
+#endif /* RENDERER_GL_STATE_CACHE_H_ */
@@ -0,0 +1,329 @@
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+#ifndef RENDERER_LIGHT_CLUSTERS_H_
+#define RENDERER_LIGHT_CLUSTERS_H_
+
+// Padded to the std140 array stride of Light in stddefs.glsl, which is also its std430 stride
+struct Light {
+  glm::vec4 pos;
+  glm::vec4 color;
+  glm::float32 attenuation;
+  glm::float32 enabled;
+
+  // How far from pos the light is shaded. Set by Renderer from the color and attenuation.
+  glm::float32 radius;
+  glm::float32 dummy;
+};
+
+static_assert(sizeof(Light) == 48, "Light must match the std140 and std430 layouts of Light");
+
+/*
+ * Bins lights into clusters, the cells of a grid over the view frustum, so a fragment only
+ * has to shade the lights of the cluster it is in. The grid divides normalized device x and y
+ * evenly into tiles, and view depth logarithmically into slices between the near plane and
+ * the far plane, so clusters are roughly as deep as they are wide. std_ClusterIndex in
+ * stdutils.glsl finds a fragment's cluster the same way clusterIndex() does.
+ *
+ * A light is in every cluster its sphere of influence touches. The sphere is first bounded
+ * by the tiles and slices its bounding box projects to, then tested against the view space
+ * bounds of each cluster in that range.
+ *
+ * The projection must not make w depend on view x or y, which holds for perspective,
+ * orthographic and oblique near plane projections. A projection without a depth range, such
+ * as the identity before a camera has set one, puts every light in every cluster.
+ */
+class LightClusters {
+public:
+	static const uint32_t TILES_X = 16;
+	static const uint32_t TILES_Y = 9;
+	static const uint32_t SLICES = 24;
+	static const uint32_t NUM_CLUSTERS = TILES_X * TILES_Y * SLICES;
+
+	// Lights are shaded out to where their attenuated color falls below this
+	static constexpr float CUTOFF = 1.0f / 256.0f;
+
+	// Slices stop at this multiple of the near depth, for projections with an infinite far plane
+	static constexpr float MAX_DEPTH_RATIO = 1.0e4f;
+
+	// Slices start at least this deep, for orthographic projections with the near plane at 0
+	static constexpr float MIN_NEAR_DEPTH = 1.0e-3f;
+
+	// Laid out like the uvec2s of std_Clusters in stddefs.glsl
+	struct Cluster {
+		uint32_t firstLight;
+		uint32_t numLights;
+	};
+
+private:
+	glm::mat4 mProjection = glm::mat4(0.0f);
+
+	// Slices cover [mNear, mFar], though the first and last reach to the near and far planes
+	float mNear = 0.0f;
+	float mFar = 0.0f;
+	float mSlicesPerLogDepth = 0.0f;
+
+	// The view space bounds of each cluster, for the projection they were computed for
+	std::vector<glm::vec3> mBoundsMin;
+	std::vector<glm::vec3> mBoundsMax;
+	float mPlaneNear = 0.0f;
+	float mPlaneFar = 0.0f;
+	bool mDegenerate = true;
+
+	std::vector<Light> mViewLights;
+	std::vector<Cluster> mClusters;
+	std::vector<uint32_t> mLightIndices;
+
+	// Every cluster of every light, as they are found
+	std::vector<uint32_t> mHitClusters;
+	std::vector<uint32_t> mHitLights;
+
+	/*
+	 * The view depth which projection maps to normalized device depth ndcZ
+	 */
+	static float planeDepth(const glm::mat4& p, float ndcZ) {
+		return -(ndcZ * p[3][3] - p[3][2]) / (p[2][2] - ndcZ * p[2][3]);
+	}
+
+	/*
+	 * The view space point at normalized device x and y, and view depth
+	 */
+	static glm::vec3 unproject(const glm::mat4& p, float x, float y, float depth) {
+		const float z = -depth;
+		const float w = p[2][3] * z + p[3][3];
+		const float rx = x * w - p[2][0] * z - p[3][0];
+		const float ry = y * w - p[2][1] * z - p[3][1];
+		const float det = p[0][0] * p[1][1] - p[1][0] * p[0][1];
+		return glm::vec3((p[1][1] * rx - p[1][0] * ry) / det, (p[0][0] * ry - p[0][1] * rx) / det, z);
+	}
+
+	static uint32_t tile(float ndc, uint32_t numTiles) {
+		const float t = std::floor((ndc * 0.5f + 0.5f) * float(numTiles));
+		return uint32_t(std::fmin(std::fmax(t, 0.0f), float(numTiles - 1)));
+	}
+
+	uint32_t slice(float depth) const {
+		const float s = std::floor(std::log(std::fmax(depth, mNear) / mNear) * mSlicesPerLogDepth);
+		return uint32_t(std::fmin(s, float(SLICES - 1)));
+	}
+
+	// The depth a slice starts at
+	float sliceDepth(uint32_t z) const {
+		if(z == 0) {
+			return mPlaneNear;
+		}
+		if(z == SLICES) {
+			return mPlaneFar;
+		}
+		return mNear * std::exp(float(z) / mSlicesPerLogDepth);
+	}
+
+	void setProjection(const glm::mat4& projection) {
+		mProjection = projection;
+		mPlaneNear = planeDepth(projection, -1.0f);
+		mPlaneFar = planeDepth(projection, 1.0f);
+		mNear = std::fmax(mPlaneNear, MIN_NEAR_DEPTH);
+		mFar = std::fmin(mPlaneFar, mNear * MAX_DEPTH_RATIO);
+		mDegenerate = !(mFar > mNear);
+		if(mDegenerate) {
+			mSlicesPerLogDepth = 0.0f;
+			return;
+		}
+		if(mPlaneFar > mFar) {
+			// Fragments beyond where the slices stop all go in the last slice
+			mPlaneFar = std::numeric_limits<float>::infinity();
+		}
+		mSlicesPerLogDepth = float(SLICES) / std::log(mFar / mNear);
+
+		const float inf = std::numeric_limits<float>::infinity();
+		mBoundsMin.resize(NUM_CLUSTERS);
+		mBoundsMax.resize(NUM_CLUSTERS);
+		for(uint32_t z = 0; z < SLICES; z++) {
+			const float depths[2] = { sliceDepth(z), sliceDepth(z + 1) };
+			for(uint32_t y = 0; y < TILES_Y; y++) {
+				for(uint32_t x = 0; x < TILES_X; x++) {
+					glm::vec3 lo(inf), hi(-inf);
+					for(size_t corner = 0; corner < 8; corner++) {
+						const float ndcX = float(x + (corner & 1)) / float(TILES_X) * 2.0f - 1.0f;
+						const float ndcY = float(y + ((corner >> 1) & 1)) / float(TILES_Y) * 2.0f - 1.0f;
+						const float depth = depths[corner >> 2];
+						if(std::isinf(depth)) {
+							lo = glm::vec3(-inf, -inf, -inf);
+							hi = glm::vec3(inf, inf, hi.z);
+							continue;
+						}
+						const glm::vec3 p = unproject(projection, ndcX, ndcY, depth);
+						lo = glm::min(lo, p);
+						hi = glm::max(hi, p);
+					}
+					const uint32_t c = clusterIndex(x, y, z);
+					mBoundsMin[c] = lo;
+					mBoundsMax[c] = hi;
+				}
+			}
+		}
+	}
+
+	/*
+	 * Add every cluster the light's sphere touches to the hits
+	 */
+	void binLight(uint32_t light, const glm::vec3& center, float radius) {
+		if(std::isinf(radius) || mDegenerate) {
+			for(uint32_t c = 0; c < NUM_CLUSTERS; c++) {
+				mHitClusters.push_back(c);
+				mHitLights.push_back(light);
+			}
+			return;
+		}
+
+		const float depth = -center.z;
+		if(depth + radius < mPlaneNear || depth - radius > mPlaneFar) {
+			return;
+		}
+
+		uint32_t x0 = 0, x1 = TILES_X - 1, y0 = 0, y1 = TILES_Y - 1;
+		const uint32_t z0 = slice(depth - radius);
+		const uint32_t z1 = slice(depth + radius);
+
+		// The box around the sphere projects inside the hull of its projected corners, unless
+		// it reaches behind the eye
+		glm::vec2 lo(std::numeric_limits<float>::infinity()), hi(-std::numeric_limits<float>::infinity());
+		bool behind = false;
+		for(size_t corner = 0; corner < 8 && !behind; corner++) {
+			const glm::vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius,
+			                       (corner & 4) ? radius : -radius);
+			const glm::vec4 clip = mProjection * glm::vec4(center + offset, 1.0f);
+			if(clip.w <= 0.0f) {
+				behind = true;
+			}
+			lo = glm::min(lo, glm::vec2(clip) / clip.w);
+			hi = glm::max(hi, glm::vec2(clip) / clip.w);
+		}
+		if(!behind) {
+			if(hi.x < -1.0f || lo.x > 1.0f || hi.y < -1.0f || lo.y > 1.0f) {
+				return;
+			}
+			x0 = tile(lo.x, TILES_X);
+			x1 = tile(hi.x, TILES_X);
+			y0 = tile(lo.y, TILES_Y);
+			y1 = tile(hi.y, TILES_Y);
+		}
+
+		const float radius2 = radius * radius;
+		for(uint32_t z = z0; z <= z1; z++) {
+			for(uint32_t y = y0; y <= y1; y++) {
+				for(uint32_t x = x0; x <= x1; x++) {
+					const uint32_t c = clusterIndex(x, y, z);
+					const glm::vec3 d = glm::clamp(center, mBoundsMin[c], mBoundsMax[c]) - center;
+					if(glm::dot(d, d) <= radius2) {
+						mHitClusters.push_back(c);
+						mHitLights.push_back(light);
+					}
+				}
+			}
+		}
+	}
+
+public:
+	/*
+	 * How far from its position light is shaded, the distance at which its brightest color
+	 * channel attenuates to CUTOFF. 0 if it is never that bright, and infinite if it doesn't
+	 * attenuate.
+	 */
+	static float lightRadius(const Light& light) {
+		const float brightest = std::fmax(light.color.r, std::fmax(light.color.g, light.color.b));
+		if(brightest <= CUTOFF) {
+			return 0.0f;
+		}
+		if(light.attenuation <= 0.0f) {
+			return std::numeric_limits<float>::infinity();
+		}
+		// Solves brightest / (1 + attenuation * radius^2) = CUTOFF
+		return std::sqrt((brightest / CUTOFF - 1.0f) / light.attenuation);
+	}
+
+	static uint32_t clusterIndex(uint32_t x, uint32_t y, uint32_t z) {
+		return (z * TILES_Y + y) * TILES_X + x;
+	}
+
+	/*
+	 * The cluster a view space position is in, once the clusters have been built
+	 */
+	uint32_t clusterIndex(const glm::vec3& viewPosition) const {
+		const glm::vec4 clip = mProjection * glm::vec4(viewPosition, 1.0f);
+		return clusterIndex(tile(clip.x / clip.w, TILES_X), tile(clip.y / clip.w, TILES_Y), slice(-viewPosition.z));
+	}
+
+	/*
+	 * Bin the enabled lights for a camera with the given view and projection matrices. The
+	 * cluster bounds are only recomputed when the projection changes.
+	 */
+	void build(const std::vector<Light>& lights, const glm::mat4& view, const glm::mat4& projection) {
+		if(projection != mProjection) {
+			setProjection(projection);
+		}
+
+		mViewLights.resize(lights.size());
+		mHitClusters.clear();
+		mHitLights.clear();
+		for(uint32_t i = 0; i < lights.size(); i++) {
+			Light& light = mViewLights[i];
+			light = lights[i];
+			light.pos = view * lights[i].pos;
+			light.radius = lightRadius(lights[i]);
+			if(light.enabled != 0.0f && light.radius > 0.0f) {
+				binLight(i, glm::vec3(light.pos), light.radius);
+			}
+		}
+
+		// Counting sort the hits by cluster, keeping each cluster's lights in order
+		mClusters.assign(NUM_CLUSTERS, Cluster{ 0, 0 });
+		for(size_t h = 0; h < mHitClusters.size(); h++) {
+			mClusters[mHitClusters[h]].numLights++;
+		}
+		uint32_t first = 0;
+		for(uint32_t c = 0; c < NUM_CLUSTERS; c++) {
+			mClusters[c].firstLight = first;
+			first += mClusters[c].numLights;
+			mClusters[c].numLights = 0;
+		}
+		mLightIndices.resize(mHitClusters.size());
+		for(size_t h = 0; h < mHitClusters.size(); h++) {
+			Cluster& cluster = mClusters[mHitClusters[h]];
+			mLightIndices[cluster.firstLight + cluster.numLights++] = mHitLights[h];
+		}
+	}
+
+	/*
+	 * Every light passed to build, in the same order, with its position in view space and its
+	 * radius set
+	 */
+	const std::vector<Light>& viewLights() const {
+		return mViewLights;
+	}
+
+	const std::vector<Cluster>& clusters() const {
+		return mClusters;
+	}
+
+	/*
+	 * The indices into viewLights() of the lights of every cluster, grouped by cluster
+	 */
+	const std::vector<uint32_t>& lightIndices() const {
+		return mLightIndices;
+	}
+
+	float nearDepth() const {
+		return mNear;
+	}
+
+	float slicesPerLogDepth() const {
+		return mSlicesPerLogDepth;
+	}
+};
+
+#endif /* RENDERER_LIGHT_CLUSTERS_H_ */
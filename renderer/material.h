@@ -6,11 +6,31 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "utils/gl_program_reflection.h"
+
 #ifndef RENDERER_MATERIAL_H_
 #define RENDERER_MATERIAL_H_
 
 class Renderer;
 
+/*
+ * The handles of the mat uniform of a program, resolved once per program
+ */
+struct MaterialUniforms {
+	utils::GLUniform<glm::vec4> diffuse;
+	utils::GLUniform<glm::vec4> specular;
+	utils::GLUniform<float> roughness;
+	utils::GLUniform<float> reflectance;
+
+	MaterialUniforms() = default;
+
+	explicit MaterialUniforms(const utils::GLProgramReflection& program) :
+		diffuse(program.uniform<glm::vec4>("mat.diffuse")),
+		specular(program.uniform<glm::vec4>("mat.specular")),
+		roughness(program.uniform<float>("mat.roughness")),
+		reflectance(program.uniform<float>("mat.reflectance")) {}
+};
+
 class Material {
 	friend class Renderer;
 
@@ -26,16 +46,11 @@ class Material {
 	Material(const glm::vec3& d, const glm::vec3& s, float m, float r) :
 		m_diffuse(d), m_specular(s), m_roughness(m), m_reflectance(r) {}
 
-	void setupUniforms() {
-		static GLuint MAT_LOC_DIFF = glGetUniformLocation(*m_program, "mat.diffuse");
-		static GLuint MAT_LOC_SPEC = glGetUniformLocation(*m_program, "mat.specular");
-		static GLuint MAT_LOC_SHINE = glGetUniformLocation(*m_program, "mat.roughness");
-		static GLuint MAT_LOC_REFL = glGetUniformLocation(*m_program, "mat.reflectance");
-
-		glUniform4fv(MAT_LOC_DIFF, 1, glm::value_ptr(m_diffuse));
-		glUniform4fv(MAT_LOC_SPEC, 1, glm::value_ptr(m_specular));
-		glUniform1f(MAT_LOC_SHINE, shininess());
-		glUniform1f(MAT_LOC_REFL, m_reflectance);
+	void setupUniforms(const MaterialUniforms& uniforms) const {
+		uniforms.diffuse.set(glm::vec4(m_diffuse, 1.0));
+		uniforms.specular.set(glm::vec4(m_specular, 1.0));
+		uniforms.roughness.set(shininess());
+		uniforms.reflectance.set(m_reflectance);
 	}
 
 public:
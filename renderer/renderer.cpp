@@ -13,112 +13,420 @@ using namespace glm;
 using namespace std;
 using namespace utils;
 
-Renderer::Renderer() {
+Renderer::Renderer() : lights(MAX_UNIFORM_LIGHTS), stream(STREAM_SEGMENT_SIZE), programCache(programBuilder) {
+  static_assert(sizeof(PerFrameData) == 2 * sizeof(glm::mat4) + 3 * sizeof(glm::vec4) + MAX_UNIFORM_LIGHTS * sizeof(Light),
+                "PerFrameData must match the std140 layout of PerFrameBlock");
+  static_assert(sizeof(LightClusters::Cluster) == sizeof(glm::uvec2), "Clusters must match the std430 layout of std_Clusters");
+
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformOffsetAlignment);
+
+  indirectDraws = supportsIndirectDraws();
+  clusteredLighting = supportsClusteredLighting();
+  if(indirectDraws || clusteredLighting) {
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageOffsetAlignment);
+  }
+
+  primitives = GeometryPool::make<geometry::Vertex4P3N2T>(PRIMITIVE_POOL_VERTICES, PRIMITIVE_POOL_INDICES);
+
   programBuilder.addIncludeDir("shaders/glsl330");
-  materialProgram = programBuilder.buildFromFiles(
-		  "shaders/phong_vertex.glsl",
-		  "shaders/physical_frag.glsl");
+  materialLights = materialLightCount();
+  materialProgram = programCache.program(
+		  MATERIAL_VERT_PATH,
+		  MATERIAL_FRAG_PATH,
+		  materialDefines(materialLights));
 
-  drawLightsProgram = programBuilder.buildFromFiles(
+  drawLightsProgram = programCache.program(
 		  "shaders/draw_lights_vert.glsl",
-		  "shaders/draw_lights_frag.glsl");
+		  "shaders/draw_lights_frag.glsl",
+		  programDefines());
 
-  drawNormalsProgram = programBuilder.buildFromFiles(
+  drawNormalsProgram = programCache.program(
 		  "shaders/draw_normals_vert.glsl",
 		  "shaders/draw_normals_frag.glsl");
+
+  const GLProgramReflection normalsReflection(drawNormalsProgram);
+  normalColor1 = normalsReflection.uniform<glm::vec4>("color1");
+  normalColor2 = normalsReflection.uniform<glm::vec4>("color2");
+  normalLength = normalsReflection.uniform<GLfloat>("normal_length");
 }
 
 Renderer::~Renderer() {
-	glDeleteProgram(materialProgram);
-	glDeleteProgram(drawLightsProgram);
-	glDeleteProgram(drawNormalsProgram);
+  // The programs are deleted with the cache
+}
+
+long Renderer::materialLightCount() const {
+  // Only the lights programs can shade count
+  bool anyEnabled = false;
+  for(auto l = lights.begin(); l != lights.begin() + numShadedLights() && !anyEnabled; l++) {
+    anyEnabled = l->enabled != 0.0f;
+  }
+
+  if(!anyEnabled) {
+    return 0;
+  }
+  return clusteredLighting ? CLUSTERED_LIGHT_COUNT : long(numShadedLights());
+}
+
+ShaderDefines Renderer::materialDefines(long lightCount) const {
+  ShaderDefines defines(programDefines());
+  if(lightCount != CLUSTERED_LIGHT_COUNT) {
+    defines.define(NUM_LIGHTS_DEFINE, lightCount);
+  }
+  return defines;
+}
+
+void Renderer::packPerFrameData() {
+  if(!perFrameDirty) {
+    return;
+  }
+
+  for(size_t i = 0; i < std::min(lights.size(), size_t(MAX_UNIFORM_LIGHTS)); i++) {
+    perFrameData.lights[i] = lights[i];
+    perFrameData.lights[i].radius = LightClusters::lightRadius(lights[i]);
+  }
+  perFrameData.light_grid = uvec4(LightClusters::TILES_X, LightClusters::TILES_Y, LightClusters::SLICES, lights.size());
+
+  if(clusteredLighting) {
+    lightClusters.build(lights, viewMatrix(), projectionMatrix());
+    perFrameData.light_grid_depth = vec4(lightClusters.nearDepth(), lightClusters.slicesPerLogDepth(), 0.0, 0.0);
+  }
+
+  // Most changes, like moving the camera, leave the variant as it is. Only the first time the
+  // lights need a variant does it get compiled.
+  const long lightCount = materialLightCount();
+  if(lightCount != materialLights) {
+    materialProgram = programCache.program(MATERIAL_VERT_PATH, MATERIAL_FRAG_PATH, materialDefines(lightCount));
+    materialLights = lightCount;
+  }
+
+  perFrameDirty = false;
+  perFramePacked = true;
+}
+
+size_t Renderer::perFrameBytes() const {
+  size_t bytes = sizeof(PerFrameData) + GLStreamBuffer::SEGMENT_ALIGNMENT;
+  if(clusteredLighting) {
+    // Empty buffers are padded to a uvec4, see uploadStorage
+    bytes += std::max(lightClusters.viewLights().size() * sizeof(Light), sizeof(uvec4)) +
+             std::max(lightClusters.clusters().size() * sizeof(LightClusters::Cluster), sizeof(uvec4)) +
+             std::max(lightClusters.lightIndices().size() * sizeof(uint32_t), sizeof(uvec4)) +
+             3 * GLStreamBuffer::SEGMENT_ALIGNMENT;
+  }
+  return bytes;
+}
+
+void Renderer::uploadPerFrameData() {
+  packPerFrameData();
+  if(perFramePacked || perFrameSegment != stream.segment()) {
+    // The lights are read along with the per-frame data, so they go in the same segment
+    stream.reserve(perFrameBytes());
+    const GLStreamBuffer::Range range = stream.write(&perFrameData, sizeof(PerFrameData), uniformOffsetAlignment);
+    glBindBufferRange(GL_UNIFORM_BUFFER, PER_FRAME_BLOCK_BINDING_POINT, range.buffer, range.offset, sizeof(PerFrameData));
+
+    if(clusteredLighting) {
+      const std::vector<Light>& viewLights = lightClusters.viewLights();
+      const std::vector<LightClusters::Cluster>& clusters = lightClusters.clusters();
+      const std::vector<uint32_t>& indices = lightClusters.lightIndices();
+      uploadStorage(VIEW_LIGHT_BUFFER_BINDING_POINT, viewLights.data(), viewLights.size() * sizeof(Light));
+      uploadStorage(CLUSTER_BUFFER_BINDING_POINT, clusters.data(), clusters.size() * sizeof(LightClusters::Cluster));
+      uploadStorage(CLUSTER_LIGHT_BUFFER_BINDING_POINT, indices.data(), indices.size() * sizeof(uint32_t));
+    }
+
+    perFramePacked = false;
+    perFrameSegment = stream.segment();
+  }
 }
 
 void Renderer::startFrame() {
+  lastFrameStats = glState.stats();
+  glState.resetStats();
+  glState.invalidate();
+
+  // Upload and bind it again in case anything else has used the binding points
+  packPerFrameData();
+  perFramePacked = true;
+  uploadPerFrameData();
+}
+
+void Renderer::setDrawTransform(const glm::mat4& transform) {
+  perDrawData.modelview_matrix = viewMatrix() * transform;
+
+  // The inverse is most of the cost, and programs like the light and normal views don't need it
+  if(currentUniforms == nullptr || currentUniforms->indirect || currentUniforms->normal.isActive()) {
+    perDrawData.normal_matrix = transpose(inverse(mat4(mat3(perDrawData.modelview_matrix))));
+  }
+}
+
+void Renderer::uploadStorage(GLuint binding, const void* data, size_t size) {
+  // Binding an empty range is an error, though nothing will read it
+  static const uvec4 EMPTY(0);
+  if(size == 0) {
+    data = &EMPTY;
+    size = sizeof(EMPTY);
+  }
+  const GLStreamBuffer::Range range = stream.write(data, size, storageOffsetAlignment);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, range.buffer, range.offset, size);
+}
+
+void Renderer::uploadPerDrawData(const PerDrawData* data, size_t count) {
+  uploadStorage(PER_DRAW_BUFFER_BINDING_POINT, data, count * sizeof(PerDrawData));
 }
 
 void Renderer::setupUniforms() {
-  glUniformMatrix4fv(
-      glGetUniformLocation(currentProgram, MV_MAT_UNIFORM_NAME),
-      1, GL_FALSE, value_ptr(perFrameData.modelview_matrix));
-  glUniformMatrix4fv(
-      glGetUniformLocation(currentProgram, NORMAL_MAT_UNIFORM_NAME),
-      1, GL_FALSE, value_ptr(perFrameData.normal_matrix));
-  glUniformMatrix4fv(
-      glGetUniformLocation(currentProgram, VIEW_MAT_UNIFORM_NAME),
-      1, GL_FALSE, value_ptr(perFrameData.view_matrix));
-  glUniformMatrix4fv(
-      glGetUniformLocation(currentProgram, PROJ_MAT_UNIFORM_NAME),
-      1, GL_FALSE, value_ptr(perFrameData.proj_matrix));
-  glUniform4fv(
-      glGetUniformLocation(currentProgram, GLOB_AMB_UNIFORM_NAME),
-      1, value_ptr(perFrameData.global_ambient));
-
-  for(size_t i = 0; i < NUM_LIGHTS; i++) {
-    const string baseUniformName = string("std_Lights[") + std::to_string(i) + string("]");
-    const string posName = baseUniformName + string(".position");
-    const string colorName = baseUniformName + string(".color");
-    const string attName = baseUniformName + string(".attenuation");
-    const string enbName = baseUniformName + string(".enabled");
-
-    glUniform4fv(
-        glGetUniformLocation(currentProgram, posName.c_str()),
-        1, value_ptr(perFrameData.lights[i].pos));
-    glUniform4fv(
-        glGetUniformLocation(currentProgram, colorName.c_str()),
-        1, value_ptr(perFrameData.lights[i].color));
-    glUniform1fv(
-        glGetUniformLocation(currentProgram, attName.c_str()),
-        1, &perFrameData.lights[i].attenuation);
-    glUniform1fv(
-        glGetUniformLocation(currentProgram, enbName.c_str()),
-        1, &perFrameData.lights[i].enabled);
+  const bool indirect = currentUniforms != nullptr && currentUniforms->indirect;
+  if(indirect) {
+    // A single draw has draw id 0
+    packPerFrameData();
+    stream.reserve(sizeof(PerDrawData) + perFrameBytes() + GLStreamBuffer::SEGMENT_ALIGNMENT);
+    uploadPerDrawData(&perDrawData, 1);
   }
+
+  // The view, projection or lights may have changed since the frame started
+  uploadPerFrameData();
+
+  if(currentUniforms == nullptr || indirect) {
+    return;
+  }
+  currentUniforms->modelview.set(perDrawData.modelview_matrix);
+  currentUniforms->normal.set(perDrawData.normal_matrix);
+}
+
+void Renderer::addIndirectDraws(const Geometry& geometry, const IndexRanges* ranges, size_t numInstances,
+                                const glm::mat4& transform) {
+  setDrawTransform(transform);
+
+  if(ranges == nullptr) {
+    const GLuint instances = numInstances > 0 ? numInstances : 1;
+    indirectCommands.push_back({ GLuint(geometry.num_indices), instances, GLuint(geometry.first_index),
+                                 geometry.base_vertex, 0 });
+    indirectDrawData.push_back(perDrawData);
+    return;
+  }
+
+  // Every range is a draw of its own, so each needs its own copy of the transforms
+  for(size_t r = 0; r < ranges->size(); r++) {
+    const size_t firstIndex = reinterpret_cast<size_t>(ranges->offsets[r]) / geometry.indexSize();
+    indirectCommands.push_back({ GLuint(ranges->counts[r]), 1, GLuint(geometry.first_index + firstIndex),
+                                 geometry.base_vertex + ranges->baseVertices[r], 0 });
+    indirectDrawData.push_back(perDrawData);
+  }
+}
+
+void Renderer::drawIndirect(const Geometry& geometry, const PrimitiveType& pType) {
+  if(!indirectCommands.empty()) {
+    // Everything the draw reads has to be in the same segment of the ring
+    const size_t commandBytes = indirectCommands.size() * sizeof(DrawElementsIndirectCommand);
+    const size_t perDrawBytes = indirectDrawData.size() * sizeof(PerDrawData);
+    packPerFrameData();
+    stream.reserve(commandBytes + perDrawBytes + perFrameBytes() + 2 * GLStreamBuffer::SEGMENT_ALIGNMENT);
+
+    const GLStreamBuffer::Range commands =
+        stream.write(indirectCommands.data(), commandBytes);
+    uploadPerDrawData(indirectDrawData.data(), indirectDrawData.size());
+    uploadPerFrameData();
+
+    // Not through the cache, since the ring may have replaced its buffer with one of the same name
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+    glState.bindVertexArray(geometry.vao);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.ibo);
+    glMultiDrawElementsIndirect(pType, geometry.index_type, reinterpret_cast<const GLvoid*>(commands.offset),
+                                indirectCommands.size(), 0);
+  }
+
+  indirectCommands.clear();
+  indirectDrawData.clear();
 }
 
 void Renderer::draw(const Geometry& geometry, const glm::mat4& transform, const PrimitiveType& pType) {
-  perFrameData.modelview_matrix = viewMatrix() * transform;
-  perFrameData.normal_matrix = transpose(inverse(mat4(mat3(perFrameData.modelview_matrix))));
+  setDrawTransform(transform);
+
+  setupUniforms();
+
+  glState.bindVertexArray(geometry.vao);
+  glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.ibo);
+  glDrawElementsBaseVertex(pType, geometry.num_indices, geometry.index_type,
+                           reinterpret_cast<const GLvoid*>(geometry.first_index * geometry.indexSize()), geometry.base_vertex);
+}
+
+void Renderer::draw(const Geometry& geometry, const IndexRanges& ranges, const glm::mat4& transform, const PrimitiveType& pType) {
+  if(ranges.size() == 0) {
+    return;
+  }
+
+  // Each range has its own draw id, which must find the transforms
+  if(currentUniforms != nullptr && currentUniforms->indirect) {
+    addIndirectDraws(geometry, &ranges, 0, transform);
+    drawIndirect(geometry, pType);
+    return;
+  }
+
+  setDrawTransform(transform);
 
   setupUniforms();
 
-  glBindVertexArray(geometry.vao);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.ibo);
-  glDrawElements(pType, geometry.num_indices, GL_UNSIGNED_INT, nullptr);
-  glBindVertexArray(0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  // Pooled geometry doesn't start at the beginning of the buffers, which the ranges are relative to
+  rangeOffsets.resize(ranges.size());
+  rangeBaseVertices.resize(ranges.size());
+  for(size_t r = 0; r < ranges.size(); r++) {
+    rangeOffsets[r] = reinterpret_cast<const GLvoid*>(
+        reinterpret_cast<size_t>(ranges.offsets[r]) + geometry.first_index * geometry.indexSize());
+    rangeBaseVertices[r] = geometry.base_vertex + ranges.baseVertices[r];
+  }
+
+  glState.bindVertexArray(geometry.vao);
+  glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.ibo);
+  glMultiDrawElementsBaseVertex(pType, ranges.counts.data(), geometry.index_type, rangeOffsets.data(), ranges.size(),
+                                rangeBaseVertices.data());
+}
+
+void Renderer::drawInstanced(const Geometry& geometry, size_t numInstances, const glm::mat4& transform, const PrimitiveType& pType) {
+  setDrawTransform(transform);
+
+  setupUniforms();
+
+  glState.bindVertexArray(geometry.vao);
+  glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.ibo);
+  glDrawElementsInstancedBaseVertex(pType, geometry.num_indices, geometry.index_type,
+                                    reinterpret_cast<const GLvoid*>(geometry.first_index * geometry.indexSize()),
+                                    numInstances, geometry.base_vertex);
 }
 
 void Renderer::draw(GLuint vao, size_t num_vertices, const glm::mat4& transform, const PrimitiveType& pType) {
-  perFrameData.modelview_matrix = viewMatrix() * transform;
-  perFrameData.normal_matrix = transpose(inverse(mat4(mat3(perFrameData.modelview_matrix))));
+  setDrawTransform(transform);
 
   setupUniforms();
 
-  glBindVertexArray(vao);
+  glState.bindVertexArray(vao);
   glDrawArrays(pType, 0, num_vertices);
-  glBindVertexArray(0);
+}
+
+void Renderer::submit(DrawList& list) {
+  list.sort();
+
+  // Packing picks the material program variant for the lights, which may have changed since
+  // the draws were recorded
+  packPerFrameData();
+
+  const Material* material = nullptr;
+  const std::vector<uint32_t>& order = list.order();
+  for(size_t i = 0; i < order.size(); ) {
+    const DrawList::Packet& packet = list.packets()[order[i]];
+
+    // Packets with a material draw with the variant it points to now, not the one recorded.
+    // Every material points to the same variant, so the sorted order still groups them.
+    const GLuint program = packet.material != nullptr && packet.material->m_program != nullptr ?
+                           *packet.material->m_program : packet.program;
+
+    // A material's uniforms belong to the program, so they need setting again with a new one
+    if(program != currentProgram) {
+      setProgram(program);
+      material = nullptr;
+    }
+    if(packet.material != nullptr && packet.material != material) {
+      packet.material->setupUniforms(currentUniforms->material);
+      material = packet.material;
+    }
+
+    for(uint32_t t = packet.firstTexture; t < packet.firstTexture + packet.numTextures; t++) {
+      const DrawList::TextureBinding& binding = list.textures()[t];
+      glState.bindTexture(binding.unit, binding.target, binding.texture);
+    }
+
+    const PrimitiveType primitive = static_cast<PrimitiveType>(packet.primitive);
+    if(currentUniforms->indirect) {
+      // Batch the packets after this one which can go in the same multi-draw
+      size_t end = i;
+      for(; end < order.size(); end++) {
+        const DrawList::Packet& next = list.packets()[order[end]];
+        if(!list.sameState(packet, next) || next.primitive != packet.primitive ||
+           next.geometry->vao != packet.geometry->vao || next.geometry->ibo != packet.geometry->ibo ||
+           next.geometry->index_type != packet.geometry->index_type) {
+          break;
+        }
+        addIndirectDraws(*next.geometry, next.ranges, next.numInstances, next.transform);
+      }
+      drawIndirect(*packet.geometry, primitive);
+      i = end;
+      continue;
+    }
+
+    if(packet.ranges != nullptr) {
+      draw(*packet.geometry, *packet.ranges, packet.transform, primitive);
+    } else if(packet.numInstances > 0) {
+      drawInstanced(*packet.geometry, packet.numInstances, packet.transform, primitive);
+    } else {
+      draw(*packet.geometry, packet.transform, primitive);
+    }
+    i++;
+  }
+
+  list.clear();
 }
 
 void Renderer::drawLights(const Geometry& g, const glm::mat4& transform, const PrimitiveType& p) {
-	setProgram(drawLightsProgram);
-	for(size_t i = 0; i < numLights(); i++) {
-		glUniform1ui(1, i);
-		draw(g, glm::translate(glm::mat4(1.0), lightPosition(i)) * transform, p);
-	}
+  // Each instance reads the position and color of its light from the light data
+  setProgram(drawLightsProgram);
+  drawInstanced(g, numShadedLights(), transform, p);
 }
 
 void Renderer::drawNormals(const Geometry& g, const glm::mat4& transform, const glm::vec4& color1, const glm::vec4& color2) {
-	  static const GLuint COLOR1_LOC = 2;
-	  static const GLuint COLOR2_LOC = 3;
+  if(g.normal_view_vao == 0) {
+    return;
+  }
+
+  setProgram(drawNormalsProgram);
+  normalColor1.set(color1);
+  normalColor2.set(color2);
+  normalLength.set(g.normal_length);
+
+  setDrawTransform(transform);
 
-	  setProgram(drawNormalsProgram);
-	  glUniform4fv(COLOR1_LOC, 1, glm::value_ptr(color1));
-	  glUniform4fv(COLOR2_LOC, 1, glm::value_ptr(color2));
-	  draw(g.normal_view_vao, g.num_vertices * 2, transform, LINES);
+  setupUniforms();
+
+  // A line of two vertices for each of g's vertices
+  glState.bindVertexArray(g.normal_view_vao);
+  glDrawArraysInstanced(LINES, 0, 2, g.num_vertices);
 }
 
 void Renderer::setProgram(GLuint program) {
   currentProgram = program;
-  glUseProgram(program);
+  glState.useProgram(program);
+
+  auto uniforms = programUniforms.find(program);
+  if(uniforms == programUniforms.end()) {
+    // Programs may come from any GLProgramBuilder, so reflect them here
+    const GLProgramReflection reflection(program);
+
+    // Programs which don't include stddefs.glsl have no per-frame block
+    const GLuint blockIndex = reflection.blockIndex(PER_FRAME_BLOCK_NAME);
+    if(blockIndex != GL_INVALID_INDEX) {
+      glUniformBlockBinding(program, blockIndex, PER_FRAME_BLOCK_BINDING_POINT);
+    }
+
+    // Programs built with STD_INDIRECT_DRAW read their transforms from the per-draw buffer
+    const GLuint perDrawIndex = reflection.storageBlockIndex(PER_DRAW_BUFFER_NAME);
+    if(perDrawIndex != GL_INVALID_INDEX) {
+      glShaderStorageBlockBinding(program, perDrawIndex, PER_DRAW_BUFFER_BINDING_POINT);
+    }
+
+    // And programs built with STD_CLUSTERED_LIGHTING read the lights from the light buffers
+    const struct { const char* name; GLuint binding; } lightBuffers[] = {
+      { VIEW_LIGHT_BUFFER_NAME, VIEW_LIGHT_BUFFER_BINDING_POINT },
+      { CLUSTER_BUFFER_NAME, CLUSTER_BUFFER_BINDING_POINT },
+      { CLUSTER_LIGHT_BUFFER_NAME, CLUSTER_LIGHT_BUFFER_BINDING_POINT } };
+    for(size_t b = 0; b < 3; b++) {
+      const GLuint index = reflection.storageBlockIndex(lightBuffers[b].name);
+      if(index != GL_INVALID_INDEX) {
+        glShaderStorageBlockBinding(program, index, lightBuffers[b].binding);
+      }
+    }
+
+    const ProgramUniforms handles = {
+      reflection.uniform<glm::mat4>(MV_MAT_UNIFORM_NAME),
+      reflection.uniform<glm::mat4>(NORMAL_MAT_UNIFORM_NAME),
+      MaterialUniforms(reflection),
+      indirectDraws && perDrawIndex != GL_INVALID_INDEX };
+    uniforms = programUniforms.insert(std::make_pair(program, handles)).first;
+  }
+  currentUniforms = &uniforms->second;
 }
@@ -1,61 +1,215 @@
 #include <GL/glew.h>
 
 #include <memory>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 
 #include "geometry/3d_primitives.h"
 #include "utils/gl_program_builder.h"
+#include "utils/gl_program_cache.h"
+#include "utils/gl_stream_buffer.h"
+#include "gl_state_cache.h"
+#include "draw_list.h"
+#include "light_clusters.h"
 #include "material.h"
 
 #ifndef RENDERER_RENDERER_H_
 #define RENDERER_RENDERER_H_
 
-struct Light {
-  glm::vec4 pos;
-  glm::vec4 color;
-  glm::float32 attenuation;
-  glm::float32 enabled;
-  glm::float32 dummy1;
-  glm::float32 dummy2;
-  glm::float32 dummy3;
-};
-
 enum PrimitiveType { TRIANGLES = GL_TRIANGLES, LINES = GL_LINES, POINTS = GL_POINTS };
 enum FaceCullMode { BACK = GL_BACK, FRONT = GL_FRONT, FRONT_AND_BACK = GL_FRONT_AND_BACK };
 enum WindingMode { CW, CCW };
 
 class Renderer {
-	static const GLuint NUM_LIGHTS = 10;
+	// Programs built without clustered lighting only shade this many lights, through std_Lights
+	static const GLuint MAX_UNIFORM_LIGHTS = 10;
 
+	// Uploaded to a uniform buffer, laid out like PerFrameBlock in stddefs.glsl with the std140
+	// rules. Everything in it is 16 byte aligned, so no padding is needed between members.
 	struct PerFrameData {
-		glm::mat4 modelview_matrix;
-		glm::mat4 normal_matrix;
 		glm::mat4 view_matrix;
 		glm::mat4 proj_matrix;
 		glm::vec4 global_ambient;
-		Light lights[NUM_LIGHTS];
+		glm::uvec4 light_grid;
+		glm::vec4 light_grid_depth;
+		Light lights[MAX_UNIFORM_LIGHTS];
+	};
+
+	// Set as uniforms, or for programs drawn indirectly, written to the per-draw storage buffer
+	// laid out like PerDraw in stddefs.glsl with the std430 rules
+	struct PerDrawData {
+		glm::mat4 modelview_matrix;
+		glm::mat4 normal_matrix;
+	};
+
+	// Laid out as glMultiDrawElementsIndirect reads its commands
+	struct DrawElementsIndirectCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
 	};
 
+	// Must match PER_FRAME_BLOCK_BINDING_POINT in stddefs.glsl
+	static const GLuint PER_FRAME_BLOCK_BINDING_POINT = 1;
+
+	// Must match PER_DRAW_BUFFER_BINDING_POINT in stddefs.glsl
+	static const GLuint PER_DRAW_BUFFER_BINDING_POINT = 3;
+
+	// Must match the light buffer binding points in stddefs.glsl
+	static const GLuint VIEW_LIGHT_BUFFER_BINDING_POINT = 4;
+	static const GLuint CLUSTER_BUFFER_BINDING_POINT = 5;
+	static const GLuint CLUSTER_LIGHT_BUFFER_BINDING_POINT = 6;
+
+	// The size of each segment of the ring all per-frame data is streamed through
+	static const size_t STREAM_SEGMENT_SIZE = 1 << 20;
+
+	// Room in the primitive pool, enough for a few hundred spheres
+	static const size_t PRIMITIVE_POOL_VERTICES = 1 << 18;
+	static const size_t PRIMITIVE_POOL_INDICES = 1 << 20;
+
 	constexpr static const char* MV_MAT_UNIFORM_NAME = "std_Modelview";
 	constexpr static const char* NORMAL_MAT_UNIFORM_NAME = "std_Normal";
-	constexpr static const char* VIEW_MAT_UNIFORM_NAME = "std_View";
-	constexpr static const char* PROJ_MAT_UNIFORM_NAME = "std_Projection";
-	constexpr static const char* GLOB_AMB_UNIFORM_NAME = "std_GlobalAmbient";
-	constexpr static const char* LIGHTS_UNIFORM_NAME = "std_Lights";
+	constexpr static const char* PER_FRAME_BLOCK_NAME = "PerFrameBlock";
+	constexpr static const char* PER_DRAW_BUFFER_NAME = "PerDrawBuffer";
+	constexpr static const char* VIEW_LIGHT_BUFFER_NAME = "ViewLightBuffer";
+	constexpr static const char* CLUSTER_BUFFER_NAME = "ClusterBuffer";
+	constexpr static const char* CLUSTER_LIGHT_BUFFER_NAME = "ClusterLightBuffer";
+	constexpr static const char* INDIRECT_DRAW_DEFINE = "STD_INDIRECT_DRAW";
+	constexpr static const char* CLUSTERED_LIGHTING_DEFINE = "STD_CLUSTERED_LIGHTING";
+	constexpr static const char* NUM_LIGHTS_DEFINE = "STD_NUM_LIGHTS";
+	constexpr static const char* MATERIAL_VERT_PATH = "shaders/phong_vertex.glsl";
+	constexpr static const char* MATERIAL_FRAG_PATH = "shaders/physical_frag.glsl";
+
+	// The uniforms Renderer sets in a program, resolved the first time the program is set
+	struct ProgramUniforms {
+		utils::GLUniform<glm::mat4> modelview;
+		utils::GLUniform<glm::mat4> normal;
+		MaterialUniforms material;
+
+		// Built with STD_INDIRECT_DRAW, so the transforms are read from the per-draw buffer
+		bool indirect;
+	};
 
 	PerFrameData perFrameData;
+	PerDrawData perDrawData;
+
+	// Every light, in the order they are numbered by the setters. The first MAX_UNIFORM_LIGHTS
+	// are also copied to std_Lights.
+	std::vector<Light> lights;
+
+	// Programs are built to shade only the lights of each fragment's cluster if the GL can, see
+	// supportsClusteredLighting(). The clusters are rebuilt whenever the per-frame data changes.
+	bool clusteredLighting = false;
+	LightClusters lightClusters;
+
+	// Per-frame data, per-draw data and draw commands are all written to this ring
+	utils::GLStreamBuffer stream;
+	GLint uniformOffsetAlignment = 0;
+	GLint storageOffsetAlignment = 0;
+
+	// The per-frame data is only packed when it has changed since the last draw, and only
+	// re-uploaded when it has been packed since, or the ring has moved on from the segment it
+	// is in
+	bool perFrameDirty = true;
+	bool perFramePacked = false;
+	size_t perFrameSegment = 0;
+
+	// Programs are built to be drawn indirectly if the GL can, see supportsIndirectDraws()
+	bool indirectDraws = false;
+
+	// The commands of the multi-draw being built and the per-draw data they index, streamed
+	// when it is drawn
+	std::vector<DrawElementsIndirectCommand> indirectCommands;
+	std::vector<PerDrawData> indirectDrawData;
+
+	// Scratch space for offsetting index ranges to where geometry starts in its buffers
+	std::vector<const GLvoid*> rangeOffsets;
+	std::vector<GLint> rangeBaseVertices;
+
+	std::unique_ptr<GeometryPool> primitives;
 
 	GLuint currentProgram = 0;
 
+	// Skips binds which wouldn't change anything. Its counts are kept for each frame.
+	GLStateCache glState;
+	GLStateCache::Stats lastFrameStats;
+	std::unordered_map<GLuint, ProgramUniforms> programUniforms;
+	const ProgramUniforms* currentUniforms = nullptr;
+
+	/*
+	 * Copy the lights into the per-frame data and bin them into clusters, and pick the
+	 * material program variant for them, if anything has changed since they were last packed
+	 */
+	void packPerFrameData();
+
+	/*
+	 * The most uploadPerFrameData can write to the ring once packed, with padding
+	 */
+	size_t perFrameBytes() const;
+
+	void uploadPerFrameData();
+
+	void setDrawTransform(const glm::mat4& transform);
+
+	/*
+	 * Write size bytes of data to the ring and bind them to a shader storage binding point
+	 */
+	void uploadStorage(GLuint binding, const void* data, size_t size);
+
+	void uploadPerDrawData(const PerDrawData* data, size_t count);
+
+	/*
+	 * Add the draws of geometry to the multi-draw being built, all with transform. Without
+	 * ranges the whole geometry is drawn, numInstances times if that isn't 0.
+	 */
+	void addIndirectDraws(const Geometry& geometry, const IndexRanges* ranges, size_t numInstances,
+	                      const glm::mat4& transform);
+
+	/*
+	 * Draw the multi-draw built so far from geometry's buffers with one
+	 * glMultiDrawElementsIndirect call, and start a new one
+	 */
+	void drawIndirect(const Geometry& geometry, const PrimitiveType& p);
+
 	utils::GLProgramBuilder programBuilder;
 
+	// Every variant of the programs built so far
+	utils::GLProgramCache programCache;
+
 	void setupUniforms();
 
+	// The light count of the material variant which loops over the lights of each cluster
+	// instead of a fixed number of lights
+	static const long CLUSTERED_LIGHT_COUNT = -1;
+
+	/*
+	 * The number of lights the material program is specialized for with the lights as they
+	 * are: 0 if none are enabled, otherwise the number shaded, or CLUSTERED_LIGHT_COUNT
+	 */
+	long materialLightCount() const;
+
+	/*
+	 * The defines of the material program variant specialized for lightCount lights
+	 */
+	utils::ShaderDefines materialDefines(long lightCount) const;
+
+	// The variant for the lights as they were last packed, and the light count it was made
+	// for. Materials point here, so they follow it when it changes.
 	GLuint materialProgram;
+	long materialLights;
 	GLuint drawLightsProgram;
 	GLuint drawNormalsProgram;
 
+	utils::GLUniform<glm::vec4> normalColor1;
+	utils::GLUniform<glm::vec4> normalColor2;
+	utils::GLUniform<GLfloat> normalLength;
+
 public:
 
 	Renderer();
@@ -69,21 +223,107 @@ public:
 		return r;
 	}
 
+	/*
+	 * Upload the per-frame data and bind it for every program. Called by the windows before
+	 * each frame is drawn. GL state may have been changed outside the state cache between
+	 * frames, so the cache is invalidated here.
+	 */
 	void startFrame();
 
+	/*
+	 * Whether the GL can draw programs built with programDefines() with
+	 * glMultiDrawElementsIndirect. That needs OpenGL 4.3 and ARB_shader_draw_parameters.
+	 */
+	static bool supportsIndirectDraws() {
+		return GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters;
+	}
+
+	/*
+	 * Whether the GL can read the light clusters from storage buffers, which needs OpenGL 4.3
+	 */
+	static bool supportsClusteredLighting() {
+		return GLEW_VERSION_4_3;
+	}
+
+	/*
+	 * The defines to build programs with, so they are drawn the way this renderer draws. When
+	 * the GL supports indirect draws, draws in a submitted list which share a program, material,
+	 * textures and vertex array are batched into one multi-draw. When it supports clustered
+	 * lighting, fragments only shade the lights which reach their cluster, and any number of
+	 * lights can be shaded.
+	 */
+	std::vector<std::string> programDefines() const {
+		std::vector<std::string> defines;
+		if(indirectDraws) {
+			defines.push_back(INDIRECT_DRAW_DEFINE);
+		}
+		if(clusteredLighting) {
+			defines.push_back(CLUSTERED_LIGHTING_DEFINE);
+		}
+		return defines;
+	}
+
+	/*
+	 * Shared buffers for primitives with vertexPosNormTex vertices. Primitives made from it can
+	 * be batched with each other into one multi-draw.
+	 */
+	GeometryPool& primitivePool() {
+		return *primitives;
+	}
+
+	/*
+	 * The state cache Renderer binds through. Code drawing in the middle of a frame should
+	 * bind through it too, so the cache stays in step with GL.
+	 */
+	GLStateCache& state() {
+		return glState;
+	}
+
+	/*
+	 * The GL calls the state cache made and skipped while drawing the last frame
+	 */
+	const GLStateCache::Stats& lastFrameStateStats() const {
+		return lastFrameStats;
+	}
+
 	void draw(GLuint vao, size_t num_vertices, const glm::mat4& transform, const PrimitiveType& p = TRIANGLES);
 
 	void draw(const Geometry& geometry, const glm::mat4& transform, const PrimitiveType& p = TRIANGLES);
 
+	/*
+	 * Draw only the given ranges of geometry's index buffer, in one multi-draw call
+	 */
+	void draw(const Geometry& geometry, const IndexRanges& ranges, const glm::mat4& transform, const PrimitiveType& p = TRIANGLES);
+
+	void drawInstanced(const Geometry& geometry, size_t numInstances, const glm::mat4& transform, const PrimitiveType& p = TRIANGLES);
+
+	/*
+	 * Sort the draws recorded in list by state and draw them, only changing the program,
+	 * material and textures between draws which need different ones. Runs of draws of an
+	 * indirectly drawn program with the same state and vertex array are drawn with one
+	 * multi-draw. The list is cleared afterwards, ready for the next frame.
+	 */
+	void submit(DrawList& list);
+
+	/*
+	 * Draw g at every enabled light, translated to the light and colored by it, with one
+	 * instanced draw
+	 */
 	void drawLights(const Geometry& g, const glm::mat4& transform, const PrimitiveType& p = TRIANGLES);
 
+	/*
+	 * Draw a line along the normal of each of g's vertices, fading from color1 to color2, with
+	 * one instanced draw. Only geometry with a normal view, such as the primitives, is drawn.
+	 */
 	void drawNormals(const Geometry& g, const glm::mat4& transform, const glm::vec4& color1, const glm::vec4& color2);
 
 	void setProgram(GLuint program);
 
 	void setMaterial(std::shared_ptr<Material> mat) {
+		// Packing picks the variant for the lights, which may have changed
+		packPerFrameData();
 		setProgram(*mat->m_program);
-		mat->setupUniforms();
+		mat->setupUniforms(currentUniforms->material);
 	}
 
 	void clearViewport() {
@@ -103,59 +343,93 @@ public:
 	}
 
 	inline size_t numLights() const {
-		return NUM_LIGHTS;
+		return lights.size();
+	}
+
+	/*
+	 * The number of lights programs can shade, which without clustered lighting is at most
+	 * MAX_UNIFORM_LIGHTS
+	 */
+	inline size_t numShadedLights() const {
+		return clusteredLighting ? lights.size() : std::min(lights.size(), size_t(MAX_UNIFORM_LIGHTS));
 	}
 
 	glm::vec3 lightPosition(size_t i) {
-		return glm::vec3(perFrameData.lights[i].pos);
+		return glm::vec3(lights[i].pos);
+	}
+
+	/*
+	 * Add or remove lights at the end. Added lights are black and disabled.
+	 */
+	void setNumLights(size_t n) {
+		lights.resize(n, Light());
+		perFrameDirty = true;
+	}
+
+	/*
+	 * Add a light at the end, returning its number
+	 */
+	GLuint addLight(const Light& light) {
+		lights.push_back(light);
+		perFrameDirty = true;
+		return lights.size() - 1;
 	}
 
 	void setGlobalAmbient(const glm::vec4& globalAmb) {
 		perFrameData.global_ambient = globalAmb;
+		perFrameDirty = true;
 	}
 
 	void setLightAttenuation(GLuint light, GLfloat attenuation) {
-		perFrameData.lights[light].attenuation = 1.0f / glm::pow(attenuation, 2.0);
+		lights[light].attenuation = 1.0f / glm::pow(attenuation, 2.0);
+		perFrameDirty = true;
 	}
 
 	void setLightPos(GLuint light, const glm::vec4& pos) {
-		perFrameData.lights[light].pos = pos;
+		lights[light].pos = pos;
+		perFrameDirty = true;
 	}
 
 	void setLightColor(GLuint light, const glm::vec4& color) {
-		perFrameData.lights[light].color = color;
+		lights[light].color = color;
+		perFrameDirty = true;
 	}
 
 	void setLight(GLuint l, const Light& light) {
-		perFrameData.lights[l] = light;
+		lights[l] = light;
+		perFrameDirty = true;
 	}
 
 	void disableLight(GLuint light) {
-		perFrameData.lights[light].enabled = 0.0; //glm::bvec1(false);
+		lights[light].enabled = 0.0; //glm::bvec1(false);
+		perFrameDirty = true;
 	}
 
 	void enableLight(GLuint light) {
-		perFrameData.lights[light].enabled = 1.0; //glm::bvec1(true);
+		lights[light].enabled = 1.0; //glm::bvec1(true);
+		perFrameDirty = true;
 	}
 
 	void setViewMatrix(const glm::mat4& matrix) {
 		perFrameData.view_matrix = matrix;
+		perFrameDirty = true;
 	}
 
 	void setProjectionMatrix(const glm::mat4& matrix) {
 		perFrameData.proj_matrix = matrix;
+		perFrameDirty = true;
 	}
 
 	void enableAlphaBlending() {
-		glEnable(GL_BLEND);
+		glState.enable(GL_BLEND);
 	}
 
 	void enableFaceCulling() {
-		glEnable(GL_CULL_FACE);
+		glState.enable(GL_CULL_FACE);
 	}
 
 	void disableFaceCulling() {
-		glDisable(GL_CULL_FACE);
+		glState.disable(GL_CULL_FACE);
 	}
 
 	void setFaceCullMode(FaceCullMode mode) {
@@ -167,11 +441,11 @@ public:
 	}
 
 	void enableDepthBuffer() {
-		glEnable(GL_DEPTH_TEST);
+		glState.enable(GL_DEPTH_TEST);
 	}
 
 	void disableDepthBuffer() {
-		glDisable(GL_DEPTH_TEST);
+		glState.disable(GL_DEPTH_TEST);
 	}
 };
 
@@ -0,0 +1,133 @@
+#include <GL/glew.h>
+
+#include <stdexcept>
+
+#include "utils/gl_program_builder.h"
+#include "gl_state_cache.h"
+
+#ifndef RENDERER_WEIGHTED_OIT_H_
+#define RENDERER_WEIGHTED_OIT_H_
+
+/*
+ * Weighted blended order independent transparency (McGuire and Bavoil 2013). Transparent
+ * geometry is drawn in any order into two offscreen targets, and a composite pass resolves
+ * them over whatever is already in the framebuffer.
+ *
+ * Shaders drawn between beginAccumulation() and composite() must write
+ *   location 0: vec4(color.rgb * color.a * w, color.a)
+ *   location 1: color.a * w
+ * where w is the depth weight from oit_weight.glsl. Both targets use the same blend function,
+ * so this only needs OpenGL 3.3: target 0 adds up the weighted color in rgb and multiplies
+ * together (1 - alpha) in a, which is the revealage, and target 1 adds up the weighted alpha.
+ */
+class WeightedBlendedOIT {
+	GLuint mFramebuffer = 0;
+	GLuint mAccumTexture = 0;
+	GLuint mAlphaTexture = 0;
+	GLuint mCompositeProgram = 0;
+	utils::GLUniform<GLint> mAccumTexUniform;
+	utils::GLUniform<GLint> mAlphaTexUniform;
+	GLuint mEmptyVao = 0;
+	size_t mWidth, mHeight;
+
+	static GLuint makeTarget(GLenum internalFormat, GLenum format, size_t w, size_t h) {
+		GLuint tex;
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, GL_FLOAT, nullptr);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return tex;
+	}
+
+public:
+	WeightedBlendedOIT(utils::GLProgramBuilder& programBuilder, size_t width, size_t height) :
+		mWidth(width), mHeight(height) {
+		mAccumTexture = makeTarget(GL_RGBA16F, GL_RGBA, width, height);
+		mAlphaTexture = makeTarget(GL_R16F, GL_RED, width, height);
+
+		glGenFramebuffers(1, &mFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mAccumTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mAlphaTexture, 0);
+		const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, drawBuffers);
+		const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if(status != GL_FRAMEBUFFER_COMPLETE) {
+			throw std::runtime_error("WeightedBlendedOIT: incomplete framebuffer");
+		}
+
+		mCompositeProgram = programBuilder.buildFromFiles(
+				"shaders/oit_composite_vert.glsl",
+				"shaders/oit_composite_frag.glsl");
+		const utils::GLProgramReflection& reflection = programBuilder.reflection(mCompositeProgram);
+		mAccumTexUniform = reflection.uniform<GLint>("accumTex");
+		mAlphaTexUniform = reflection.uniform<GLint>("alphaTex");
+
+		// The composite pass draws a full screen triangle from gl_VertexID alone
+		glGenVertexArrays(1, &mEmptyVao);
+	}
+
+	WeightedBlendedOIT(const WeightedBlendedOIT&) = delete;
+	WeightedBlendedOIT& operator=(const WeightedBlendedOIT&) = delete;
+
+	~WeightedBlendedOIT() {
+		glDeleteVertexArrays(1, &mEmptyVao);
+		glDeleteProgram(mCompositeProgram);
+		glDeleteFramebuffers(1, &mFramebuffer);
+		glDeleteTextures(1, &mAccumTexture);
+		glDeleteTextures(1, &mAlphaTexture);
+	}
+
+	/*
+	 * Bind and clear the accumulation targets, and set up blending for them. Depth writes are
+	 * turned off so transparent surfaces never hide each other.
+	 */
+	void beginAccumulation(GLStateCache& state) {
+		static const GLfloat ACCUM_CLEAR[4] = { 0.0, 0.0, 0.0, 1.0 };
+		static const GLfloat ALPHA_CLEAR[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+		glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+		glClearBufferfv(GL_COLOR, 0, ACCUM_CLEAR);
+		glClearBufferfv(GL_COLOR, 1, ALPHA_CLEAR);
+
+		glDepthMask(GL_FALSE);
+		state.enable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	/*
+	 * Resolve the accumulated surfaces over the default framebuffer. Leaves standard alpha
+	 * blending enabled and depth writes back on.
+	 */
+	void composite(GLStateCache& state) {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		state.useProgram(mCompositeProgram);
+		state.bindTexture(0, GL_TEXTURE_2D, mAccumTexture);
+		mAccumTexUniform.set(0);
+		state.bindTexture(1, GL_TEXTURE_2D, mAlphaTexture);
+		mAlphaTexUniform.set(1);
+
+		const bool depthTest = state.isEnabled(GL_DEPTH_TEST);
+		state.disable(GL_DEPTH_TEST);
+		state.bindVertexArray(mEmptyVao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		state.setEnabled(GL_DEPTH_TEST, depthTest);
+
+		glDepthMask(GL_TRUE);
+	}
+
+	size_t width() const {
+		return mWidth;
+	}
+
+	size_t height() const {
+		return mHeight;
+	}
+};
+
+#endif /* RENDERER_WEIGHTED_OIT_H_ */
@@ -1,13 +1,13 @@
-#extension GL_ARB_explicit_uniform_location : enable
-#extension GL_ARB_separate_shader_objects : enable
-
 #pragma include "stddefs.glsl"
 
-
-layout(location = 1) uniform uint light_id;
+flat in int v_lightId;
 
 out vec4 fragcolor;
 
 void main() {
-	fragcolor = std_Lights[light_id].color + std_GlobalAmbient;
+#ifdef STD_CLUSTERED_LIGHTING
+	fragcolor = std_ViewLights[v_lightId].color + std_GlobalAmbient;
+#else
+	fragcolor = std_Lights[v_lightId].color + std_GlobalAmbient;
+#endif
 }
@@ -1,9 +1,25 @@
 #pragma include "stddefs.glsl"
 
 in vec4 in_position;
-in vec3 in_normal;
-in vec2 in_texcoord;
+
+// Every light is drawn as an instance, in the order Renderer numbers them
+flat out int v_lightId;
 
 void main() {
-	gl_Position =  std_Projection * std_Modelview * in_position;
+	v_lightId = gl_InstanceID;
+
+	// The light's offset from the origin of std_Modelview, in view space
+#ifdef STD_CLUSTERED_LIGHTING
+	Light light = std_ViewLights[gl_InstanceID];
+	vec3 offset = light.position.xyz - std_View[3].xyz;
+#else
+	Light light = std_Lights[gl_InstanceID];
+	vec3 offset = mat3(std_View) * light.position.xyz;
+#endif
+
+	vec4 position = std_Modelview * in_position;
+	position.xyz += offset;
+
+	// Disabled lights collapse to a point outside the clip volume
+	gl_Position = light.enabled == 0.0 ? vec4(0.0) : std_Projection * position;
 }
@@ -1,10 +1,16 @@
 #pragma include "stddefs.glsl"
 
-in vec4 in_position;
+// Read once per instance, so each instance draws the line along one vertex's normal
+layout(location=0) in vec4 in_position;
+layout(location=1) in vec3 in_normal;
+
+uniform float normal_length;
 
 smooth out float interp_factor;
 
 void main() {
-	gl_Position =  std_Projection * std_Modelview * vec4(in_position.xyz, 1.0);
-	interp_factor = in_position.w;
+	// The first vertex of each line is at the vertex, and the second at the end of the normal
+	interp_factor = float(gl_VertexID);
+	vec3 position = in_position.xyz + interp_factor * normal_length * in_normal;
+	gl_Position =  std_Projection * std_Modelview * vec4(position, 1.0);
 }
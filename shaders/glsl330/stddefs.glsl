@@ -1,8 +1,30 @@
+// Programs built with STD_INDIRECT_DRAW defined are drawn by Renderer with
+// glMultiDrawElementsIndirect, and read the transforms of each draw from a storage buffer by
+// the draw's id instead of from uniforms. They need OpenGL 4.3 and
+// ARB_shader_draw_parameters, whose draw id is only visible to vertex shaders.
+#ifdef STD_INDIRECT_DRAW
+#extension GL_ARB_shader_storage_buffer_object : require
+#extension GL_ARB_shader_draw_parameters : enable
+#endif
+
+// Programs built with STD_CLUSTERED_LIGHTING defined read every light from storage buffers,
+// along with the lights which reach each cluster of the view frustum, so fragments only shade
+// the lights of their own cluster. They need OpenGL 4.3.
+#ifdef STD_CLUSTERED_LIGHTING
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+// Programs built with STD_NUM_LIGHTS defined are specialized for that many lights. Renderer
+// defines it to the number of lights in std_Lights for programs without clustered lighting,
+// and to 0 for any program when no light is enabled, so the lighting code which can't run is
+// stripped before it is compiled.
+
 struct Light {
     vec4 position;
     vec4 color;
     float attenuation;
     float enabled;
+    float radius;
 };
 
 struct Material {
@@ -12,9 +34,71 @@ struct Material {
     float reflectance;
 };
 
+// The per-frame data is shared by every program through a uniform buffer. GLSL 330 can't
+// give blocks a binding, so Renderer binds the block to this binding point when it first
+// uses a program.
+#define PER_FRAME_BLOCK_BINDING_POINT 1
+
+layout(std140) uniform PerFrameBlock {
+	mat4 std_View;
+	mat4 std_Projection;
+	vec4 std_GlobalAmbient;
+
+	// The number of clusters along x, y and depth, and in w the number of lights
+	uvec4 std_LightGrid;
+
+	// The depth of the first cluster slice, and the number of slices per unit of log depth
+	vec4 std_LightGridDepth;
+
+	// The first 10 lights, in world space
+	Light std_Lights[10];
+};
+
+#ifdef STD_CLUSTERED_LIGHTING
+
+// Renderer binds the light buffers to these shader storage binding points
+#define VIEW_LIGHT_BUFFER_BINDING_POINT 4
+#define CLUSTER_BUFFER_BINDING_POINT 5
+#define CLUSTER_LIGHT_BUFFER_BINDING_POINT 6
+
+// Every light, with its position in view space
+layout(std430) readonly buffer ViewLightBuffer {
+	Light std_ViewLights[];
+};
+
+// The first element of std_ClusterLights of each cluster's lights, and how many there are
+layout(std430) readonly buffer ClusterBuffer {
+	uvec2 std_Clusters[];
+};
+
+// The index in std_ViewLights of each light of each cluster, grouped by cluster
+layout(std430) readonly buffer ClusterLightBuffer {
+	uint std_ClusterLights[];
+};
+
+#endif
+
+#ifdef STD_INDIRECT_DRAW
+
+// Renderer binds the per-draw buffer to this shader storage binding point
+#define PER_DRAW_BUFFER_BINDING_POINT 3
+
+struct PerDraw {
+	mat4 modelview;
+	mat4 normal;
+};
+
+layout(std430) readonly buffer PerDrawBuffer {
+	PerDraw std_PerDraw[];
+};
+
+#define std_Modelview (std_PerDraw[gl_DrawIDARB].modelview)
+#define std_Normal (std_PerDraw[gl_DrawIDARB].normal)
+
+#else
+
+// Set for every draw
 uniform mat4 std_Modelview;
 uniform mat4 std_Normal;
-uniform mat4 std_View;
-uniform mat4 std_Projection;
-uniform vec4 std_GlobalAmbient;
-uniform Light std_Lights[10];
+
+#endif
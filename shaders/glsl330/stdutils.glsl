@@ -3,4 +3,26 @@ const float STD_PI = 3.1415926535897932384626433832795;
 void std_Attenuate(in vec4 lightPos, in float k, in vec4 pos, out float attenuation) {
 	float distanceToLight = distance(lightPos, pos);
 	attenuation = 1.0 / (1.0 + k * pow(distanceToLight, 2.0));
-}
\ No newline at end of file
+}
+
+// Fades the attenuation to 0 at the light's radius, beyond which Renderer doesn't shade it
+void std_AttenuateToRadius(in vec4 lightPos, in float k, in float radius, in vec4 pos, out float attenuation) {
+	float distanceToLight = distance(lightPos, pos);
+	float window = clamp(1.0 - pow(distanceToLight / radius, 4.0), 0.0, 1.0);
+	attenuation = window * window / (1.0 + k * pow(distanceToLight, 2.0));
+}
+
+#ifdef STD_CLUSTERED_LIGHTING
+
+// The cluster a view space position is in, found the same way as LightClusters::clusterIndex
+uint std_ClusterIndex(in vec4 viewPos) {
+	vec4 clip = std_Projection * viewPos;
+	vec2 tiles = vec2(std_LightGrid.xy);
+	vec2 tile = clamp(floor((clip.xy / clip.w * 0.5 + 0.5) * tiles), vec2(0.0), tiles - 1.0);
+	float near = std_LightGridDepth.x;
+	float slice = floor(log(max(-viewPos.z, near) / near) * std_LightGridDepth.y);
+	slice = min(slice, float(std_LightGrid.z) - 1.0);
+	return (uint(slice) * std_LightGrid.y + uint(tile.y)) * std_LightGrid.x + uint(tile.x);
+}
+
+#endif
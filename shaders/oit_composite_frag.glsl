@@ -0,0 +1,19 @@
+// Resolves the weighted blended OIT targets, see renderer/weighted_oit.h
+
+uniform sampler2D accumTex;
+uniform sampler2D alphaTex;
+
+out vec4 fragcolor;
+
+void main() {
+	ivec2 p = ivec2(gl_FragCoord.xy);
+	vec4 accum = texelFetch(accumTex, p, 0);
+	float revealage = accum.a;
+	if(revealage >= 1.0) {
+		discard;
+	}
+
+	// Weighted average of the surface colors, covering 1 - revealage of the background
+	float weightedAlpha = texelFetch(alphaTex, p, 0).r;
+	fragcolor = vec4(accum.rgb / max(weightedAlpha, 1e-5), 1.0 - revealage);
+}
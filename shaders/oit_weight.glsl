@@ -0,0 +1,6 @@
+// Depth weight for weighted blended OIT (McGuire and Bavoil 2013, equation 10). Nearer and
+// more opaque surfaces get more weight. viewDepth is the distance along the view axis, which
+// for a perspective projection is 1.0 / gl_FragCoord.w.
+float oitWeight(float viewDepth, float alpha) {
+	return alpha * clamp(0.03 / (1e-5 + pow(viewDepth / 200.0, 4.0)), 1e-2, 3e3);
+}
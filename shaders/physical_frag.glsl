@@ -9,44 +9,65 @@ smooth in vec2 v_texcoord;
 
 out vec4 fragcolor;
 
+// The light reflected towards the viewer from a light at viewSpaceLightPos
+vec3 shade(in vec4 viewSpaceLightPos, in Light light, in vec3 normal, in vec3 dirToViewer, in float n_dot_v) {
+	vec3 dirToLight = normalize(vec3(viewSpaceLightPos - v_position));
+	vec3 halfVec = normalize(dirToLight + dirToViewer);
+
+	float n_dot_l = dot(normal, dirToLight);
+	float n_dot_h = max(dot(normal, halfVec), 0.0);
+	float v_dot_h = max(dot(dirToViewer, halfVec), 0.0);
+	float l_dot_h = max(dot(halfVec, dirToLight), 0.0);
+	float n_dot_l_clamped = max(n_dot_l, 0.0);
+	
+	float G = 2.0 * min(n_dot_v, n_dot_l) * n_dot_h / v_dot_h;
+	      G = min(1.0, G);
+	    
+	float Fs = mat.reflectance + (1.0 - mat.reflectance) * pow((1.0 - l_dot_h), 5.0);
+	float Fd = mat.reflectance + (1.0 - mat.reflectance) * pow((1.0 - n_dot_l_clamped), 5.0);
+	
+	float D = pow(n_dot_h, mat.roughness) * ((mat.roughness + 2)/(2*STD_PI));
+	
+	float specular_brdf = (Fs * D * G) / (4 * n_dot_l * n_dot_v);
+	vec3 specular = n_dot_l_clamped * specular_brdf * mat.specular.rgb;
+	vec3 diffuse = n_dot_l_clamped * (1.0 - Fd) * mat.diffuse.rgb;
+
+	float attenuation;
+	std_AttenuateToRadius(viewSpaceLightPos, light.attenuation, light.radius, v_position, attenuation);
+	return attenuation * (diffuse + specular) * light.color.rgb;
+}
+
 void main() {
 	vec3 color = std_GlobalAmbient.rgb;
-			
-	vec3 diffuse, specular;
-	float attenuation;
 
 	vec3 normal = normalize(v_normal);
 	vec3 dirToViewer = normalize(-v_position.xyz);
 	
 	float n_dot_v = dot(normal, dirToViewer);
-	float n_dot_v_clamped = max(n_dot_v, 0.0);
-	
-	for(int i = 0; i < std_Lights.length(); i++) {
-		vec4 viewSpaceLightPos = std_View * std_Lights[i].position;
-		vec3 dirToLight = normalize(vec3(viewSpaceLightPos - v_position));
-		vec3 halfVec = normalize(dirToLight + dirToViewer);
-
-		float n_dot_l = dot(normal, dirToLight);
-		float n_dot_h = max(dot(normal, halfVec), 0.0);
-		float v_dot_h = max(dot(dirToViewer, halfVec), 0.0);
-		float l_dot_h = max(dot(halfVec, dirToLight), 0.0);
-		float n_dot_l_clamped = max(n_dot_l, 0.0);
-		
-		float G = 2.0 * min(n_dot_v, n_dot_l) * n_dot_h / v_dot_h;
-		      G = min(1.0, G);
-		    
-		float Fs = mat.reflectance + (1.0 - mat.reflectance) * pow((1.0 - l_dot_h), 5.0);
-		float Fd = mat.reflectance + (1.0 - mat.reflectance) * pow((1.0 - n_dot_l_clamped), 5.0);
-		
-		float D = pow(n_dot_h, mat.roughness) * ((mat.roughness + 2)/(2*STD_PI));
-		
-		float specular_brdf = (Fs * D * G) / (4 * n_dot_l * n_dot_v);
-		specular = n_dot_l_clamped * specular_brdf * mat.specular.rgb;
-		diffuse = n_dot_l_clamped * (1.0 - Fd) * mat.diffuse.rgb;
-
-		std_Attenuate(viewSpaceLightPos, std_Lights[i].attenuation, v_position, attenuation);
-		color += attenuation * (diffuse + specular) * std_Lights[i].color.rgb;
+
+#if defined(STD_NUM_LIGHTS) && STD_NUM_LIGHTS == 0
+	// No light is enabled, so only the ambient light is left
+#elif defined(STD_CLUSTERED_LIGHTING)
+	// Only the lights which reach this fragment's cluster, already in view space
+	uvec2 cluster = std_Clusters[std_ClusterIndex(v_position)];
+	for(uint i = cluster.x; i < cluster.x + cluster.y; i++) {
+		Light light = std_ViewLights[std_ClusterLights[i]];
+		color += shade(light.position, light, normal, dirToViewer, n_dot_v);
+	}
+#else
+#ifdef STD_NUM_LIGHTS
+	// A constant, so the loop can be unrolled
+	const int numLights = STD_NUM_LIGHTS;
+#else
+	int numLights = min(int(std_LightGrid.w), std_Lights.length());
+#endif
+	for(int i = 0; i < numLights; i++) {
+		if(std_Lights[i].enabled == 0.0 || std_Lights[i].radius == 0.0) {
+			continue;
+		}
+		color += shade(std_View * std_Lights[i].position, std_Lights[i], normal, dirToViewer, n_dot_v);
 	}
+#endif
 	
 	fragcolor = vec4(color, 1.0);
 	vec4 gamma = vec4(1.0/2.2);
@@ -1,15 +1,25 @@
 #pragma include "stddefs.glsl"
+#pragma include "tile_view_lookup.glsl"
 
+// Built with TILE_INSTANCED defined for instanced walls, which share one unit quad
+#ifdef TILE_INSTANCED
+// A corner of the shared unit quad. x is 0 at the first endpoint of the wall and 1 at the
+// second, and y is the height of the corner.
+layout(location=0) in vec4 corner;
+
+// Per wall: the endpoints of the wall in xy and zw, and its view id
+layout(location=1) in vec4 endpoints;
+layout(location=2) in uint view;
+#else
 layout(location=0) in vec4 position;
 layout(location=1) in vec3 texcoord;
-
-out vec2 v_texcoord;
-out vec4 v_position;
-flat out uint v_texindex;
+#endif
 
 void main() {
-	gl_Position = std_Projection * std_Modelview * position;
-	v_texcoord = texcoord.xy;
-	v_texindex = uint(texcoord.z);
-	v_position = position;
-}
\ No newline at end of file
+#ifdef TILE_INSTANCED
+	vec2 p = mix(endpoints.xy, endpoints.zw, corner.x);
+	emitTileVertex(vec4(p.x, corner.y, p.y, 1.0), vec3(corner.x, corner.y + 0.5, float(view)));
+#else
+	emitTileVertex(position, texcoord);
+#endif
+}
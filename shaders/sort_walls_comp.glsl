@@ -0,0 +1,108 @@
+#version 430
+
+// Sorts walls back to front from the eye with a bitonic sort and writes the index buffer.
+// Run once with sortPass = PASS_COMPUTE_KEYS, once with PASS_BITONIC_STEP for every (k, j)
+// step of the sorting network, then once with PASS_WRITE_INDICES.
+
+#define PASS_COMPUTE_KEYS 0
+#define PASS_BITONIC_STEP 1
+#define PASS_WRITE_INDICES 2
+
+layout(local_size_x = 256) in;
+
+// The center of each wall in xyz
+layout(std430, binding = 0) readonly buffer WallCenters {
+	vec4 centers[];
+};
+
+// (key, wall) pairs being sorted, padded to a power of two with keys that sort last
+layout(std430, binding = 1) buffer SortKeys {
+	uvec2 keys[];
+};
+
+// The walls' range of the index buffer, 6 indices per wall from word firstWord on. 16 bit
+// indices are packed in pairs.
+layout(std430, binding = 2) writeonly buffer WallIndices {
+	uint indices[];
+};
+
+// The ranges of walls to sort as (first wall, position of the first wall in the sorted
+// walls), in increasing order of both
+layout(std430, binding = 3) readonly buffer WallRanges {
+	uvec2 ranges[];
+};
+
+uniform int sortPass;
+uniform vec3 eye;
+uniform uint numWalls; // The number of walls sorted, over all the ranges
+uniform uint numRanges;
+uniform uint numKeys;
+uniform uint k; // The size of the bitonic sequences being merged
+uniform uint j; // The distance between compared elements
+uniform bool shortIndices;
+uniform uint firstWord;
+
+// Map a float to a uint which sorts in the same order
+uint sortableFloatKey(float f) {
+	uint bits = floatBitsToUint(f);
+	return (bits & 0x80000000u) != 0u ? ~bits : bits | 0x80000000u;
+}
+
+// The wall at position i of the walls being sorted, found by binary search of the ranges
+uint wallAt(uint i) {
+	uint lo = 0u;
+	uint hi = numRanges - 1u;
+	while(lo < hi) {
+		uint mid = (lo + hi + 1u) / 2u;
+		if(ranges[mid].y <= i) {
+			lo = mid;
+		} else {
+			hi = mid - 1u;
+		}
+	}
+	return ranges[lo].x + (i - ranges[lo].y);
+}
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if(i >= numKeys) {
+		return;
+	}
+
+	if(sortPass == PASS_COMPUTE_KEYS) {
+		if(i < numWalls) {
+			// Farthest first, so invert the depth
+			uint wall = wallAt(i);
+			keys[i] = uvec2(~sortableFloatKey(distance(centers[wall].xyz, eye)), wall);
+		} else {
+			keys[i] = uvec2(0xffffffffu);
+		}
+	} else if(sortPass == PASS_BITONIC_STEP) {
+		uint l = i ^ j;
+		if(l > i) {
+			uvec2 a = keys[i];
+			uvec2 b = keys[l];
+
+			// Break ties by wall so the order doesn't flicker between frames
+			bool aAfterB = a.x > b.x || (a.x == b.x && a.y > b.y);
+			bool ascending = (i & k) == 0u;
+			if(aAfterB == ascending) {
+				keys[i] = b;
+				keys[l] = a;
+			}
+		}
+	} else if(sortPass == PASS_WRITE_INDICES && i < numWalls) {
+		uint vBase = keys[i].y * 4u;
+		uint quad[6] = uint[6](vBase + 0u, vBase + 1u, vBase + 2u, vBase + 1u, vBase + 3u, vBase + 2u);
+		if(shortIndices) {
+			// The 6 indices of a wall fill exactly 3 words, the first of each pair in the low half
+			for(uint w = 0u; w < 3u; w++) {
+				indices[firstWord + i * 3u + w] = quad[w * 2u] | (quad[w * 2u + 1u] << 16u);
+			}
+		} else {
+			for(uint w = 0u; w < 6u; w++) {
+				indices[firstWord + i * 6u + w] = quad[w];
+			}
+		}
+	}
+}
@@ -0,0 +1,29 @@
+// Shading shared by the sorted and order independent tile wall shaders
+
+uniform sampler2DArray texid;
+uniform sampler2DArray depthId;
+
+in vec4 v_position;
+in vec2 v_texcoord; 
+flat in uint v_texindex;
+
+uniform mat4 reprojMat;
+
+vec4 shadeTile() {
+	float depth = texture(depthId, vec3(v_texcoord, v_texindex)).r * 50.0;
+	vec2 uv = v_texcoord - vec2(0.5);
+	vec3 pos = normalize(vec3(gl_FragCoord.xy, -0.5)) * depth;
+	
+	vec4 reprojectedPos = reprojMat * vec4(pos, 1.0);
+	vec3 pp = reprojectedPos.xyz / reprojectedPos.w;
+	vec2 tc = pp.xy/pp.z;
+	
+	/*
+	return texture(texid, vec3(tc, v_texindex));
+	   
+	return vec4(tc, 0.0, 0.5);
+	*/       
+	return
+	  vec4(normalize(pos+vec3(50.0)), 
+	       texture(texid, vec3(v_texcoord, v_texindex)).a);
+}
@@ -0,0 +1,18 @@
+// Vertex outputs shared by the tile wall vertex shaders
+
+// Maps a view id to (layer << 1 | mirrored) in the tile texture arrays
+uniform usamplerBuffer viewLayers;
+
+out vec2 v_texcoord;
+out vec4 v_position;
+flat out uint v_texindex;
+
+// Transform a wall vertex, and look up the layer of the tile view in texcoord.z
+void emitTileVertex(vec4 position, vec3 texcoord) {
+	uint viewLayer = texelFetch(viewLayers, int(texcoord.z)).r;
+
+	gl_Position = std_Projection * std_Modelview * position;
+	v_texcoord = (viewLayer & 1u) != 0u ? vec2(1.0 - texcoord.x, texcoord.y) : texcoord.xy;
+	v_texindex = viewLayer >> 1;
+	v_position = position;
+}
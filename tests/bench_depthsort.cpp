@@ -0,0 +1,86 @@
+#include <stdio.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "utils/radix_sort.h"
+
+using namespace std;
+using namespace utils;
+
+/*
+ * Compare depth sorting walls with a comparator that computes depths on the fly against
+ * precomputing a key per wall and radix sorting. Walls are random quads in a disc around
+ * the origin, stored as in TileMesh: 4 vertices and 6 indices each.
+ */
+
+typedef array<unsigned, 6> Quad;
+
+static void makeWalls(size_t numWalls, vector<glm::vec4>& verts, vector<Quad>& quads) {
+  mt19937 rng(1234);
+  uniform_real_distribution<float> dist(-500.0f, 500.0f);
+  verts.resize(numWalls * 4);
+  quads.resize(numWalls);
+  for(size_t w = 0; w < numWalls; w++) {
+    const glm::vec2 v1(dist(rng), dist(rng));
+    const glm::vec2 v2 = v1 + glm::vec2(1.0f, 0.0f);
+    verts[w*4 + 0] = glm::vec4(v1.x,  0.5, v1.y, 1.0);
+    verts[w*4 + 1] = glm::vec4(v1.x, -0.5, v1.y, 1.0);
+    verts[w*4 + 2] = glm::vec4(v2.x,  0.5, v2.y, 1.0);
+    verts[w*4 + 3] = glm::vec4(v2.x, -0.5, v2.y, 1.0);
+
+    const unsigned b = w * 4;
+    quads[w] = Quad { b + 0, b + 1, b + 2, b + 1, b + 3, b + 2 };
+  }
+}
+
+template <class F>
+static double timeMs(const F& f) {
+  const auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+  const size_t sizes[] = { 100000, 300000, 1000000 };
+
+  printf("%10s %16s %16s %16s\n", "walls", "comparator (ms)", "radix (ms)", "radix walls/s");
+  for(size_t n : sizes) {
+    vector<glm::vec4> verts;
+    vector<Quad> quads;
+    makeWalls(n, verts, quads);
+
+    vector<Quad> byComparator = quads;
+    const double comparatorMs = timeMs([&] {
+      stable_sort(byComparator.begin(), byComparator.end(), [&](const Quad& a, const Quad& b) {
+        const glm::vec3 ca = glm::vec3(verts[a[0]] + verts[a[4]]) / 2.0f;
+        const glm::vec3 cb = glm::vec3(verts[b[0]] + verts[b[4]]) / 2.0f;
+        return glm::length(ca) > glm::length(cb);
+      });
+    });
+
+    vector<Quad> byRadix = quads;
+    const double radixMs = timeMs([&] {
+      vector<uint32_t> keys(byRadix.size());
+      for(size_t q = 0; q < byRadix.size(); q++) {
+        const glm::vec3 c = glm::vec3(verts[byRadix[q][0]] + verts[byRadix[q][4]]) / 2.0f;
+        keys[q] = ~sortableFloatKey(glm::length(c));
+      }
+      radixSortByKey(keys, byRadix);
+    });
+
+    if(byRadix != byComparator) {
+      fprintf(stderr, "Sorted orders differ for %zu walls\n", n);
+      return 1;
+    }
+
+    printf("%10zu %16.2f %16.2f %16.3g\n", n, comparatorMs, radixMs, n / (radixMs / 1000.0));
+  }
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include "renderer/draw_list.h"
+
+using namespace std;
+
+// Packets only hold pointers to geometry, so any address will do for these tests
+static const Geometry& fakeGeometry(size_t i) {
+  static char storage[16];
+  return *reinterpret_cast<const Geometry*>(&storage[i]);
+}
+
+static vector<uint32_t> sortedOrder(DrawList& list) {
+  list.sort();
+  return list.order();
+}
+
+BOOST_AUTO_TEST_SUITE(DrawListTests)
+
+BOOST_AUTO_TEST_CASE(test_layers_come_first) {
+  DrawList list;
+  list.record(1, DrawList::LayerOrder::STATE, 1, nullptr, {}, fakeGeometry(0), glm::mat4(1.0), 1.0f);
+  list.record(0, DrawList::LayerOrder::BACK_TO_FRONT, 2, nullptr, {}, fakeGeometry(1), glm::mat4(1.0), 5.0f);
+  list.record(0, DrawList::LayerOrder::BACK_TO_FRONT, 3, nullptr, {}, fakeGeometry(2), glm::mat4(1.0), 10.0f);
+
+  // The farther packet of layer 0 goes first, whatever its program
+  BOOST_CHECK((sortedOrder(list) == vector<uint32_t>{ 2, 1, 0 }));
+}
+
+BOOST_AUTO_TEST_CASE(test_state_order_groups_programs) {
+  DrawList list;
+  list.record(0, DrawList::LayerOrder::STATE, 2, nullptr, {}, fakeGeometry(0), glm::mat4(1.0), 1.0f);
+  list.record(0, DrawList::LayerOrder::STATE, 1, nullptr, {}, fakeGeometry(1), glm::mat4(1.0), 3.0f);
+  list.record(0, DrawList::LayerOrder::STATE, 2, nullptr, {}, fakeGeometry(2), glm::mat4(1.0), 0.5f);
+  list.record(0, DrawList::LayerOrder::STATE, 1, nullptr, {}, fakeGeometry(3), glm::mat4(1.0), 2.0f);
+
+  // Grouped by program, then front to back within each program
+  BOOST_CHECK((sortedOrder(list) == vector<uint32_t>{ 3, 1, 2, 0 }));
+}
+
+BOOST_AUTO_TEST_CASE(test_equal_keys_keep_recorded_order) {
+  DrawList list;
+  for(size_t i = 0; i < 8; i++) {
+    list.record(0, DrawList::LayerOrder::STATE, 1, nullptr, {}, fakeGeometry(i), glm::mat4(1.0), 1.0f);
+  }
+  BOOST_CHECK((sortedOrder(list) == vector<uint32_t>{ 0, 1, 2, 3, 4, 5, 6, 7 }));
+}
+
+BOOST_AUTO_TEST_CASE(test_merge_rebases_textures) {
+  DrawList a, b;
+  a.record(0, DrawList::LayerOrder::STATE, 1, nullptr, { { 0, GL_TEXTURE_2D, 7 } }, fakeGeometry(0), glm::mat4(1.0), 1.0f);
+  b.record(0, DrawList::LayerOrder::STATE, 1, nullptr, { { 0, GL_TEXTURE_2D, 8 }, { 1, GL_TEXTURE_2D, 9 } },
+           fakeGeometry(1), glm::mat4(1.0), 1.0f);
+  a.merge(b);
+
+  BOOST_CHECK_EQUAL(b.size(), 0);
+  BOOST_REQUIRE_EQUAL(a.size(), 2);
+  const DrawList::Packet& merged = a.packets()[1];
+  BOOST_CHECK_EQUAL(merged.numTextures, 2);
+  BOOST_CHECK_EQUAL(a.textures()[merged.firstTexture].texture, 8);
+  BOOST_CHECK_EQUAL(a.textures()[merged.firstTexture + 1].texture, 9);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,216 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include <SDL2/SDL.h>
+
+#include "geometry/gpu_wall_sorter.h"
+#include "utils/gl_stream_buffer.h"
+
+using namespace glm;
+using namespace std;
+using namespace geometry;
+
+/*
+ * Creates a hidden window with an OpenGL 4.3 core context. Tests are skipped if there is no
+ * display or the driver is too old. Mesa's software renderer supports 4.3, so these tests
+ * can run anywhere with LIBGL_ALWAYS_SOFTWARE=1.
+ */
+struct GLContextFixture {
+  SDL_Window* window = nullptr;
+  SDL_GLContext context = nullptr;
+
+  GLContextFixture() {
+    // Shaders are loaded relative to the source directory
+    if(chdir(SOURCE_DIR) != 0 || SDL_Init(SDL_INIT_VIDEO) != 0) {
+      return;
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    window = SDL_CreateWindow("test", 0, 0, 16, 16, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if(window != nullptr) {
+      context = SDL_GL_CreateContext(window);
+    }
+    if(context != nullptr) {
+      glewExperimental = GL_TRUE;
+      glewInit();
+    }
+  }
+
+  ~GLContextFixture() {
+    if(context != nullptr) {
+      SDL_GL_DeleteContext(context);
+    }
+    if(window != nullptr) {
+      SDL_DestroyWindow(window);
+    }
+    SDL_Quit();
+  }
+
+  bool hasComputeShaders() const {
+    return context != nullptr && GPUWallSorter::isSupported();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(GPUWallSortTests, GLContextFixture)
+
+BOOST_AUTO_TEST_CASE(test_gpu_sort_matches_cpu) {
+  if(!hasComputeShaders()) {
+    BOOST_TEST_MESSAGE("Skipping, no OpenGL 4.3 context available");
+    return;
+  }
+
+  // Walls at distinct distances from the eye, in a random order. The number of walls
+  // isn't a power of two, so the padding is exercised too.
+  const size_t numWalls = 1000;
+  mt19937 rng(1234);
+  uniform_real_distribution<float> angle(0.0f, 6.28f);
+  vector<GLuint> distances(numWalls);
+  for(size_t i = 0; i < numWalls; i++) {
+    distances[i] = i + 1;
+  }
+  shuffle(distances.begin(), distances.end(), rng);
+
+  const vec3 eye(3.0, 0.0, -2.0);
+  vector<vec3> centers(numWalls);
+  for(size_t i = 0; i < numWalls; i++) {
+    const float a = angle(rng);
+    centers[i] = eye + vec3(cos(a), 0.0, sin(a)) * float(distances[i]);
+  }
+
+  utils::GLProgramBuilder builder;
+  GPUWallSorter sorter(builder);
+  sorter.setWalls(centers);
+
+  GLuint indexBuffer;
+  glGenBuffers(1, &indexBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, numWalls * 6 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+
+  utils::GLStreamBuffer uploads(1 << 16);
+  sorter.sort(eye, uploads, indexBuffer);
+
+  vector<GLuint> indices(numWalls * 6);
+  glBindBuffer(GL_COPY_READ_BUFFER, indexBuffer);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+  glDeleteBuffers(1, &indexBuffer);
+
+  // Farthest first
+  vector<GLuint> expected(numWalls);
+  for(size_t i = 0; i < numWalls; i++) {
+    expected[i] = i;
+  }
+  sort(expected.begin(), expected.end(), [&](GLuint a, GLuint b) { return distances[a] > distances[b]; });
+
+  for(size_t i = 0; i < numWalls; i++) {
+    const GLuint vBase = expected[i] * 4;
+    const GLuint quad[6] = { vBase + 0, vBase + 1, vBase + 2, vBase + 1, vBase + 3, vBase + 2 };
+    for(size_t k = 0; k < 6; k++) {
+      BOOST_REQUIRE_EQUAL(indices[i * 6 + k], quad[k]);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_gpu_sort_only_sorts_given_ranges) {
+  if(!hasComputeShaders()) {
+    BOOST_TEST_MESSAGE("Skipping, no OpenGL 4.3 context available");
+    return;
+  }
+
+  // Walls in a row, nearest first. Only two ranges of them are sorted, as for the walls of
+  // the visible chunks, and their walls are interleaved by distance.
+  const size_t numWalls = 300;
+  vector<vec3> centers(numWalls);
+  for(size_t i = 0; i < numWalls; i++) {
+    centers[i] = vec3(float(i + 1), 0.0, 0.0);
+  }
+  const vector<uvec2> ranges = { uvec2(20, 30), uvec2(35, 100) };
+  const size_t numSorted = 130;
+
+  utils::GLProgramBuilder builder;
+  GPUWallSorter sorter(builder);
+  sorter.setWalls(centers);
+
+  const GLuint untouched = 0xabcdabcd;
+  vector<GLuint> indices(numWalls * 6, untouched);
+  GLuint indexBuffer;
+  glGenBuffers(1, &indexBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_DYNAMIC_DRAW);
+
+  utils::GLStreamBuffer uploads(1 << 16);
+  sorter.sort(vec3(0.0), ranges, uploads, indexBuffer);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, indexBuffer);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+  glDeleteBuffers(1, &indexBuffer);
+
+  // The walls of both ranges, farthest first, and nothing after them
+  vector<GLuint> expected;
+  for(auto r = ranges.begin(); r != ranges.end(); r++) {
+    for(GLuint w = r->x; w < r->x + r->y; w++) {
+      expected.push_back(w);
+    }
+  }
+  sort(expected.begin(), expected.end(), greater<GLuint>());
+  BOOST_REQUIRE_EQUAL(expected.size(), numSorted);
+  for(size_t i = 0; i < numSorted; i++) {
+    BOOST_REQUIRE_EQUAL(indices[i * 6], expected[i] * 4);
+  }
+  for(size_t i = numSorted * 6; i < indices.size(); i++) {
+    BOOST_REQUIRE_EQUAL(indices[i], untouched);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_gpu_sort_writes_from_first_index) {
+  if(!hasComputeShaders()) {
+    BOOST_TEST_MESSAGE("Skipping, no OpenGL 4.3 context available");
+    return;
+  }
+
+  // Walls in a row, nearest first, written after other geometry's indices in a shared buffer.
+  // The first index isn't a multiple of any storage buffer offset alignment.
+  const size_t numWalls = 50;
+  const size_t firstIndex = 10;
+  vector<vec3> centers(numWalls);
+  for(size_t i = 0; i < numWalls; i++) {
+    centers[i] = vec3(float(i + 1), 0.0, 0.0);
+  }
+
+  utils::GLProgramBuilder builder;
+  GPUWallSorter sorter(builder);
+  sorter.setWalls(centers);
+
+  const GLushort untouched = 0xabcd;
+  vector<GLushort> indices(firstIndex + numWalls * 6 + 2, untouched);
+  GLuint indexBuffer;
+  glGenBuffers(1, &indexBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_DYNAMIC_DRAW);
+
+  utils::GLStreamBuffer uploads(1 << 16);
+  sorter.sort(vec3(0.0), uploads, indexBuffer, GL_UNSIGNED_SHORT, firstIndex);
+
+  glBindBuffer(GL_COPY_READ_BUFFER, indexBuffer);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, indices.size() * sizeof(GLushort), indices.data());
+  glDeleteBuffers(1, &indexBuffer);
+
+  for(size_t i = 0; i < firstIndex; i++) {
+    BOOST_REQUIRE_EQUAL(indices[i], untouched);
+  }
+  for(size_t i = 0; i < numWalls; i++) {
+    BOOST_REQUIRE_EQUAL(indices[firstIndex + i * 6], (numWalls - 1 - i) * 4);
+  }
+  BOOST_CHECK_EQUAL(indices[firstIndex + numWalls * 6], untouched);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
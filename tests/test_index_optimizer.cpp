@@ -0,0 +1,106 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include "geometry/index_optimizer.h"
+
+using namespace std;
+using namespace geometry;
+
+struct IndexOptimizerFixture {
+  mt19937 rng{1234};
+
+  // A grid of n by n quads, with its triangles shuffled
+  vector<uint32_t> shuffledGrid(uint32_t n) {
+    vector<array<uint32_t, 3>> tris;
+    for(uint32_t i = 0; i < n; i++) {
+      for(uint32_t j = 0; j < n; j++) {
+        const uint32_t v = i * (n + 1) + j;
+        tris.push_back({{ v, v + 1, v + n + 1 }});
+        tris.push_back({{ v + 1, v + n + 2, v + n + 1 }});
+      }
+    }
+    shuffle(tris.begin(), tris.end(), rng);
+
+    vector<uint32_t> ret;
+    for(auto t = tris.begin(); t != tris.end(); t++) {
+      ret.insert(ret.end(), t->begin(), t->end());
+    }
+    return ret;
+  }
+
+  // The triangles of indices, each rotated to start at its smallest index, in sorted order
+  static vector<array<uint32_t, 3>> canonicalTriangles(const vector<uint32_t>& indices) {
+    vector<array<uint32_t, 3>> ret;
+    for(size_t i = 0; i < indices.size(); i += 3) {
+      array<uint32_t, 3> t {{ indices[i], indices[i + 1], indices[i + 2] }};
+      rotate(t.begin(), min_element(t.begin(), t.end()), t.end());
+      ret.push_back(t);
+    }
+    sort(ret.begin(), ret.end());
+    return ret;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(IndexOptimizerTests, IndexOptimizerFixture)
+
+BOOST_AUTO_TEST_CASE(test_acmr_bounds) {
+  // No reuse at all
+  const vector<uint32_t> separate { 0, 1, 2, 3, 4, 5 };
+  BOOST_CHECK_CLOSE(averageCacheMissRatio(separate, 6), 3.0f, 1e-4);
+
+  // Two triangles sharing an edge
+  const vector<uint32_t> quad { 0, 1, 2, 1, 3, 2 };
+  BOOST_CHECK_CLOSE(averageCacheMissRatio(quad, 4), 2.0f, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(test_cache_order_keeps_triangles) {
+  const uint32_t n = 40;
+  const size_t numVertices = (n + 1) * (n + 1);
+  vector<uint32_t> indices = shuffledGrid(n);
+  const vector<array<uint32_t, 3>> before = canonicalTriangles(indices);
+  const float acmrBefore = averageCacheMissRatio(indices, numVertices);
+
+  optimizeVertexCache(indices, numVertices);
+  BOOST_CHECK(canonicalTriangles(indices) == before);
+
+  const float acmrAfter = averageCacheMissRatio(indices, numVertices);
+  BOOST_TEST_MESSAGE("ACMR " << acmrBefore << " -> " << acmrAfter);
+  BOOST_CHECK_GT(acmrBefore, 2.5f);
+  BOOST_CHECK_LT(acmrAfter, 0.8f);
+}
+
+BOOST_AUTO_TEST_CASE(test_fetch_order) {
+  const uint32_t n = 10;
+  const size_t numVertices = (n + 1) * (n + 1) + 1; // The last vertex isn't used
+  vector<uint32_t> indices = shuffledGrid(n);
+  const vector<uint32_t> original = indices;
+
+  vector<uint32_t> vertices(numVertices);
+  for(size_t v = 0; v < numVertices; v++) {
+    vertices[v] = v;
+  }
+
+  const vector<uint32_t> remap = optimizeVertexFetch(indices, numVertices);
+  remapVertices(vertices, remap);
+
+  // Every index still refers to the same vertex
+  for(size_t i = 0; i < indices.size(); i++) {
+    BOOST_REQUIRE_EQUAL(vertices[indices[i]], original[i]);
+  }
+
+  // Vertices are numbered in order of first use
+  uint32_t next = 0;
+  for(auto i = indices.begin(); i != indices.end(); i++) {
+    BOOST_REQUIRE_LE(*i, next);
+    next = max(next, *i + 1);
+  }
+  BOOST_CHECK_EQUAL(vertices.back(), numVertices - 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
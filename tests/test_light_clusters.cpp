@@ -0,0 +1,127 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "renderer/light_clusters.h"
+
+using namespace std;
+
+static Light pointLight(const glm::vec3& pos, float attenuation) {
+  Light light = {};
+  light.pos = glm::vec4(pos, 1.0f);
+  light.color = glm::vec4(1.0f);
+  light.attenuation = attenuation;
+  light.enabled = 1.0f;
+  return light;
+}
+
+static bool clusterHasLight(const LightClusters& clusters, uint32_t cluster, uint32_t light) {
+  const LightClusters::Cluster& c = clusters.clusters()[cluster];
+  const auto first = clusters.lightIndices().begin() + c.firstLight;
+  return find(first, first + c.numLights, light) != first + c.numLights;
+}
+
+BOOST_AUTO_TEST_SUITE(LightClustersTests)
+
+BOOST_AUTO_TEST_CASE(test_light_radius) {
+  // Full brightness attenuates to the cutoff at sqrt(255 / attenuation)
+  BOOST_CHECK_CLOSE(LightClusters::lightRadius(pointLight(glm::vec3(0.0f), 1.0f)), sqrt(255.0f), 1e-3);
+
+  Light black = pointLight(glm::vec3(0.0f), 1.0f);
+  black.color = glm::vec4(0.0f);
+  BOOST_CHECK_EQUAL(LightClusters::lightRadius(black), 0.0f);
+  BOOST_CHECK(isinf(LightClusters::lightRadius(pointLight(glm::vec3(0.0f), 0.0f))));
+}
+
+BOOST_AUTO_TEST_CASE(test_small_light_stays_in_few_clusters) {
+  const glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+  vector<Light> lights = { pointLight(glm::vec3(0.0f, 0.0f, -10.0f), 1.0e4f) };
+
+  LightClusters clusters;
+  clusters.build(lights, glm::mat4(1.0f), proj);
+
+  const uint32_t center = clusters.clusterIndex(glm::vec3(0.0f, 0.0f, -10.0f));
+  BOOST_CHECK(clusterHasLight(clusters, center, 0));
+  BOOST_CHECK(!clusterHasLight(clusters, clusters.clusterIndex(glm::vec3(0.0f, 0.0f, -50.0f)), 0));
+  BOOST_CHECK(!clusterHasLight(clusters, clusters.clusterIndex(glm::vec3(5.0f, 0.0f, -10.0f)), 0));
+  BOOST_CHECK_LT(clusters.lightIndices().size(), 16);
+}
+
+BOOST_AUTO_TEST_CASE(test_skips_disabled_and_offscreen_lights) {
+  const glm::mat4 proj = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
+  vector<Light> lights = { pointLight(glm::vec3(0.0f, 0.0f, -10.0f), 1.0e4f),
+                           pointLight(glm::vec3(0.0f, 0.0f, 10.0f), 1.0e4f) };
+  lights[0].enabled = 0.0f;
+
+  LightClusters clusters;
+  clusters.build(lights, glm::mat4(1.0f), proj);
+  BOOST_CHECK_EQUAL(clusters.lightIndices().size(), 0);
+  BOOST_CHECK_EQUAL(clusters.viewLights().size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_unattenuated_light_is_everywhere) {
+  const glm::mat4 proj = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
+  vector<Light> lights = { pointLight(glm::vec3(0.0f, 0.0f, 10.0f), 0.0f) };
+
+  LightClusters clusters;
+  clusters.build(lights, glm::mat4(1.0f), proj);
+  BOOST_CHECK_EQUAL(clusters.lightIndices().size(), LightClusters::NUM_CLUSTERS + 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_degenerate_projection_puts_lights_everywhere) {
+  vector<Light> lights = { pointLight(glm::vec3(0.0f, 0.0f, -10.0f), 1.0e4f) };
+
+  LightClusters clusters;
+  clusters.build(lights, glm::mat4(1.0f), glm::mat4(1.0f));
+  BOOST_CHECK_EQUAL(clusters.lightIndices().size(), LightClusters::NUM_CLUSTERS + 0);
+}
+
+// Any point a light reaches must be in a cluster with the light, for the same view and
+// projections the shaders see
+static void checkConservative(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& lo, const glm::vec3& hi) {
+  mt19937 rng(1234);
+  uniform_real_distribution<float> x(lo.x, hi.x), y(lo.y, hi.y), z(lo.z, hi.z);
+
+  vector<Light> lights;
+  for(size_t i = 0; i < 500; i++) {
+    lights.push_back(pointLight(glm::vec3(x(rng), y(rng), z(rng)), 1.0e3f * (1.0f + float(i % 7))));
+  }
+  LightClusters clusters;
+  clusters.build(lights, view, proj);
+
+  for(size_t p = 0; p < 2000; p++) {
+    const glm::vec4 world(x(rng), y(rng), z(rng), 1.0f);
+    const glm::vec4 viewPos = view * world;
+    const glm::vec4 clip = proj * viewPos;
+    if(clip.w <= 0.0f || glm::any(glm::greaterThan(glm::abs(glm::vec3(clip) / clip.w), glm::vec3(1.0f)))) {
+      continue;
+    }
+    const uint32_t cluster = clusters.clusterIndex(glm::vec3(viewPos));
+    for(uint32_t l = 0; l < lights.size(); l++) {
+      const Light& light = clusters.viewLights()[l];
+      if(glm::distance(glm::vec3(light.pos), glm::vec3(viewPos)) < light.radius) {
+        BOOST_REQUIRE(clusterHasLight(clusters, cluster, l));
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_perspective_clusters_are_conservative) {
+  const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  const glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 20.0f);
+  checkConservative(view, proj, glm::vec3(-5.0f, -2.0f, -10.0f), glm::vec3(5.0f, 3.0f, 5.0f));
+}
+
+BOOST_AUTO_TEST_CASE(test_orthographic_clusters_are_conservative) {
+  const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+  const glm::mat4 proj = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.0f, 20.0f);
+  checkConservative(view, proj, glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3(5.0f, 5.0f, 5.0f));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,183 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdio.h>
+
+#include <random>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+#include "utils/mipmap.h"
+
+using namespace std;
+using namespace utils;
+
+struct MipmapFixture {
+  mt19937 rng{1234};
+
+  vector<uint8_t> randomBytes(size_t n) {
+    uniform_int_distribution<int> dist(0, 255);
+    vector<uint8_t> ret(n);
+    for(auto i = ret.begin(); i != ret.end(); i++) {
+      *i = static_cast<uint8_t>(dist(rng));
+    }
+    return ret;
+  }
+
+  vector<uint16_t> randomShorts(size_t n) {
+    uniform_int_distribution<int> dist(0, 65535);
+    vector<uint16_t> ret(n);
+    for(auto i = ret.begin(); i != ret.end(); i++) {
+      *i = static_cast<uint16_t>(dist(rng));
+    }
+    return ret;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(MipmapTests, MipmapFixture)
+
+BOOST_AUTO_TEST_CASE(test_chain_length) {
+  BOOST_CHECK_EQUAL(MipChain::fullChainLength(1, 1), 1);
+  BOOST_CHECK_EQUAL(MipChain::fullChainLength(512, 512), 10);
+  BOOST_CHECK_EQUAL(MipChain::fullChainLength(512, 4), 10);
+  BOOST_CHECK_EQUAL(MipChain::fullChainLength(3, 5), 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_rgba8_matches_box_filter) {
+  const size_t w = 38, h = 10;
+  vector<uint8_t> src = randomBytes(w * h * 4);
+  vector<uint8_t> dst((w/2) * (h/2) * 4);
+  downsampleRGBA8(src.data(), w, h, dst.data());
+
+  for(size_t y = 0; y < h/2; y++) {
+    for(size_t x = 0; x < w/2; x++) {
+      for(size_t c = 0; c < 4; c++) {
+        const unsigned sum = src[((2*y)*w + 2*x)*4 + c] + src[((2*y)*w + 2*x+1)*4 + c] +
+                             src[((2*y+1)*w + 2*x)*4 + c] + src[((2*y+1)*w + 2*x+1)*4 + c];
+        BOOST_REQUIRE_EQUAL(dst[(y*(w/2) + x)*4 + c], (sum + 2) / 4);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_r16_min_and_max) {
+  const size_t w = 36, h = 6;
+  vector<uint16_t> src = randomShorts(w * h);
+  vector<uint16_t> dmin((w/2) * (h/2)), dmax((w/2) * (h/2));
+  downsampleR16(src.data(), w, h, dmin.data(), MipReduction::MIN);
+  downsampleR16(src.data(), w, h, dmax.data(), MipReduction::MAX);
+
+  for(size_t y = 0; y < h/2; y++) {
+    for(size_t x = 0; x < w/2; x++) {
+      const uint16_t block[4] = { src[(2*y)*w + 2*x], src[(2*y)*w + 2*x+1], src[(2*y+1)*w + 2*x], src[(2*y+1)*w + 2*x+1] };
+      BOOST_REQUIRE_EQUAL(dmin[y*(w/2) + x], *min_element(block, block+4));
+      BOOST_REQUIRE_EQUAL(dmax[y*(w/2) + x], *max_element(block, block+4));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_odd_sizes_clamp) {
+  const uint16_t src[3] = { 7, 3, 5 };
+  uint16_t dst[1];
+  downsampleR16(src, 3, 1, dst, MipReduction::MAX);
+  BOOST_CHECK_EQUAL(dst[0], 7);
+}
+
+BOOST_AUTO_TEST_CASE(test_generate_chain_reaches_one_texel) {
+  MipChain chain;
+  chain.width = 16;
+  chain.height = 8;
+  chain.bytesPerTexel = 2;
+  chain.levels.push_back(vector<uint8_t>(16 * 8 * 2, 0));
+  reinterpret_cast<uint16_t*>(chain.levels[0].data())[37] = 1000;
+
+  generateMipChain(chain, MipReduction::MAX);
+  BOOST_REQUIRE_EQUAL(chain.numLevels(), 5);
+  BOOST_CHECK_EQUAL(chain.levels.back().size(), 2);
+  BOOST_CHECK_EQUAL(reinterpret_cast<const uint16_t*>(chain.levels.back().data())[0], 1000);
+}
+
+BOOST_AUTO_TEST_CASE(test_hash_mirrored_images) {
+  MipChain a, b;
+  a.width = b.width = 5;
+  a.height = b.height = 3;
+  a.bytesPerTexel = b.bytesPerTexel = 4;
+  a.levels.push_back(randomBytes(5 * 3 * 4));
+
+  // b is a mirror image of a
+  b.levels.push_back(vector<uint8_t>(a.levels[0].size()));
+  for(size_t y = 0; y < 3; y++) {
+    for(size_t x = 0; x < 5; x++) {
+      for(size_t c = 0; c < 4; c++) {
+        b.levels[0][(y*5 + x)*4 + c] = a.levels[0][(y*5 + (4 - x))*4 + c];
+      }
+    }
+  }
+
+  BOOST_CHECK_EQUAL(hashImage(a, true), hashImage(b, false));
+  BOOST_CHECK_EQUAL(hashImage(a, false), hashImage(b, true));
+  BOOST_CHECK_NE(hashImage(a, false), hashImage(b, false));
+
+  // Mirroring holds for every seed, and the seed changes the hash
+  BOOST_CHECK_EQUAL(hashImage(a, true, 99), hashImage(b, false, 99));
+  BOOST_CHECK_NE(hashImage(a, false, 99), hashImage(a, false));
+
+  b.levels[0][7] ^= 1;
+  BOOST_CHECK_NE(hashImage(a, true), hashImage(b, false));
+}
+
+BOOST_AUTO_TEST_CASE(test_cache_roundtrip) {
+  MipChain chain;
+  chain.width = 8;
+  chain.height = 8;
+  chain.bytesPerTexel = 4;
+  chain.levels.push_back(randomBytes(8 * 8 * 4));
+  generateMipChain(chain, MipReduction::AVERAGE);
+
+  const string path = "test_mipmap_cache.mips";
+  BOOST_REQUIRE(writeMipCache(path, 100, chain));
+
+  MipChain read;
+  BOOST_REQUIRE(readMipCache(path, 100, read));
+  BOOST_CHECK_EQUAL(read.numLevels(), chain.numLevels());
+  for(size_t i = 0; i < chain.numLevels(); i++) {
+    BOOST_CHECK(read.levels[i] == chain.levels[i]);
+  }
+
+  // A newer source invalidates the cache, and so does one restored to an older time
+  BOOST_CHECK(!readMipCache(path, 200, read));
+  BOOST_CHECK(!readMipCache(path, 50, read));
+  remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_cache_rejects_corrupt_header) {
+  MipChain chain;
+  chain.width = 4;
+  chain.height = 4;
+  chain.bytesPerTexel = 4;
+  chain.levels.push_back(randomBytes(4 * 4 * 4));
+  generateMipChain(chain, MipReduction::AVERAGE);
+
+  const string path = "test_mipmap_corrupt.mips";
+  BOOST_REQUIRE(writeMipCache(path, 100, chain));
+
+  // Claim a huge image and a matching level count. The file is far too short for it.
+  {
+    fstream f(path.c_str(), ios::in | ios::out | ios::binary);
+    const uint32_t dims[2] = { 60000, 60000 };
+    const uint32_t levels = MipChain::fullChainLength(60000, 60000);
+    f.seekp(8);
+    f.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+    f.seekp(20);
+    f.write(reinterpret_cast<const char*>(&levels), sizeof(levels));
+  }
+
+  MipChain read;
+  BOOST_CHECK(!readMipCache(path, 100, read));
+  BOOST_CHECK_EQUAL(read.numLevels(), 0);
+  remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,56 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "utils/radix_sort.h"
+
+using namespace std;
+using namespace utils;
+
+BOOST_AUTO_TEST_SUITE(RadixSortTests)
+
+BOOST_AUTO_TEST_CASE(test_sort_is_stable) {
+  mt19937 rng(1234);
+  uniform_int_distribution<uint32_t> dist(0, 1000);
+
+  vector<uint32_t> keys(10000);
+  vector<size_t> values(keys.size());
+  for(size_t i = 0; i < keys.size(); i++) {
+    keys[i] = dist(rng) << 12; // Leave the low digits equal so their passes are skipped
+    values[i] = i;
+  }
+  vector<pair<uint32_t, size_t>> expected;
+  for(size_t i = 0; i < keys.size(); i++) {
+    expected.push_back(make_pair(keys[i], values[i]));
+  }
+  stable_sort(expected.begin(), expected.end(), [](const pair<uint32_t, size_t>& a, const pair<uint32_t, size_t>& b) {
+    return a.first < b.first;
+  });
+
+  radixSortByKey(keys, values);
+
+  for(size_t i = 0; i < keys.size(); i++) {
+    BOOST_REQUIRE_EQUAL(keys[i], expected[i].first);
+    BOOST_REQUIRE_EQUAL(values[i], expected[i].second);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_sort_64_bit_keys) {
+  vector<uint64_t> keys { 0xffffffff00000000ull, 3, 0x100000000ull, 0 };
+  vector<int> values { 3, 1, 2, 0 };
+  radixSortByKey(keys, values);
+  BOOST_CHECK(values == (vector<int> { 0, 1, 2, 3 }));
+}
+
+BOOST_AUTO_TEST_CASE(test_float_keys_keep_order) {
+  const vector<float> floats { -1e10f, -2.5f, -0.0f, 0.0f, 1e-20f, 0.5f, 3.0f, 1e10f };
+  for(size_t i = 1; i < floats.size(); i++) {
+    BOOST_CHECK_LE(sortableFloatKey(floats[i-1]), sortableFloatKey(floats[i]));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,105 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+#include "utils/range_allocator.h"
+
+using namespace std;
+using namespace utils;
+
+BOOST_AUTO_TEST_SUITE(RangeAllocatorTests)
+
+BOOST_AUTO_TEST_CASE(test_first_fit) {
+  RangeAllocator alloc(100);
+  BOOST_CHECK_EQUAL(alloc.allocate(30), 0);
+  BOOST_CHECK_EQUAL(alloc.allocate(30), 30);
+  BOOST_CHECK_EQUAL(alloc.allocate(30), 60);
+  BOOST_CHECK(alloc.allocate(30) == RangeAllocator::FAILED);
+  BOOST_CHECK_EQUAL(alloc.freeSpace(), 10);
+
+  // The hole left by the first range is reused before the end
+  alloc.free(0, 30);
+  BOOST_CHECK_EQUAL(alloc.allocate(20), 0);
+  BOOST_CHECK_EQUAL(alloc.allocate(10), 20);
+  BOOST_CHECK_EQUAL(alloc.allocate(10), 90);
+}
+
+BOOST_AUTO_TEST_CASE(test_free_merges_neighbours) {
+  RangeAllocator alloc(90);
+  const size_t a = alloc.allocate(30), b = alloc.allocate(30), c = alloc.allocate(30);
+
+  alloc.free(a, 30);
+  alloc.free(c, 30);
+  BOOST_CHECK_EQUAL(alloc.numFreeRanges(), 2);
+
+  // Freeing the middle joins all three into one range
+  alloc.free(b, 30);
+  BOOST_CHECK_EQUAL(alloc.numFreeRanges(), 1);
+  BOOST_CHECK_EQUAL(alloc.freeSpace(), 90);
+  BOOST_CHECK_EQUAL(alloc.allocate(90), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_double_free_throws) {
+  RangeAllocator alloc(100);
+  const size_t a = alloc.allocate(50);
+  alloc.free(a, 50);
+  BOOST_CHECK_THROW(alloc.free(a, 50), runtime_error);
+  BOOST_CHECK_THROW(alloc.free(90, 20), runtime_error);
+  BOOST_CHECK_EQUAL(alloc.freeSpace(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_grow_extends_last_free_range) {
+  RangeAllocator alloc(100);
+  alloc.allocate(80);
+  BOOST_CHECK(alloc.allocate(40) == RangeAllocator::FAILED);
+
+  alloc.grow(200);
+  BOOST_CHECK_EQUAL(alloc.capacity(), 200);
+  BOOST_CHECK_EQUAL(alloc.numFreeRanges(), 1);
+  BOOST_CHECK_EQUAL(alloc.allocate(40), 80);
+  BOOST_CHECK_THROW(alloc.grow(150), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_random_allocations_never_overlap) {
+  mt19937 rng(1234);
+  uniform_int_distribution<size_t> sizes(1, 64);
+
+  RangeAllocator alloc(4096);
+  vector<bool> used(alloc.capacity(), false);
+  vector<pair<size_t, size_t>> live;
+  for(size_t i = 0; i < 2000; i++) {
+    if(!live.empty() && rng() % 2 == 0) {
+      const size_t j = rng() % live.size();
+      alloc.free(live[j].first, live[j].second);
+      for(size_t k = live[j].first; k < live[j].first + live[j].second; k++) {
+        used[k] = false;
+      }
+      live[j] = live.back();
+      live.pop_back();
+    } else {
+      const size_t size = sizes(rng);
+      const size_t start = alloc.allocate(size);
+      if(start == RangeAllocator::FAILED) {
+        continue;
+      }
+      for(size_t k = start; k < start + size; k++) {
+        BOOST_REQUIRE(!used[k]);
+        used[k] = true;
+      }
+      live.push_back(make_pair(start, size));
+    }
+  }
+
+  for(auto r = live.begin(); r != live.end(); r++) {
+    alloc.free(r->first, r->second);
+  }
+  BOOST_CHECK_EQUAL(alloc.freeSpace(), alloc.capacity());
+  BOOST_CHECK_EQUAL(alloc.numFreeRanges(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,46 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include "utils/shader_defines.h"
+
+using namespace std;
+using namespace utils;
+
+BOOST_AUTO_TEST_SUITE(ShaderDefinesTests)
+
+BOOST_AUTO_TEST_CASE(test_key_ignores_order) {
+  ShaderDefines a, b;
+  a.define("STD_INDIRECT_DRAW").define("STD_NUM_LIGHTS", 4);
+  b.define("STD_NUM_LIGHTS", 4).define("STD_INDIRECT_DRAW");
+  BOOST_CHECK(a == b);
+  BOOST_CHECK_EQUAL(a.key(), b.key());
+
+  // The value is part of the key
+  b.define("STD_NUM_LIGHTS", 5);
+  BOOST_CHECK(a != b);
+  BOOST_CHECK_NE(a.key(), b.key());
+}
+
+BOOST_AUTO_TEST_CASE(test_parses_builder_defines) {
+  const ShaderDefines defines(vector<string>{ "WALL_OIT", "STD_NUM_LIGHTS 3" });
+  BOOST_CHECK(defines.defined("WALL_OIT"));
+  BOOST_CHECK(defines.defined("STD_NUM_LIGHTS"));
+  BOOST_CHECK((defines.list() == vector<string>{ "STD_NUM_LIGHTS 3", "WALL_OIT" }));
+  BOOST_CHECK_THROW(ShaderDefines(vector<string>{ " " }), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_enable_toggles) {
+  ShaderDefines defines;
+  defines.enable("WALL_INSTANCED", true);
+  BOOST_CHECK(defines.defined("WALL_INSTANCED"));
+  defines.enable("WALL_INSTANCED", false);
+  BOOST_CHECK(!defines.defined("WALL_INSTANCED"));
+  BOOST_CHECK_EQUAL(defines.size(), 0);
+  BOOST_CHECK(defines == ShaderDefines());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,47 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+
+#include "utils/thread_pool.h"
+
+using namespace std;
+using namespace utils;
+
+BOOST_AUTO_TEST_SUITE(ThreadPoolTests)
+
+BOOST_AUTO_TEST_CASE(test_submit_returns_result) {
+  ThreadPool pool(2);
+  auto f = pool.submit([] { return 42; });
+  BOOST_CHECK_EQUAL(f.get(), 42);
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_for_visits_each_index_once) {
+  ThreadPool pool(3);
+  for(size_t n : { 0, 1, 2, 7, 1000 }) {
+    vector<atomic<int>> visits(n);
+    for(auto i = visits.begin(); i != visits.end(); i++) {
+      *i = 0;
+    }
+
+    pool.parallelFor(0, n, [&](size_t i) { visits[i]++; });
+
+    for(size_t i = 0; i < n; i++) {
+      BOOST_REQUIRE_EQUAL(visits[i], 1);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_for_rethrows) {
+  ThreadPool pool(4);
+  BOOST_CHECK_THROW(pool.parallelFor(0, 100, [](size_t i) {
+    if(i == 57) {
+      throw runtime_error("failed");
+    }
+  }), runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -15,6 +15,7 @@ class BasicGLWindow : public detail::SDLGLWindow {
 	}
 
 	void draw(SDLGLWindow& w) {
+		mRenderer->startFrame();
 		onDraw(*mRenderer);
 	}
 
@@ -11,6 +11,9 @@
 #include <functional>
 #include <iterator>
 #include <vector>
+#include <unordered_map>
+
+#include "utils/gl_program_reflection.h"
 
 #ifndef PROGRAM_BUILDER_H_
 #define PROGRAM_BUILDER_H_
@@ -29,6 +32,7 @@ struct GLProgramBuilder {
 		if (!logLinkStatus(program))
 			std::runtime_error("Failed to link shaders");
 		glDeleteShader(compute_shader);
+		reflect(program);
 
 		return program;
 	}
@@ -44,15 +48,21 @@ struct GLProgramBuilder {
 		if (!logLinkStatus(program))
 			std::runtime_error("Failed to link shaders");
 		glDeleteShader(compute_shader);
+		reflect(program);
 
 		return program;
 	}
 
-	GLuint buildFromFiles(const std::string& vert, const std::string& frag) {
+	/*
+	 * Build a program from a vertex and a fragment shader. Each of defines is defined at the
+	 * top of both shaders, as "NAME" or "NAME VALUE".
+	 */
+	GLuint buildFromFiles(const std::string& vert, const std::string& frag,
+	                      const std::vector<std::string>& defines = std::vector<std::string>()) {
 		GLuint program = glCreateProgram();
 
-		GLuint vert_shader = compileFromFile(GL_VERTEX_SHADER, vert);
-		GLuint frag_shader = compileFromFile(GL_FRAGMENT_SHADER, frag);
+		GLuint vert_shader = compileFromFile(GL_VERTEX_SHADER, vert, defines);
+		GLuint frag_shader = compileFromFile(GL_FRAGMENT_SHADER, frag, defines);
 
 		glAttachShader(program, vert_shader);
 		glAttachShader(program, frag_shader);
@@ -62,14 +72,16 @@ struct GLProgramBuilder {
 			std::runtime_error("Failed to link shaders");
 		glDeleteShader(vert_shader);
 		glDeleteShader(frag_shader);
+		reflect(program);
 
 		return program;
 	}
 
-	GLuint buildFromStrings(const std::string& vert, const std::string& frag) {
+	GLuint buildFromStrings(const std::string& vert, const std::string& frag,
+	                        const std::vector<std::string>& defines = std::vector<std::string>()) {
 		GLuint program = glCreateProgram();
-		GLuint vert_shader = compile(GL_VERTEX_SHADER, vert);
-		GLuint frag_shader = compile(GL_FRAGMENT_SHADER, frag);
+		GLuint vert_shader = compile(GL_VERTEX_SHADER, vert, defines);
+		GLuint frag_shader = compile(GL_FRAGMENT_SHADER, frag, defines);
 		glAttachShader(program, vert_shader);
 		glAttachShader(program, frag_shader);
 		glLinkProgram(program);
@@ -77,9 +89,22 @@ struct GLProgramBuilder {
 		logLinkStatus(program);
 		glDeleteShader(vert_shader);
 		glDeleteShader(frag_shader);
+		reflect(program);
 		return program;
 	}
 
+	/*
+	 * The uniforms and uniform blocks of a program built by this builder, enumerated when it
+	 * was linked
+	 */
+	const GLProgramReflection& reflection(GLuint program) const {
+		auto r = reflections.find(program);
+		if(r == reflections.end()) {
+			throw std::runtime_error("No reflection for a program which wasn't built by this GLProgramBuilder");
+		}
+		return r->second;
+	}
+
 	void addIncludeDir(const std::string& dir) {
 		includeDirs.push_back(dir);
 	}
@@ -91,8 +116,41 @@ struct GLProgramBuilder {
 private:
 	std::vector<std::string> includeDirs;
 
-	std::string preprocess(const std::string& input) {
-		std::string res = std::string("#version 330\n");
+	// The reflection of every program built, by program name
+	std::unordered_map<GLuint, GLProgramReflection> reflections;
+
+	void reflect(GLuint program) {
+		reflections[program] = GLProgramReflection(program);
+	}
+
+	/*
+	 * The GLSL version requested by a #version directive in input, or 330 if there is none.
+	 * Shaders are written against 330 unless they need a newer feature such as compute
+	 * shaders or storage buffers, in which case they ask for 430.
+	 */
+	static std::string shaderVersion(const std::string& input) {
+		std::istringstream iss(input);
+		for(std::string line; std::getline(iss, line); ) {
+			std::istringstream buf(line);
+			std::string directive, version;
+			if(buf >> directive >> version && directive == "#version") {
+				if(version != "330" && version != "430") {
+					std::ostringstream err;
+					err << "Error: Invalid version " << version <<
+							". Shaders must be compiled with a 330 or 430 context.";
+					throw std::runtime_error(err.str());
+				}
+				return version;
+			}
+		}
+		return "330";
+	}
+
+	std::string preprocess(const std::string& input, const std::vector<std::string>& defines) {
+		std::string res = std::string("#version ") + shaderVersion(input) + std::string("\n");
+		for(auto d = defines.begin(); d != defines.end(); d++) {
+			res = res.append(std::string("#define ") + *d + std::string("\n"));
+		}
 		std::istringstream iss(input);
 		for(std::string line; std::getline(iss, line); ) {
 			// Copy original line to alter it
@@ -132,15 +190,9 @@ private:
 						continue;
 					}
 				}
+				// The version has already been emitted by shaderVersion
 				if(tokens[0] == "#version") {
-					if(tokens[1] != "330") {
-						std::ostringstream err;
-						err << "Error: Invalid version " << tokens[1] <<
-								". Compiling shader with " << "330" << " context.";
-						throw std::runtime_error(err.str());
-					} else {
-						continue;
-					}
+					continue;
 				}
 			}
 			line.append(std::string("\n"));
@@ -166,8 +218,9 @@ private:
 		return "";
 	}
 
-	GLuint compile(const GLenum type, const std::string& src) {
-		std::string s = preprocess(src);
+	GLuint compile(const GLenum type, const std::string& src,
+	               const std::vector<std::string>& defines = std::vector<std::string>()) {
+		std::string s = preprocess(src, defines);
 
 		GLuint shader = glCreateShader(type);
 		const GLchar* source = s.c_str();
@@ -183,11 +236,12 @@ private:
 		return shader;
 	}
 
-	GLuint compileFromFile(const GLenum type, const std::string& file_path) {
+	GLuint compileFromFile(const GLenum type, const std::string& file_path,
+	                       const std::vector<std::string>& defines = std::vector<std::string>()) {
 		fprintf(stdout, "Reading %s: %s\n", shaderTypeAsString(type).c_str(), file_path.c_str());
 
 		std::string src = readFileToString(file_path);
-		return compile(type, src);
+		return compile(type, src, defines);
 	}
 
 	static GLint logCompileStatus(const GLuint shader_id, const GLenum type) {
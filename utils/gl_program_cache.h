@@ -0,0 +1,71 @@
+#include <GL/glew.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "utils/gl_program_builder.h"
+#include "utils/shader_defines.h"
+
+#ifndef UTILS_GL_PROGRAM_CACHE_H_
+#define UTILS_GL_PROGRAM_CACHE_H_
+
+namespace utils {
+
+/*
+ * Builds specialized variants of programs the first time they are asked for, and hands out
+ * the same program for the same shaders and defines after that. Code which picks a variant for
+ * every draw can ask for it every draw, since only the first request compiles anything.
+ *
+ * Programs are built with the given GLProgramBuilder, so its include directories apply and
+ * their reflections can be looked up from it. The cache deletes its programs when it is
+ * destroyed, and the builder must outlive it.
+ */
+class GLProgramCache {
+	GLProgramBuilder& mBuilder;
+
+	// Every program built, by its shaders and the key of its defines
+	std::unordered_map<std::string, GLuint> mPrograms;
+
+	static std::string key(const std::string& vert, const std::string& frag, const ShaderDefines& defines) {
+		// Paths can't contain a NUL, so the parts can't run into each other
+		return vert + '\0' + frag + '\0' + defines.key();
+	}
+
+public:
+	explicit GLProgramCache(GLProgramBuilder& builder) : mBuilder(builder) {}
+
+	GLProgramCache(const GLProgramCache&) = delete;
+	GLProgramCache& operator=(const GLProgramCache&) = delete;
+
+	~GLProgramCache() {
+		for(auto p = mPrograms.begin(); p != mPrograms.end(); p++) {
+			glDeleteProgram(p->second);
+		}
+	}
+
+	/*
+	 * The program made of the vertex shader file vert and the fragment shader file frag, both
+	 * compiled with defines
+	 */
+	GLuint program(const std::string& vert, const std::string& frag, const ShaderDefines& defines = ShaderDefines()) {
+		const std::string k = key(vert, frag, defines);
+		auto p = mPrograms.find(k);
+		if(p == mPrograms.end()) {
+			p = mPrograms.insert(std::make_pair(k, mBuilder.buildFromFiles(vert, frag, defines.list()))).first;
+		}
+		return p->second;
+	}
+
+	const GLProgramReflection& reflection(GLuint program) const {
+		return mBuilder.reflection(program);
+	}
+
+	// The number of variants built so far
+	size_t size() const {
+		return mPrograms.size();
+	}
+};
+
+}
+
+#endif /* UTILS_GL_PROGRAM_CACHE_H_ */
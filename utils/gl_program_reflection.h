@@ -0,0 +1,287 @@
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#ifndef UTILS_GL_PROGRAM_REFLECTION_H_
+#define UTILS_GL_PROGRAM_REFLECTION_H_
+
+namespace utils {
+
+namespace detail {
+
+inline bool isSamplerType(GLenum type) {
+	switch(type) {
+	case GL_SAMPLER_1D:
+	case GL_SAMPLER_2D:
+	case GL_SAMPLER_3D:
+	case GL_SAMPLER_CUBE:
+	case GL_SAMPLER_2D_SHADOW:
+	case GL_SAMPLER_2D_ARRAY:
+	case GL_SAMPLER_2D_MULTISAMPLE:
+	case GL_SAMPLER_BUFFER:
+	case GL_INT_SAMPLER_2D:
+	case GL_INT_SAMPLER_2D_ARRAY:
+	case GL_INT_SAMPLER_BUFFER:
+	case GL_UNSIGNED_INT_SAMPLER_2D:
+	case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+	case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * How to check and set a uniform of C++ type T. Samplers and bools are set as ints.
+ */
+template <class T>
+struct GLUniformTraits;
+
+template <>
+struct GLUniformTraits<GLint> {
+	static bool matches(GLenum type) {
+		return type == GL_INT || type == GL_BOOL || isSamplerType(type);
+	}
+	static void set(GLint location, const GLint& value) {
+		glUniform1i(location, value);
+	}
+};
+
+template <>
+struct GLUniformTraits<GLuint> {
+	static bool matches(GLenum type) {
+		return type == GL_UNSIGNED_INT;
+	}
+	static void set(GLint location, const GLuint& value) {
+		glUniform1ui(location, value);
+	}
+};
+
+template <>
+struct GLUniformTraits<GLfloat> {
+	static bool matches(GLenum type) {
+		return type == GL_FLOAT;
+	}
+	static void set(GLint location, const GLfloat& value) {
+		glUniform1f(location, value);
+	}
+};
+
+template <>
+struct GLUniformTraits<glm::vec2> {
+	static bool matches(GLenum type) {
+		return type == GL_FLOAT_VEC2;
+	}
+	static void set(GLint location, const glm::vec2& value) {
+		glUniform2fv(location, 1, glm::value_ptr(value));
+	}
+};
+
+template <>
+struct GLUniformTraits<glm::vec3> {
+	static bool matches(GLenum type) {
+		return type == GL_FLOAT_VEC3;
+	}
+	static void set(GLint location, const glm::vec3& value) {
+		glUniform3fv(location, 1, glm::value_ptr(value));
+	}
+};
+
+template <>
+struct GLUniformTraits<glm::vec4> {
+	static bool matches(GLenum type) {
+		return type == GL_FLOAT_VEC4;
+	}
+	static void set(GLint location, const glm::vec4& value) {
+		glUniform4fv(location, 1, glm::value_ptr(value));
+	}
+};
+
+template <>
+struct GLUniformTraits<glm::mat3> {
+	static bool matches(GLenum type) {
+		return type == GL_FLOAT_MAT3;
+	}
+	static void set(GLint location, const glm::mat3& value) {
+		glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+};
+
+template <>
+struct GLUniformTraits<glm::mat4> {
+	static bool matches(GLenum type) {
+		return type == GL_FLOAT_MAT4;
+	}
+	static void set(GLint location, const glm::mat4& value) {
+		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+};
+
+}
+
+/*
+ * A handle to a uniform of type T of one program, resolved once by GLProgramReflection.
+ * Setting it affects the program currently in use, which must be the program it came from.
+ * Handles to uniforms the program doesn't use are inactive, and setting them does nothing,
+ * just as with glUniform and location -1.
+ */
+template <class T>
+class GLUniform {
+	GLint mLocation = -1;
+
+public:
+	GLUniform() = default;
+
+	explicit GLUniform(GLint location) : mLocation(location) {}
+
+	void set(const T& value) const {
+		if(mLocation >= 0) {
+			detail::GLUniformTraits<T>::set(mLocation, value);
+		}
+	}
+
+	GLint location() const {
+		return mLocation;
+	}
+
+	bool isActive() const {
+		return mLocation >= 0;
+	}
+};
+
+/*
+ * The active uniforms and uniform blocks of a linked program, enumerated once when it is
+ * constructed. Uniforms which are members of blocks are set through the block's buffer, so
+ * only the default block's uniforms are listed. Arrays are listed by their name without the
+ * trailing "[0]". Shader storage blocks are only listed on OpenGL 4.3, which can query them.
+ */
+class GLProgramReflection {
+public:
+	struct Uniform {
+		GLint location;
+		GLenum type;
+		GLint size; // The number of elements of an array
+	};
+
+	struct Block {
+		GLuint index;
+		GLint dataSize; // In bytes
+	};
+
+private:
+	GLuint mProgram = 0;
+	std::unordered_map<std::string, Uniform> mUniforms;
+	std::unordered_map<std::string, Block> mBlocks;
+	std::unordered_map<std::string, GLuint> mStorageBlocks;
+
+public:
+	GLProgramReflection() = default;
+
+	explicit GLProgramReflection(GLuint program) : mProgram(program) {
+		GLint numUniforms = 0, maxNameLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+		std::vector<GLchar> name(maxNameLength + 1);
+		for(GLint i = 0; i < numUniforms; i++) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, i, name.size(), &length, &size, &type, name.data());
+			std::string uniformName(name.data(), length);
+
+			const GLint location = glGetUniformLocation(program, uniformName.c_str());
+			if(location < 0) {
+				continue; // In a block
+			}
+			if(uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0) {
+				uniformName.resize(uniformName.size() - 3);
+			}
+			mUniforms[uniformName] = Uniform{ location, type, size };
+		}
+
+		GLint numBlocks = 0;
+		maxNameLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxNameLength);
+		name.resize(maxNameLength + 1);
+		for(GLint i = 0; i < numBlocks; i++) {
+			GLsizei length = 0;
+			GLint dataSize = 0;
+			glGetActiveUniformBlockName(program, i, name.size(), &length, name.data());
+			glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+			mBlocks[std::string(name.data(), length)] = Block{ static_cast<GLuint>(i), dataSize };
+		}
+
+		if(GLEW_VERSION_4_3) {
+			GLint numStorageBlocks = 0;
+			maxNameLength = 0;
+			glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &numStorageBlocks);
+			glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_MAX_NAME_LENGTH, &maxNameLength);
+			name.resize(maxNameLength + 1);
+			for(GLint i = 0; i < numStorageBlocks; i++) {
+				GLsizei length = 0;
+				glGetProgramResourceName(program, GL_SHADER_STORAGE_BLOCK, i, name.size(), &length, name.data());
+				mStorageBlocks[std::string(name.data(), length)] = static_cast<GLuint>(i);
+			}
+		}
+	}
+
+	GLuint program() const {
+		return mProgram;
+	}
+
+	bool hasUniform(const std::string& name) const {
+		return mUniforms.find(name) != mUniforms.end();
+	}
+
+	const std::unordered_map<std::string, Uniform>& uniforms() const {
+		return mUniforms;
+	}
+
+	const std::unordered_map<std::string, Block>& blocks() const {
+		return mBlocks;
+	}
+
+	/*
+	 * A handle to the uniform called name, which is inactive if the program doesn't use it.
+	 * Throws if the uniform is declared with a type which doesn't match T.
+	 */
+	template <class T>
+	GLUniform<T> uniform(const std::string& name) const {
+		auto u = mUniforms.find(name);
+		if(u == mUniforms.end()) {
+			return GLUniform<T>();
+		}
+		if(!detail::GLUniformTraits<T>::matches(u->second.type)) {
+			throw std::runtime_error(std::string("Uniform ") + name + std::string(" is set with the wrong type"));
+		}
+		return GLUniform<T>(u->second.location);
+	}
+
+	/*
+	 * The index of the uniform block called name, or GL_INVALID_INDEX if the program has none
+	 */
+	GLuint blockIndex(const std::string& name) const {
+		auto b = mBlocks.find(name);
+		return b == mBlocks.end() ? GL_INVALID_INDEX : b->second.index;
+	}
+
+	/*
+	 * The index of the shader storage block called name, or GL_INVALID_INDEX if the program
+	 * has none
+	 */
+	GLuint storageBlockIndex(const std::string& name) const {
+		auto b = mStorageBlocks.find(name);
+		return b == mStorageBlocks.end() ? GL_INVALID_INDEX : b->second;
+	}
+};
+
+}
+
+#endif /* UTILS_GL_PROGRAM_REFLECTION_H_ */
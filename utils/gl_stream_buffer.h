@@ -0,0 +1,192 @@
+#include <GL/glew.h>
+#include <string.h>
+
+#include <array>
+#include <stdexcept>
+
+#ifndef UTILS_GL_STREAM_BUFFER_H_
+#define UTILS_GL_STREAM_BUFFER_H_
+
+namespace utils {
+
+/*
+ * A ring buffer for data which is written by the CPU, read by the GPU a few times and then
+ * thrown away, such as per-frame uniforms, draw commands and re-sorted indices. The ring is
+ * split into NUM_SEGMENTS segments. A fence is inserted when writing moves on from a segment,
+ * and writing only comes back to a segment once its fence has signaled, so writes never wait
+ * for the GPU unless it is a whole ring behind.
+ *
+ * With OpenGL 4.4 or ARB_buffer_storage the buffer is mapped once, persistently and
+ * coherently, and writes are plain copies. Otherwise each write maps its range unsynchronized,
+ * which the fences make safe.
+ *
+ * Data written may only be read by GL commands issued while its segment is the one being
+ * written, since the segment's fence only covers those. Data which is read for longer, such as
+ * per-frame uniforms, must be written again when segment() changes. Several writes read by
+ * the same command can be kept in one segment by reserving room for all of them first. A
+ * write too big for a segment replaces the buffer with a bigger one, which also changes
+ * segment().
+ */
+class GLStreamBuffer {
+public:
+	static const size_t NUM_SEGMENTS = 3;
+
+	// Segments start at multiples of this, which covers every offset alignment GL asks for
+	static const size_t SEGMENT_ALIGNMENT = 256;
+
+	// Where a write went. The buffer changes if the ring has to grow.
+	struct Range {
+		GLuint buffer;
+		size_t offset;
+	};
+
+private:
+	GLuint mBuffer = 0;
+	size_t mSegmentSize = 0;
+	size_t mSegment = 0;
+	size_t mSegmentsStarted = 0;
+	size_t mHead = 0;
+	char* mMapped = nullptr;
+	std::array<GLsync, NUM_SEGMENTS> mFences;
+
+	static size_t alignUp(size_t offset, size_t alignment) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	static void waitFor(GLsync& fence) {
+		if(fence == 0) {
+			return;
+		}
+		while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	void allocate(size_t segmentSize) {
+		mSegmentSize = alignUp(segmentSize, SEGMENT_ALIGNMENT);
+		mSegment = 0;
+		mHead = 0;
+		mFences.fill(0);
+
+		const size_t size = mSegmentSize * NUM_SEGMENTS;
+		glGenBuffers(1, &mBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+		if(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+			mMapped = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+		} else {
+			glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	void release() {
+		for(auto f = mFences.begin(); f != mFences.end(); f++) {
+			if(*f != 0) {
+				glDeleteSync(*f);
+				*f = 0;
+			}
+		}
+
+		// Deleting the buffer unmaps it. Commands already issued which read it still see it.
+		glDeleteBuffers(1, &mBuffer);
+		mBuffer = 0;
+		mMapped = nullptr;
+	}
+
+	/*
+	 * Fence the current segment and start writing at the beginning of the next, once the GPU
+	 * has finished with it
+	 */
+	void nextSegment() {
+		mFences[mSegment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		mSegment = (mSegment + 1) % NUM_SEGMENTS;
+		mSegmentsStarted++;
+		waitFor(mFences[mSegment]);
+		mHead = mSegment * mSegmentSize;
+	}
+
+public:
+	explicit GLStreamBuffer(size_t segmentSize) {
+		allocate(segmentSize);
+	}
+
+	GLStreamBuffer(const GLStreamBuffer&) = delete;
+	GLStreamBuffer& operator=(const GLStreamBuffer&) = delete;
+
+	~GLStreamBuffer() {
+		release();
+	}
+
+	/*
+	 * Make sure the next size bytes of writes go in the current segment, moving on to the next
+	 * segment now if they wouldn't fit. Every write may need up to its alignment in padding.
+	 */
+	void reserve(size_t size) {
+		if(size > mSegmentSize) {
+			// Everything issued so far has its own reference to the old buffer
+			release();
+			allocate(size * 2);
+			mSegmentsStarted++;
+		}
+		if(mHead + size > (mSegment + 1) * mSegmentSize) {
+			nextSegment();
+		}
+	}
+
+	/*
+	 * Copy size bytes of data into the ring at a multiple of alignment, which must divide
+	 * SEGMENT_ALIGNMENT
+	 */
+	Range write(const void* data, size_t size, size_t alignment = 4) {
+		reserve(alignUp(mHead, alignment) - mHead + size);
+		const size_t offset = alignUp(mHead, alignment);
+
+		if(mMapped != nullptr) {
+			memcpy(mMapped + offset, data, size);
+		} else if(size > 0) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+			void* dst = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+			                             GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+			memcpy(dst, data, size);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		mHead = offset + size;
+		return Range{ mBuffer, offset };
+	}
+
+	/*
+	 * Write size bytes of data and copy them to offset in buffer on the GPU. The copy is
+	 * ordered with the commands around it, so this updates a buffer the GPU may still be reading
+	 * without waiting for it.
+	 */
+	void copyTo(GLuint buffer, size_t offset, const void* data, size_t size) {
+		if(size == 0) {
+			return;
+		}
+		const Range range = write(data, size);
+		glBindBuffer(GL_COPY_READ_BUFFER, range.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, range.offset, offset, size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	/*
+	 * Changes whenever writing moves on to a new segment
+	 */
+	size_t segment() const {
+		return mSegmentsStarted;
+	}
+
+	bool persistentlyMapped() const {
+		return mMapped != nullptr;
+	}
+};
+
+}
+
+#endif /* UTILS_GL_STREAM_BUFFER_H_ */
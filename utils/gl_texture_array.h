@@ -0,0 +1,216 @@
+#include <GL/glew.h>
+
+#include <stdexcept>
+#include <algorithm>
+
+#ifndef UTILS_GL_TEXTURE_ARRAY_H_
+#define UTILS_GL_TEXTURE_ARRAY_H_
+
+namespace utils {
+
+/*
+ * Returns the number of bytes used by one texel of a sized internal format
+ */
+inline size_t bytesPerTexel(GLenum internalFormat) {
+	switch(internalFormat) {
+	case GL_R8:
+		return 1;
+	case GL_R16:
+	case GL_R16F:
+	case GL_RG8:
+		return 2;
+	case GL_RGB8:
+	case GL_SRGB8:
+		return 3;
+	case GL_RGBA8:
+	case GL_SRGB8_ALPHA8:
+	case GL_R32F:
+	case GL_RG16:
+		return 4;
+	case GL_RGBA16F:
+		return 8;
+	case GL_RGBA32F:
+		return 16;
+	default:
+		throw std::runtime_error("bytesPerTexel: unsupported internal format");
+	}
+}
+
+/*
+ * A GL_TEXTURE_2D_ARRAY with a fixed internal format and layer size which can grow.
+ * Storage is immutable, so growing allocates a new texture and copies the existing layers
+ * into it, with glCopyImageSubData where the GL has it and framebuffer blits otherwise.
+ * Layers are appended to the end of the array, and the array grows by at least batchSize
+ * layers at a time when it runs out of space.
+ */
+class GLTextureArray {
+	GLuint mTexture = 0;
+	GLenum mFormat;
+	size_t mWidth, mHeight, mLevels;
+	size_t mBatchSize;
+	size_t mSize = 0;
+	size_t mCapacity = 0;
+
+	GLuint allocate(size_t layers) const {
+		GLuint tex;
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, mLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, mLevels - 1);
+
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, mLevels, mFormat, mWidth, mHeight, layers);
+		return tex;
+	}
+
+	/*
+	 * Copy the layers in use from one array to another with framebuffer blits, one per layer
+	 * and level, for GLs without glCopyImageSubData. Every format the arrays are made with is
+	 * color renderable in OpenGL 3.3.
+	 */
+	void blitLayers(GLuint from, GLuint to) const {
+		GLint readFramebuffer, drawFramebuffer;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+
+		GLuint framebuffers[2];
+		glGenFramebuffers(2, framebuffers);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+
+		for(size_t level = 0; level < mLevels; level++) {
+			const GLint w = std::max<size_t>(mWidth >> level, 1), h = std::max<size_t>(mHeight >> level, 1);
+			for(size_t layer = 0; layer < mSize; layer++) {
+				glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, from, level, layer);
+				glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, to, level, layer);
+				glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			}
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+		glDeleteFramebuffers(2, framebuffers);
+	}
+
+public:
+	GLTextureArray(GLenum internalFormat, size_t w, size_t h, size_t levels = 1, size_t batchSize = 16) :
+		mFormat(internalFormat), mWidth(w), mHeight(h), mLevels(levels), mBatchSize(batchSize) {}
+
+	GLTextureArray(const GLTextureArray&) = delete;
+	GLTextureArray& operator=(const GLTextureArray&) = delete;
+
+	~GLTextureArray() {
+		if(mTexture != 0) {
+			glDeleteTextures(1, &mTexture);
+		}
+	}
+
+	/*
+	 * Make room for at least n layers. Existing layers are preserved.
+	 */
+	void reserve(size_t n) {
+		if(n <= mCapacity) {
+			return;
+		}
+
+		GLuint tex = allocate(n);
+		if(mTexture != 0) {
+			if(GLEW_VERSION_4_3 || GLEW_ARB_copy_image) {
+				for(size_t level = 0; level < mLevels && mSize > 0; level++) {
+					glCopyImageSubData(
+							mTexture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+							tex, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+							std::max<size_t>(mWidth >> level, 1), std::max<size_t>(mHeight >> level, 1), mSize);
+				}
+			} else {
+				blitLayers(mTexture, tex);
+			}
+			glDeleteTextures(1, &mTexture);
+		}
+		mTexture = tex;
+		mCapacity = n;
+	}
+
+	/*
+	 * Upload one mip level of a layer. format and type describe the pixel data.
+	 */
+	void upload(size_t layer, size_t level, GLenum format, GLenum type, const void* data) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, mTexture);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY,
+				level, // Mipmap level
+				0, 0, layer, // x-offset, y-offset, z-offset
+				std::max<size_t>(mWidth >> level, 1), std::max<size_t>(mHeight >> level, 1), 1, // width, height, depth
+				format, type, data);
+	}
+
+	/*
+	 * Add a new layer at the end of the array, growing it by a batch if it is full.
+	 * Returns the index of the new layer. The layer's contents are undefined until uploaded.
+	 */
+	size_t append() {
+		if(mSize == mCapacity) {
+			reserve(mCapacity + mBatchSize);
+		}
+		return mSize++;
+	}
+
+	/*
+	 * Forget all layers but keep the storage around for reuse
+	 */
+	void clear() {
+		mSize = 0;
+	}
+
+	GLuint id() const {
+		return mTexture;
+	}
+
+	size_t size() const {
+		return mSize;
+	}
+
+	size_t capacity() const {
+		return mCapacity;
+	}
+
+	size_t levels() const {
+		return mLevels;
+	}
+
+	size_t width() const {
+		return mWidth;
+	}
+
+	size_t height() const {
+		return mHeight;
+	}
+
+	GLenum format() const {
+		return mFormat;
+	}
+
+	/*
+	 * The number of bytes of GPU memory used by one layer including its mip levels
+	 */
+	size_t bytesPerLayer() const {
+		size_t bytes = 0;
+		for(size_t level = 0; level < mLevels; level++) {
+			bytes += std::max<size_t>(mWidth >> level, 1) * std::max<size_t>(mHeight >> level, 1);
+		}
+		return bytes * bytesPerTexel(mFormat);
+	}
+
+	/*
+	 * The number of bytes of GPU memory allocated for the array
+	 */
+	size_t allocatedBytes() const {
+		return bytesPerLayer() * mCapacity;
+	}
+};
+
+}
+
+#endif /* UTILS_GL_TEXTURE_ARRAY_H_ */
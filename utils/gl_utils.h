@@ -25,4 +25,31 @@ void check_SDL_error(int line = -1);
 #define check_gl_error()
 #endif
 
+namespace utils {
+
+/*
+ * Binds no vertex array while it is alive, and rebinds the vertex array which was bound
+ * before when it goes out of scope. Code which sets up vertex arrays or binds element buffers
+ * outside of Renderer uses it, so it neither changes the vertex array Renderer last drew with
+ * nor leaves a different one bound.
+ */
+class ScopedVertexArrayUnbind {
+  GLint mPrevious = 0;
+
+public:
+  ScopedVertexArrayUnbind() {
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &mPrevious);
+    glBindVertexArray(0);
+  }
+
+  ScopedVertexArrayUnbind(const ScopedVertexArrayUnbind&) = delete;
+  ScopedVertexArrayUnbind& operator=(const ScopedVertexArrayUnbind&) = delete;
+
+  ~ScopedVertexArrayUnbind() {
+    glBindVertexArray(mPrevious);
+  }
+};
+
+}
+
 #endif /* GL_HELPER_H_ */
@@ -86,6 +86,7 @@ class InteractiveGLWindow : public detail::SDLGLWindow {
 	}
 
 	void draw(SDLGLWindow& w) {
+		mRenderer->startFrame();
 		onDraw(*mRenderer);
 	}
 
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mipmap.h"
+
+using namespace std;
+
+namespace utils {
+
+namespace {
+
+const char MIP_CACHE_MAGIC[4] = { 'M', 'I', 'P', 'S' };
+const uint32_t MIP_CACHE_VERSION = 1;
+
+// Larger than any texture GL will make, so larger headers can only come from corrupt caches
+const uint32_t MAX_MIP_CACHE_DIMENSION = 1 << 16;
+
+struct MipCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bytesPerTexel;
+  uint32_t numLevels;
+  int64_t sourceMTime;
+};
+
+// Scalar 2x2 reduction of the texels in [x0, dstW) of one destination row. Texel coordinates
+// are clamped so odd sized and 1 pixel wide/tall images are handled.
+void downsampleRowRGBA8(const uint8_t* r0, const uint8_t* r1, size_t w, size_t x0, size_t dstW, uint8_t* dst) {
+  for(size_t x = x0; x < dstW; x++) {
+    const size_t xa = min(2*x, w-1), xb = min(2*x+1, w-1);
+    for(size_t c = 0; c < 4; c++) {
+      const unsigned sum = r0[xa*4+c] + r0[xb*4+c] + r1[xa*4+c] + r1[xb*4+c];
+      dst[x*4+c] = static_cast<uint8_t>((sum + 2) / 4);
+    }
+  }
+}
+
+void downsampleRowR16(const uint16_t* r0, const uint16_t* r1, size_t w, size_t x0, size_t dstW, uint16_t* dst, bool takeMin) {
+  for(size_t x = x0; x < dstW; x++) {
+    const size_t xa = min(2*x, w-1), xb = min(2*x+1, w-1);
+    if(takeMin) {
+      dst[x] = min(min(r0[xa], r0[xb]), min(r1[xa], r1[xb]));
+    } else {
+      dst[x] = max(max(r0[xa], r0[xb]), max(r1[xa], r1[xb]));
+    }
+  }
+}
+
+// MurmurHash64A
+uint64_t hashBytes(const uint8_t* data, size_t n, uint64_t h) {
+  const uint64_t m = 0xc6a4a7935bd1e995ull;
+  const int r = 47;
+
+  h ^= n * m;
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8) {
+    uint64_t k;
+    memcpy(&k, data + i, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  if(i < n) {
+    uint64_t k = 0;
+    memcpy(&k, data + i, n - i);
+    h ^= k;
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+#ifdef __SSE2__
+// SSE2 only has signed 16 bit min/max, so unsigned values are biased into signed range first
+template <bool TAKE_MIN>
+inline __m128i minmaxEpi16(__m128i a, __m128i b) {
+  return TAKE_MIN ? _mm_min_epi16(a, b) : _mm_max_epi16(a, b);
+}
+
+template <bool TAKE_MIN>
+size_t downsampleRowR16SSE2(const uint16_t* r0, const uint16_t* r1, size_t dstW, uint16_t* dst) {
+  const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+  size_t x = 0;
+  for(; x + 8 <= dstW; x += 8) {
+    // Vertical reduction of 16 source texels
+    const __m128i a0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2*x)), bias);
+    const __m128i a1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2*x + 8)), bias);
+    const __m128i b0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2*x)), bias);
+    const __m128i b1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2*x + 8)), bias);
+    const __m128i v0 = minmaxEpi16<TAKE_MIN>(a0, b0);
+    const __m128i v1 = minmaxEpi16<TAKE_MIN>(a1, b1);
+
+    // Horizontal reduction of neighboring texels, sign extended into 32 bit lanes
+    const __m128i h0 = minmaxEpi16<TAKE_MIN>(_mm_srai_epi32(_mm_slli_epi32(v0, 16), 16), _mm_srai_epi32(v0, 16));
+    const __m128i h1 = minmaxEpi16<TAKE_MIN>(_mm_srai_epi32(_mm_slli_epi32(v1, 16), 16), _mm_srai_epi32(v1, 16));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_xor_si128(_mm_packs_epi32(h0, h1), bias));
+  }
+  return x;
+}
+
+size_t downsampleRowRGBA8SSE2(const uint8_t* r0, const uint8_t* r1, size_t dstW, uint8_t* dst) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  size_t x = 0;
+  for(; x + 4 <= dstW; x += 4) {
+    // Load 8 source texels from each row and split them into even and odd texels
+    const __m128 a0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 8*x)));
+    const __m128 a1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 8*x + 16)));
+    const __m128 b0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 8*x)));
+    const __m128 b1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 8*x + 16)));
+    const __m128i q[4] = {
+      _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0))),
+      _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1))),
+      _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0))),
+      _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)))
+    };
+
+    // Sum the four texels of each block in 16 bit lanes so the result is rounded exactly like the scalar path
+    __m128i lo = two, hi = two;
+    for(size_t k = 0; k < 4; k++) {
+      lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(q[k], zero));
+      hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(q[k], zero));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4*x),
+                     _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2)));
+  }
+  return x;
+}
+#endif
+
+}
+
+size_t MipChain::fullChainLength(size_t w, size_t h) {
+  size_t n = 1;
+  while(w > 1 || h > 1) {
+    w = max<size_t>(w / 2, 1);
+    h = max<size_t>(h / 2, 1);
+    n += 1;
+  }
+  return n;
+}
+
+void downsampleRGBA8(const uint8_t* src, size_t w, size_t h, uint8_t* dst) {
+  const size_t dstW = max<size_t>(w / 2, 1), dstH = max<size_t>(h / 2, 1);
+  for(size_t y = 0; y < dstH; y++) {
+    const uint8_t* r0 = src + min(2*y, h-1) * w * 4;
+    const uint8_t* r1 = src + min(2*y+1, h-1) * w * 4;
+    uint8_t* d = dst + y * dstW * 4;
+
+    size_t x0 = 0;
+#ifdef __SSE2__
+    if(w % 2 == 0) {
+      x0 = downsampleRowRGBA8SSE2(r0, r1, dstW, d);
+    }
+#endif
+    downsampleRowRGBA8(r0, r1, w, x0, dstW, d);
+  }
+}
+
+void downsampleR16(const uint16_t* src, size_t w, size_t h, uint16_t* dst, MipReduction reduction) {
+  if(reduction == MipReduction::AVERAGE) {
+    throw std::runtime_error("downsampleR16: only MIN and MAX reductions are supported");
+  }
+  const bool takeMin = reduction == MipReduction::MIN;
+
+  const size_t dstW = max<size_t>(w / 2, 1), dstH = max<size_t>(h / 2, 1);
+  for(size_t y = 0; y < dstH; y++) {
+    const uint16_t* r0 = src + min(2*y, h-1) * w;
+    const uint16_t* r1 = src + min(2*y+1, h-1) * w;
+    uint16_t* d = dst + y * dstW;
+
+    size_t x0 = 0;
+#ifdef __SSE2__
+    if(w % 2 == 0) {
+      x0 = takeMin ? downsampleRowR16SSE2<true>(r0, r1, dstW, d) : downsampleRowR16SSE2<false>(r0, r1, dstW, d);
+    }
+#endif
+    downsampleRowR16(r0, r1, w, x0, dstW, d, takeMin);
+  }
+}
+
+void generateMipChain(MipChain& chain, MipReduction reduction) {
+  const size_t numLevels = MipChain::fullChainLength(chain.width, chain.height);
+  chain.levels.resize(numLevels);
+
+  for(size_t level = 1; level < numLevels; level++) {
+    const size_t w = chain.levelWidth(level-1), h = chain.levelHeight(level-1);
+    chain.levels[level].resize(chain.levelWidth(level) * chain.levelHeight(level) * chain.bytesPerTexel);
+    const uint8_t* src = chain.levels[level-1].data();
+    uint8_t* dst = chain.levels[level].data();
+
+    switch(chain.bytesPerTexel) {
+    case 4:
+      downsampleRGBA8(src, w, h, dst);
+      break;
+    case 2:
+      downsampleR16(reinterpret_cast<const uint16_t*>(src), w, h, reinterpret_cast<uint16_t*>(dst), reduction);
+      break;
+    default:
+      throw std::runtime_error("generateMipChain: unsupported texel size");
+    }
+  }
+}
+
+uint64_t hashImage(const MipChain& chain, bool mirrored, uint64_t seed) {
+  const size_t rowBytes = chain.width * chain.bytesPerTexel;
+  const uint8_t* base = chain.levels[0].data();
+
+  // Hash row by row, chaining each row's hash into the next
+  std::vector<uint8_t> row(rowBytes);
+  uint64_t h = seed ^ (chain.width * 31 + chain.height * 17 + chain.bytesPerTexel);
+  for(size_t y = 0; y < chain.height; y++) {
+    const uint8_t* src = base + y * rowBytes;
+    if(mirrored) {
+      for(size_t x = 0; x < chain.width; x++) {
+        memcpy(&row[x * chain.bytesPerTexel], src + (chain.width - 1 - x) * chain.bytesPerTexel, chain.bytesPerTexel);
+      }
+      src = row.data();
+    }
+    h = hashBytes(src, rowBytes, h);
+  }
+  return h;
+}
+
+bool readMipCache(const std::string& path, time_t sourceMTime, MipChain& chain) {
+  ifstream in(path.c_str(), ios::in | ios::binary);
+  if(!in) {
+    return false;
+  }
+
+  // Any other modification time, older or newer, means the source has been replaced
+  MipCacheHeader header;
+  if(!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+     memcmp(header.magic, MIP_CACHE_MAGIC, sizeof(MIP_CACHE_MAGIC)) != 0 ||
+     header.version != MIP_CACHE_VERSION ||
+     header.sourceMTime != static_cast<int64_t>(sourceMTime)) {
+    return false;
+  }
+
+  // Don't trust the header to size the chain until it describes a chain this code could
+  // have written, of exactly the size of the rest of the file
+  if(header.width == 0 || header.height == 0 ||
+     header.width > MAX_MIP_CACHE_DIMENSION || header.height > MAX_MIP_CACHE_DIMENSION ||
+     (header.bytesPerTexel != 2 && header.bytesPerTexel != 4) ||
+     header.numLevels != MipChain::fullChainLength(header.width, header.height)) {
+    return false;
+  }
+
+  MipChain read;
+  read.width = header.width;
+  read.height = header.height;
+  read.bytesPerTexel = header.bytesPerTexel;
+  size_t dataBytes = 0;
+  for(size_t level = 0; level < header.numLevels; level++) {
+    dataBytes += read.levelWidth(level) * read.levelHeight(level) * read.bytesPerTexel;
+  }
+  const streampos dataStart = in.tellg();
+  if(!in.seekg(0, ios::end) || in.tellg() - dataStart != static_cast<streamoff>(dataBytes) ||
+     !in.seekg(dataStart)) {
+    return false;
+  }
+
+  read.levels.resize(header.numLevels);
+  for(size_t level = 0; level < read.levels.size(); level++) {
+    read.levels[level].resize(read.levelWidth(level) * read.levelHeight(level) * read.bytesPerTexel);
+    if(!in.read(reinterpret_cast<char*>(read.levels[level].data()), read.levels[level].size())) {
+      return false;
+    }
+  }
+  chain = std::move(read);
+  return true;
+}
+
+bool writeMipCache(const std::string& path, time_t sourceMTime, const MipChain& chain) {
+  // Write to a temporary file first so a concurrent reader never sees a partial cache
+  const std::string tmpPath = path + ".tmp";
+  {
+    ofstream out(tmpPath.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!out) {
+      return false;
+    }
+
+    MipCacheHeader header;
+    memcpy(header.magic, MIP_CACHE_MAGIC, sizeof(MIP_CACHE_MAGIC));
+    header.version = MIP_CACHE_VERSION;
+    header.width = chain.width;
+    header.height = chain.height;
+    header.bytesPerTexel = chain.bytesPerTexel;
+    header.numLevels = chain.levels.size();
+    header.sourceMTime = sourceMTime;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(auto i = chain.levels.begin(); i != chain.levels.end(); i++) {
+      out.write(reinterpret_cast<const char*>(i->data()), i->size());
+    }
+    if(!out) {
+      return false;
+    }
+  }
+  return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+}
@@ -0,0 +1,87 @@
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#ifndef UTILS_MIPMAP_H_
+#define UTILS_MIPMAP_H_
+
+namespace utils {
+
+/*
+ * How four texels of one mip level are combined into one texel of the next level
+ */
+enum class MipReduction {
+  AVERAGE, // Box filter, for color data
+  MIN,     // Keep the smallest value, e.g. the nearest depth
+  MAX      // Keep the largest value, e.g. the farthest depth
+};
+
+/*
+ * A tightly packed image and all of its mip levels down to 1x1
+ */
+struct MipChain {
+  size_t width = 0;
+  size_t height = 0;
+  size_t bytesPerTexel = 0;
+  std::vector<std::vector<uint8_t>> levels;
+
+  size_t levelWidth(size_t level) const {
+    return width >> level > 0 ? width >> level : 1;
+  }
+
+  size_t levelHeight(size_t level) const {
+    return height >> level > 0 ? height >> level : 1;
+  }
+
+  size_t numLevels() const {
+    return levels.size();
+  }
+
+  /*
+   * The number of levels in a full chain for a w by h image
+   */
+  static size_t fullChainLength(size_t w, size_t h);
+};
+
+/*
+ * Halve a w by h RGBA8 image with a 2x2 box filter into dst
+ */
+void downsampleRGBA8(const uint8_t* src, size_t w, size_t h, uint8_t* dst);
+
+/*
+ * Halve a w by h single channel 16 bit image into dst keeping the min or max of each 2x2 block
+ */
+void downsampleR16(const uint16_t* src, size_t w, size_t h, uint16_t* dst, MipReduction reduction);
+
+/*
+ * Build the full mip chain of an image whose base level has already been filled in.
+ * Supported formats are RGBA8 (4 bytes per texel, averaged) and R16 (2 bytes per texel,
+ * min or max reduced).
+ */
+void generateMipChain(MipChain& chain, MipReduction reduction);
+
+/*
+ * A 64 bit hash of the base level of an image, used to find identical images.
+ * If mirrored is set, the hash is that of the image flipped horizontally, so an image A
+ * is a mirror image of B if hashImage(A, true) == hashImage(B, false). Hashes with
+ * different seeds are independent, so several can be combined into a wider hash.
+ */
+uint64_t hashImage(const MipChain& chain, bool mirrored = false, uint64_t seed = 0);
+
+/*
+ * Read a mip chain cached by writeMipCache. Returns false if the cache does not exist, is
+ * unreadable or corrupt, or was made from a source with any modification time other than
+ * sourceMTime. chain is only changed if the cache is read.
+ */
+bool readMipCache(const std::string& path, time_t sourceMTime, MipChain& chain);
+
+/*
+ * Cache a mip chain on disk. Returns false if the file could not be written.
+ */
+bool writeMipCache(const std::string& path, time_t sourceMTime, const MipChain& chain);
+
+}
+
+#endif /* UTILS_MIPMAP_H_ */
@@ -0,0 +1,75 @@
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <vector>
+#include <type_traits>
+
+#ifndef UTILS_RADIX_SORT_H_
+#define UTILS_RADIX_SORT_H_
+
+namespace utils {
+
+/*
+ * Map a float to an unsigned integer which sorts in the same order as the float
+ */
+inline uint32_t sortableFloatKey(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+
+	// Negative floats sort backwards, so flip all their bits. Positive ones just need to
+	// sort after the negatives.
+	return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+/*
+ * Stable LSD radix sort of values by their unsigned integer keys, in ascending key order.
+ * keys and values must be the same size, and both are reordered. Keys are sorted 8 bits at
+ * a time, and passes where every key has the same digit are skipped.
+ */
+template <class Key, class T>
+void radixSortByKey(std::vector<Key>& keys, std::vector<T>& values) {
+	static_assert(std::is_unsigned<Key>::value, "radixSortByKey needs unsigned integer keys");
+
+	const size_t n = keys.size();
+	const size_t NUM_DIGITS = sizeof(Key);
+
+	// Build the histograms of every digit in one pass over the keys
+	std::vector<std::array<size_t, 256>> counts(NUM_DIGITS);
+	for(auto c = counts.begin(); c != counts.end(); c++) {
+		c->fill(0);
+	}
+	for(size_t i = 0; i < n; i++) {
+		for(size_t d = 0; d < NUM_DIGITS; d++) {
+			counts[d][(keys[i] >> (d * 8)) & 0xff]++;
+		}
+	}
+
+	std::vector<Key> keysTmp(n);
+	std::vector<T> valuesTmp(n);
+	for(size_t d = 0; d < NUM_DIGITS; d++) {
+		std::array<size_t, 256>& count = counts[d];
+		if(n == 0 || count[(keys[0] >> (d * 8)) & 0xff] == n) {
+			continue;
+		}
+
+		// Turn the counts into the first output position of each digit
+		size_t offset = 0;
+		for(size_t b = 0; b < 256; b++) {
+			const size_t c = count[b];
+			count[b] = offset;
+			offset += c;
+		}
+
+		for(size_t i = 0; i < n; i++) {
+			const size_t dst = count[(keys[i] >> (d * 8)) & 0xff]++;
+			keysTmp[dst] = keys[i];
+			valuesTmp[dst] = std::move(values[i]);
+		}
+		keys.swap(keysTmp);
+		values.swap(valuesTmp);
+	}
+}
+
+}
+
+#endif /* UTILS_RADIX_SORT_H_ */
@@ -0,0 +1,131 @@
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <iterator>
+#include <stdexcept>
+
+#ifndef UTILS_RANGE_ALLOCATOR_H_
+#define UTILS_RANGE_ALLOCATOR_H_
+
+namespace utils {
+
+/*
+ * Hands out ranges of [0, capacity) first fit, for suballocating a buffer. Only the free
+ * ranges are tracked, so the caller must remember the size of each range it allocates to free
+ * it again. Freed ranges are merged with their free neighbours.
+ */
+class RangeAllocator {
+	// The start of every free range, mapped to its size
+	std::map<size_t, size_t> mFree;
+	size_t mCapacity = 0;
+	size_t mFreeSpace = 0;
+
+public:
+	// Returned by allocate when there is no free range big enough
+	static const size_t FAILED = SIZE_MAX;
+
+	RangeAllocator() = default;
+
+	explicit RangeAllocator(size_t capacity) : mCapacity(capacity), mFreeSpace(capacity) {
+		if(capacity > 0) {
+			mFree[0] = capacity;
+		}
+	}
+
+	/*
+	 * The start of a free range of size elements, or FAILED if there is none. Allocating 0
+	 * elements always succeeds and returns 0.
+	 */
+	size_t allocate(size_t size) {
+		if(size == 0) {
+			return 0;
+		}
+		for(auto r = mFree.begin(); r != mFree.end(); r++) {
+			if(r->second >= size) {
+				const size_t start = r->first;
+				const size_t remaining = r->second - size;
+				mFree.erase(r);
+				if(remaining > 0) {
+					mFree[start + size] = remaining;
+				}
+				mFreeSpace -= size;
+				return start;
+			}
+		}
+		return FAILED;
+	}
+
+	/*
+	 * Return a range given by allocate to the free ranges
+	 */
+	void free(size_t start, size_t size) {
+		if(size == 0) {
+			return;
+		}
+		if(start + size > mCapacity) {
+			throw std::runtime_error("Freed a range outside of the RangeAllocator");
+		}
+
+		const size_t freed = size;
+		auto next = mFree.lower_bound(start);
+		if(next != mFree.end() && next->first < start + size) {
+			throw std::runtime_error("Freed a range which is already free");
+		}
+
+		// Merge with the free range before, if it ends where this one starts
+		if(next != mFree.begin()) {
+			auto prev = std::prev(next);
+			if(prev->first + prev->second > start) {
+				throw std::runtime_error("Freed a range which is already free");
+			}
+			if(prev->first + prev->second == start) {
+				start = prev->first;
+				size += prev->second;
+				mFree.erase(prev);
+			}
+		}
+
+		// And with the free range after, if it starts where this one ends
+		if(next != mFree.end() && next->first == start + size) {
+			size += next->second;
+			mFree.erase(next);
+		}
+
+		mFree[start] = size;
+		mFreeSpace += freed;
+	}
+
+	/*
+	 * Add room at the end, up to a new capacity which must be larger than the current one
+	 */
+	void grow(size_t capacity) {
+		if(capacity <= mCapacity) {
+			throw std::runtime_error("A RangeAllocator can only grow");
+		}
+		const size_t oldCapacity = mCapacity;
+		mCapacity = capacity;
+		free(oldCapacity, capacity - oldCapacity);
+	}
+
+	size_t capacity() const {
+		return mCapacity;
+	}
+
+	/*
+	 * The total number of free elements, which may be split over many ranges
+	 */
+	size_t freeSpace() const {
+		return mFreeSpace;
+	}
+
+	/*
+	 * The number of separate free ranges
+	 */
+	size_t numFreeRanges() const {
+		return mFree.size();
+	}
+};
+
+}
+
+#endif /* UTILS_RANGE_ALLOCATOR_H_ */
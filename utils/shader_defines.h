@@ -0,0 +1,108 @@
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef UTILS_SHADER_DEFINES_H_
+#define UTILS_SHADER_DEFINES_H_
+
+namespace utils {
+
+/*
+ * The preprocessor defines a shader variant is compiled with. Features which are off are left
+ * undefined, so the GLSL preprocessor strips the code under them before it is compiled, and
+ * counts such as the number of lights become constants the compiler can unroll loops over.
+ *
+ * Defines are kept sorted by name, so the same set always has the same key whatever order it
+ * was built in.
+ */
+class ShaderDefines {
+	// Each defined name, mapped to its value, which is empty for names defined without one
+	std::map<std::string, std::string> mDefines;
+
+public:
+	ShaderDefines() = default;
+
+	/*
+	 * Defines given as GLProgramBuilder takes them, "NAME" or "NAME VALUE"
+	 */
+	ShaderDefines(const std::vector<std::string>& defines) {
+		for(auto d = defines.begin(); d != defines.end(); d++) {
+			std::istringstream iss(*d);
+			std::string name, value;
+			if(!(iss >> name)) {
+				throw std::runtime_error("Empty shader define");
+			}
+			std::getline(iss >> std::ws, value);
+			define(name, value);
+		}
+	}
+
+	ShaderDefines& define(const std::string& name, const std::string& value = std::string()) {
+		mDefines[name] = value;
+		return *this;
+	}
+
+	ShaderDefines& define(const std::string& name, long value) {
+		return define(name, std::to_string(value));
+	}
+
+	/*
+	 * Define name if on is true, and undefine it otherwise
+	 */
+	ShaderDefines& enable(const std::string& name, bool on) {
+		if(on) {
+			return define(name);
+		}
+		return undefine(name);
+	}
+
+	ShaderDefines& undefine(const std::string& name) {
+		mDefines.erase(name);
+		return *this;
+	}
+
+	bool defined(const std::string& name) const {
+		return mDefines.find(name) != mDefines.end();
+	}
+
+	size_t size() const {
+		return mDefines.size();
+	}
+
+	/*
+	 * The defines as GLProgramBuilder takes them, in order of name
+	 */
+	std::vector<std::string> list() const {
+		std::vector<std::string> defines;
+		for(auto d = mDefines.begin(); d != mDefines.end(); d++) {
+			defines.push_back(d->second.empty() ? d->first : d->first + " " + d->second);
+		}
+		return defines;
+	}
+
+	/*
+	 * A string which is equal for two sets exactly when they define the same names to the
+	 * same values
+	 */
+	std::string key() const {
+		std::string key;
+		for(auto d = mDefines.begin(); d != mDefines.end(); d++) {
+			key.append(d->first).append("=").append(d->second).append(";");
+		}
+		return key;
+	}
+
+	bool operator==(const ShaderDefines& other) const {
+		return mDefines == other.mDefines;
+	}
+
+	bool operator!=(const ShaderDefines& other) const {
+		return mDefines != other.mDefines;
+	}
+};
+
+}
+
+#endif /* UTILS_SHADER_DEFINES_H_ */
@@ -0,0 +1,123 @@
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+
+#ifndef UTILS_THREAD_POOL_H_
+#define UTILS_THREAD_POOL_H_
+
+namespace utils {
+
+/*
+ * A fixed set of worker threads which run submitted jobs in FIFO order
+ */
+class ThreadPool {
+	std::vector<std::thread> mWorkers;
+	std::queue<std::function<void()>> mJobs;
+	std::mutex mMutex;
+	std::condition_variable mJobAvailable;
+	bool mStopping = false;
+
+	void workerLoop() {
+		for(;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mJobAvailable.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+				if(mStopping && mJobs.empty()) {
+					return;
+				}
+				job = std::move(mJobs.front());
+				mJobs.pop();
+			}
+			job();
+		}
+	}
+
+public:
+	ThreadPool(size_t numThreads = std::thread::hardware_concurrency()) {
+		numThreads = numThreads == 0 ? 1 : numThreads;
+		for(size_t i = 0; i < numThreads; i++) {
+			mWorkers.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStopping = true;
+		}
+		mJobAvailable.notify_all();
+		for(auto i = mWorkers.begin(); i != mWorkers.end(); i++) {
+			i->join();
+		}
+	}
+
+	size_t size() const {
+		return mWorkers.size();
+	}
+
+	/*
+	 * Queue f to run on a worker thread. Returns a future holding its result.
+	 * Exceptions thrown by f are rethrown when the future is read.
+	 */
+	template <class F>
+	std::future<typename std::result_of<F()>::type> submit(F f) {
+		typedef typename std::result_of<F()>::type R;
+		auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+		std::future<R> ret = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mJobs.push([task] { (*task)(); });
+		}
+		mJobAvailable.notify_one();
+		return ret;
+	}
+
+	/*
+	 * Run f(i) for every i in [begin, end) on the workers, in about one contiguous chunk per
+	 * worker, and wait for all of them to finish. Exceptions thrown by f are rethrown here.
+	 * This must not be called from a job running on the same pool.
+	 */
+	template <class F>
+	void parallelFor(size_t begin, size_t end, const F& f) {
+		if(begin >= end) {
+			return;
+		}
+
+		const size_t numChunks = std::min(end - begin, size());
+		const size_t chunkSize = (end - begin + numChunks - 1) / numChunks;
+
+		std::vector<std::future<void>> chunks;
+		chunks.reserve(numChunks);
+		for(size_t c = begin; c < end; c += chunkSize) {
+			const size_t chunkEnd = std::min(c + chunkSize, end);
+			chunks.push_back(submit([c, chunkEnd, &f] {
+				for(size_t i = c; i < chunkEnd; i++) {
+					f(i);
+				}
+			}));
+		}
+
+		// Every chunk refers to f, so wait for all of them before an exception can unwind it
+		for(auto c = chunks.begin(); c != chunks.end(); c++) {
+			c->wait();
+		}
+		for(auto c = chunks.begin(); c != chunks.end(); c++) {
+			c->get();
+		}
+	}
+};
+
+}
+
+#endif /* UTILS_THREAD_POOL_H_ */